@@ -2,8 +2,16 @@
 #include "client-utils.h"
 #include "config.h"
 #include "format.h"
+#include "session-recording.h"
 #include <purple.h>
 #include <algorithm>
+#include <stdio.h>
+
+#ifdef CHECK_ACCOUNT_DATA_INDEXES
+#define CHECK_INDEXES() checkIndexes()
+#else
+#define CHECK_INDEXES()
+#endif
 
 static bool isCanonicalPhoneNumber(const char *s)
 {
@@ -45,13 +53,28 @@ SecretChatId purpleBuddyNameToSecretChatId(const char *s)
     return SecretChatId::fromString(s+6);
 }
 
-static bool isPhoneEqual(const std::string &n1, const std::string &n2)
+static std::string makeSuffixedName(const std::string &baseName, unsigned n)
+{
+    return baseName + " #" + std::to_string(n);
+}
+
+template<typename Key, typename Id>
+static void addToIndex(std::unordered_map<Key, Id> &index, const Key &key, Id id)
 {
-    const char *s1 = n1.c_str();
-    const char *s2 = n2.c_str();
-    if (*s1 == '+') s1++;
-    if (*s2 == '+') s2++;
-    return !strcmp(s1, s2);
+    auto ret = index.emplace(key, id);
+    if (!ret.second && (id < ret.first->second))
+        ret.first->second = id;
+}
+
+template<typename Key, typename Id>
+static bool removeFromIndex(std::unordered_map<Key, Id> &index, const Key &key, Id id)
+{
+    auto it = index.find(key);
+    if ((it != index.end()) && (it->second == id)) {
+        index.erase(it);
+        return true;
+    }
+    return false;
 }
 
 bool isPrivateChat(const td::td_api::chat &chat)
@@ -97,6 +120,41 @@ SecretChatId getSecretChatId(const td::td_api::chat &chat)
     return SecretChatId::invalid;
 }
 
+void compactUser(td::td_api::user &user)
+{
+    // Only small profile photo is ever downloaded
+    if (user.profile_photo_) {
+        user.profile_photo_->big_           = nullptr;
+        user.profile_photo_->minithumbnail_ = nullptr;
+    }
+    std::string().swap(user.restriction_reason_);
+    std::string().swap(user.language_code_);
+}
+
+void compactChat(td::td_api::chat &chat)
+{
+    if (chat.photo_) {
+        chat.photo_->big_           = nullptr;
+        chat.photo_->minithumbnail_ = nullptr;
+    }
+    // Last message is kept track of through updateChatLastMessage, and with all its content
+    // it is by far the largest part of a chat
+    chat.last_message_          = nullptr;
+    chat.permissions_           = nullptr;
+    chat.notification_settings_ = nullptr;
+    chat.action_bar_            = nullptr;
+    chat.draft_message_         = nullptr;
+    std::string().swap(chat.client_data_);
+}
+
+static bool hasSameIndexKeys(const td::td_api::chat &chat1, const td::td_api::chat &chat2)
+{
+    return (getUserIdByPrivateChat(chat1) == getUserIdByPrivateChat(chat2)) &&
+           (getBasicGroupId(chat1) == getBasicGroupId(chat2)) &&
+           (getSupergroupId(chat1) == getSupergroupId(chat2)) &&
+           (getSecretChatId(chat1) == getSecretChatId(chat2));
+}
+
 bool isGroupMember(const td::td_api::object_ptr<td::td_api::ChatMemberStatus> &status)
 {
     if (!status)
@@ -138,22 +196,54 @@ static std::string makeDisplayName(const td::td_api::user &user)
     return result;
 }
 
-auto PendingMessageQueue::getChatQueue(ChatId chatId) -> std::vector<ChatQueue>::iterator 
+auto PendingMessageQueue::getChatQueue(ChatId chatId) -> ChatQueue *
 {
-    return std::find_if(m_queues.begin(), m_queues.end(), [chatId](const ChatQueue &queue) {
-        return (queue.chatId == chatId);
-    });
+    auto it = m_queues.find(chatId.value());
+    return (it != m_queues.end()) ? &it->second : nullptr;
+}
+
+auto PendingMessageQueue::createChatQueue(ChatId chatId) -> ChatQueue &
+{
+    ChatQueue &queue = m_queues[chatId.value()];
+    queue.chatId        = chatId;
+    queue.creationOrder = m_queuesCreated++;
+    return queue;
 }
 
-PendingMessageQueue::Message &PendingMessageQueue::addMessage(ChatQueue &queue, MessageAction action)
+IncomingMessage &PendingMessageQueue::addMessage(ChatQueue &queue, IncomingMessage &&message,
+                                                 MessageAction action, bool ready)
 {
+    Message *newEntry;
+    int64_t  position;
     if (action == MessageAction::Append) {
+        position = queue.frontPosition + queue.messages.size();
         queue.messages.emplace_back();
-        return queue.messages.back();
+        newEntry = &queue.messages.back();
     } else {
+        position = --queue.frontPosition;
         queue.messages.emplace_front();
-        return queue.messages.front();
+        newEntry = &queue.messages.front();
     }
+
+    newEntry->ready    = ready;
+    newEntry->taken    = false;
+    newEntry->queuedAt = g_get_monotonic_time();
+    newEntry->message  = std::move(message);
+    queue.positions.emplace(newEntry->message.message->id_, position);
+    return newEntry->message;
+}
+
+auto PendingMessageQueue::findMessage(ChatQueue &queue, MessageId messageId) -> Message *
+{
+    // Same message queued more than once is not expected, but if it happens, the first one wins
+    auto    range    = queue.positions.equal_range(messageId.value());
+    int64_t position = INT64_MAX;
+    for (auto it = range.first; it != range.second; ++it)
+        position = std::min(position, it->second);
+
+    if (position == INT64_MAX)
+        return nullptr;
+    return &queue.messages[position - queue.frontPosition];
 }
 
 IncomingMessage &PendingMessageQueue::addPendingMessage(IncomingMessage &&message,
@@ -161,45 +251,57 @@ IncomingMessage &PendingMessageQueue::addPendingMessage(IncomingMessage &&messag
 {
     if (!message.message) return message;
 
-    ChatId     chatId  = getChatId(*message.message);
-    auto       queueIt = getChatQueue(chatId);
-    ChatQueue *queue;
+    ChatId     chatId = getChatId(*message.message);
+    ChatQueue *queue  = getChatQueue(chatId);
     purple_debug_misc(config::pluginId,"MessageQueue: chat %" G_GINT64_FORMAT ": "
                       "adding pending message %" G_GINT64_FORMAT " (not ready)\n",
                       chatId.value(), message.message->id_);
 
-    if (queueIt != m_queues.end())
-        queue = &*queueIt;
-    else {
-        m_queues.emplace_back();
-        m_queues.back().chatId = chatId;
-        queue = &m_queues.back();
-    }
+    if (!queue)
+        queue = &createChatQueue(chatId);
 
-    Message &newEntry = addMessage(*queue, action);
-    newEntry.ready = false;
-    newEntry.message = std::move(message);
-    return newEntry.message;
+    return addMessage(*queue, std::move(message), action, false);
 }
 
-void PendingMessageQueue::extractReadyMessages(
-    std::vector<ChatQueue>::iterator pQueue,
-    std::vector<IncomingMessage> &readyMessages)
+void PendingMessageQueue::setOrderPolicy(OrderPolicy policy, unsigned reorderWindowMs)
 {
-    std::list<Message>::iterator pReady;
-    for (pReady = pQueue->messages.begin(); pReady != pQueue->messages.end(); ++pReady) {
-        if (!pReady->ready) break;
-        purple_debug_misc(config::pluginId,"MessageQueue: chat %" G_GINT64_FORMAT ": "
-                            "showing message %" G_GINT64_FORMAT "\n",
-                            pQueue->chatId.value(), getId(*pReady->message.message).value());
-        readyMessages.push_back(std::move(pReady->message));
-    }
+    m_policy          = policy;
+    m_reorderWindowMs = reorderWindowMs;
+}
+
+void PendingMessageQueue::takeMessage(ChatQueue &queue, Message &message, int64_t position,
+                                      std::vector<IncomingMessage> &readyMessages, gint64 now)
+{
+    int64_t messageId = getId(*message.message.message).value();
+    purple_debug_misc(config::pluginId,"MessageQueue: chat %" G_GINT64_FORMAT ": "
+                        "showing message %" G_GINT64_FORMAT "\n",
+                        queue.chatId.value(), messageId);
+
+    auto range = queue.positions.equal_range(messageId);
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->second == position) {
+            queue.positions.erase(it);
+            break;
+        }
+
+    m_waitTime.add(now - message.queuedAt);
+    readyMessages.push_back(std::move(message.message));
+    message.taken = true;
+}
 
-    pQueue->messages.erase(pQueue->messages.begin(), pReady);
-    if (pQueue->messages.empty()) {
-        m_queues.erase(pQueue);
-        pQueue = m_queues.end();
+void PendingMessageQueue::extractReadyMessages(ChatQueue &queue,
+                                               std::vector<IncomingMessage> &readyMessages)
+{
+    gint64 now = g_get_monotonic_time();
+    while (!queue.messages.empty() && queue.messages.front().ready) {
+        if (!queue.messages.front().taken)
+            takeMessage(queue, queue.messages.front(), queue.frontPosition, readyMessages, now);
+        queue.messages.pop_front();
+        queue.frontPosition++;
     }
+
+    if (queue.messages.empty())
+        m_queues.erase(queue.chatId.value());
 }
 
 void PendingMessageQueue::setMessageReady(ChatId chatId, MessageId messageId,
@@ -207,21 +309,19 @@ void PendingMessageQueue::setMessageReady(ChatId chatId, MessageId messageId,
 {
     readyMessages.clear();
 
-    auto pQueue = getChatQueue(chatId);
-    if (pQueue == m_queues.end()) return;
+    ChatQueue *queue = getChatQueue(chatId);
+    if (!queue) return;
 
     purple_debug_misc(config::pluginId,"MessageQueue: chat %" G_GINT64_FORMAT ": "
                       "message %" G_GINT64_FORMAT " now ready\n",
                       chatId.value(), messageId.value());
 
-    auto it = std::find_if(pQueue->messages.begin(), pQueue->messages.end(), [messageId](const Message &m) {
-        return (getId(*m.message.message) == messageId);
-    });
-    if (it == pQueue->messages.end()) return;
+    Message *message = findMessage(*queue, messageId);
+    if (!message) return;
 
-    it->ready = true;
-    if (pQueue->ready && (it == pQueue->messages.begin()))
-        extractReadyMessages(pQueue, readyMessages);
+    message->ready = true;
+    if (queue->ready && (message == &queue->messages.front()))
+        extractReadyMessages(*queue, readyMessages);
 }
 
 IncomingMessage PendingMessageQueue::addReadyMessage(IncomingMessage &&message,
@@ -229,74 +329,235 @@ IncomingMessage PendingMessageQueue::addReadyMessage(IncomingMessage &&message,
 {
     if (!message.message) return IncomingMessage();
 
-    ChatId chatId  = getChatId(*message.message);
-    auto   queueIt = getChatQueue(chatId);
-    if (queueIt == m_queues.end())
+    ChatId     chatId = getChatId(*message.message);
+    ChatQueue *queue  = getChatQueue(chatId);
+    if (!queue)
         return std::move(message);
 
     purple_debug_misc(config::pluginId,"MessageQueue: chat %" G_GINT64_FORMAT ": "
                       "adding pending message %" G_GINT64_FORMAT " (ready)\n",
                       chatId.value(), message.message->id_);
 
-    Message &newEntry = addMessage(*queueIt, action);
-    newEntry.ready = true;
-    newEntry.message = std::move(message);
-
+    addMessage(*queue, std::move(message), action, true);
     return IncomingMessage();
 }
 
 IncomingMessage *PendingMessageQueue::findPendingMessage(ChatId chatId, MessageId messageId)
 {
-    auto queueIt = getChatQueue(chatId);
-    if (queueIt == m_queues.end()) return nullptr;
-    ChatQueue *queue = &*queueIt;
+    ChatQueue *queue = getChatQueue(chatId);
+    if (!queue) return nullptr;
 
-    auto it = std::find_if(queue->messages.begin(), queue->messages.end(), [messageId](const Message &m) {
-        return (getId(*m.message.message) == messageId);
-    });
-    return (it != queue->messages.end()) ? &it->message : nullptr;
+    Message *message = findMessage(*queue, messageId);
+    return message ? &message->message : nullptr;
 }
 
 void PendingMessageQueue::flush(std::vector<IncomingMessage> &messages)
 {
+    // Chats in the order their queues were created, like it used to be with a list of queues
+    std::vector<ChatQueue *> queues;
+    for (auto &entry: m_queues)
+        queues.push_back(&entry.second);
+    std::sort(queues.begin(), queues.end(), [](const ChatQueue *queue1, const ChatQueue *queue2) {
+        return (queue1->creationOrder < queue2->creationOrder);
+    });
+
     messages.clear();
-    for (ChatQueue &queue: m_queues)
-        for (Message &message: queue.messages)
-            messages.push_back(std::move(message.message));
+    for (ChatQueue *queue: queues)
+        for (Message &message: queue->messages)
+            if (!message.taken)
+                messages.push_back(std::move(message.message));
     m_queues.clear();
 }
 
 void PendingMessageQueue::setChatNotReady(ChatId chatId)
 {
-    auto pQueue = getChatQueue(chatId);
-    if (pQueue != m_queues.end())
-        pQueue->ready = false;
-    else {
-        m_queues.emplace_back();
-        m_queues.back().chatId = chatId;
-        m_queues.back().ready = false;
-    }
+    ChatQueue *queue = getChatQueue(chatId);
+    if (!queue)
+        queue = &createChatQueue(chatId);
+    queue->ready = false;
 }
 
 void PendingMessageQueue::setChatReady(ChatId chatId, std::vector<IncomingMessage>& readyMessages)
 {
     readyMessages.clear();
-    auto pQueue = getChatQueue(chatId);
-    if (pQueue == m_queues.end()) return;
+    ChatQueue *queue = getChatQueue(chatId);
+    if (!queue) return;
 
-    pQueue->ready = true;
-    extractReadyMessages(pQueue, readyMessages);
+    queue->ready = true;
+    extractReadyMessages(*queue, readyMessages);
 }
 
 bool PendingMessageQueue::isChatReady(ChatId chatId)
 {
-    auto pQueue = getChatQueue(chatId);
-    if (pQueue != m_queues.end())
-        return pQueue->ready;
+    ChatQueue *queue = getChatQueue(chatId);
+    if (queue)
+        return queue->ready;
     else
         return true;
 }
 
+void PendingMessageQueue::extractOverdueMessages(std::vector<IncomingMessage> &readyMessages)
+{
+    readyMessages.clear();
+    if (m_policy != OrderPolicy::ReorderWindow)
+        return;
+
+    gint64 now    = g_get_monotonic_time();
+    gint64 window = gint64(m_reorderWindowMs) * 1000;
+    for (auto &entry: m_queues) {
+        ChatQueue &queue = entry.second;
+        // Holding back for history fetch is not about any one message, so no reordering there
+        if (!queue.ready)
+            continue;
+
+        // A ready message can go once everything not ready in front of it has waited long enough
+        gint64 latestBlocker = 0;
+        for (size_t i = 0; i < queue.messages.size(); i++) {
+            Message &message = queue.messages[i];
+            if (message.taken)
+                continue;
+            if (!message.ready)
+                latestBlocker = std::max(latestBlocker, message.queuedAt);
+            else if (now - latestBlocker >= window) {
+                takeMessage(queue, message, queue.frontPosition + i, readyMessages, now);
+                m_reordered++;
+            } else
+                break;
+        }
+    }
+}
+
+bool PendingMessageQueue::getOverdueDelay(unsigned &delayMs) const
+{
+    if (m_policy != OrderPolicy::ReorderWindow)
+        return false;
+
+    gint64 now      = g_get_monotonic_time();
+    gint64 window   = gint64(m_reorderWindowMs) * 1000;
+    bool   heldBack = false;
+    gint64 delay    = window;
+    for (const auto &entry: m_queues) {
+        const ChatQueue &queue = entry.second;
+        if (!queue.ready)
+            continue;
+
+        // First ready message behind messages not ready is the first one to be released
+        gint64 latestBlocker = 0;
+        for (const Message &message: queue.messages) {
+            if (message.taken)
+                continue;
+            if (!message.ready)
+                latestBlocker = std::max(latestBlocker, message.queuedAt);
+            else {
+                heldBack = true;
+                delay    = std::min(delay, std::max<gint64>(latestBlocker + window - now, 0));
+                break;
+            }
+        }
+    }
+
+    // Round up so that the timer doesn't go off just before the window is over
+    delayMs = (delay + 999) / 1000;
+    return heldBack;
+}
+
+std::string PendingMessageQueue::getStatistics() const
+{
+    std::string out = "{\"wait_time\":";
+    m_waitTime.appendJson(out);
+    out += ",\"reordered\":" + std::to_string(m_reordered) + "}";
+    return out;
+}
+
+bool HistoryFetchQueue::add(const Fetch &fetch)
+{
+    m_added++;
+    if ((m_limit == 0) || (m_running.size() < m_limit)) {
+        m_running.push_back(fetch.chatId);
+        return true;
+    }
+
+    m_queued.push_back(QueuedFetch{fetch, m_added});
+    return false;
+}
+
+bool HistoryFetchQueue::finish(ChatId chatId, Fetch &next)
+{
+    auto it = std::find(m_running.begin(), m_running.end(), chatId);
+    if (it == m_running.end())
+        return false;
+    m_running.erase(it);
+    m_finished++;
+
+    if (m_queued.empty() || ((m_limit != 0) && (m_running.size() >= m_limit)))
+        return false;
+
+    auto best = m_queued.begin();
+    for (auto queued = m_queued.begin(); queued != m_queued.end(); ++queued)
+        if ((queued->fetch.priority > best->fetch.priority) ||
+            ((queued->fetch.priority == best->fetch.priority) && (queued->order < best->order)))
+        {
+            best = queued;
+        }
+    next = best->fetch;
+    m_queued.erase(best);
+    m_running.push_back(next.chatId);
+    return true;
+}
+
+std::string HistoryFetchQueue::getStatistics() const
+{
+    return "{\"limit\":" + std::to_string(m_limit) + ",\"total\":" + std::to_string(m_added) +
+           ",\"finished\":" + std::to_string(m_finished) + ",\"running\":" + std::to_string(m_running.size()) +
+           ",\"queued\":" + std::to_string(m_queued.size()) + "}";
+}
+
+void PendingMessageQueue::getMemoryUsage(MemoryUsage &usage) const
+{
+    size_t messageCount = 0;
+    size_t messageBytes = memory::hashMapBytes(m_queues);
+    size_t repliedCount = 0;
+    size_t repliedBytes = 0;
+    size_t thumbnailCount = 0;
+    size_t thumbnailBytes = 0;
+
+    for (const auto &item: m_queues) {
+        const ChatQueue &queue = item.second;
+        messageBytes += queue.messages.size() * sizeof(Message) + memory::hashMapBytes(queue.positions);
+        for (const Message &message: queue.messages) {
+            if (message.taken)
+                continue;
+            messageCount++;
+            messageBytes += memory::messageBytes(message.message.message.get()) +
+                            memory::stringBytes(message.message.inlineDownloadedFilePath);
+            if (message.message.repliedMessage) {
+                repliedCount++;
+                repliedBytes += memory::messageBytes(message.message.repliedMessage.get());
+            }
+            if (message.message.thumbnail) {
+                thumbnailCount++;
+                thumbnailBytes += memory::fileBytes(message.message.thumbnail.get());
+            }
+        }
+    }
+
+    usage.add("pending_messages", messageCount, messageBytes);
+    usage.add("replied_messages", repliedCount, repliedBytes);
+    usage.add("thumbnails", thumbnailCount, thumbnailBytes);
+}
+
+TdAccountData::~TdAccountData()
+{
+    if (m_readReceiptsTimer != 0)
+        transceiver.cancelTimeout(m_readReceiptsTimer);
+    if (m_lastMessagesFlushTimer != 0)
+        transceiver.cancelTimeout(m_lastMessagesFlushTimer);
+    if (m_replySourcesTimer != 0)
+        transceiver.cancelTimeout(m_replySourcesTimer);
+    if (m_overdueMessagesTimer != 0)
+        transceiver.cancelTimeout(m_overdueMessagesTimer);
+}
+
 void TdAccountData::updateUser(TdUserPtr userPtr)
 {
     const td::td_api::user *user = userPtr.get();
@@ -310,26 +571,29 @@ void TdAccountData::updateUser(TdUserPtr userPtr)
         }
 
         UserInfo &entry = it->second;
-        entry.user = std::move(userPtr);
-        entry.displayName = makeDisplayName(*user);
-        for (unsigned n = 0; n != UINT32_MAX; n++) {
-            std::string displayName = entry.displayName;
-            if (n != 0) {
-                displayName += " #";
-                displayName += std::to_string(n);
-            }
-
-            std::vector<const td::td_api::user *> existingUsers;
-            getUsersByDisplayName(displayName.c_str(), existingUsers);
-            if (std::none_of(existingUsers.begin(), existingUsers.end(),
-                                [user](const td::td_api::user *otherUser) {
-                                    return (otherUser != user);
-                                }))
-            {
-                entry.displayName = std::move(displayName);
-                break;
-            }
+        if (entry.user && strcmp(getCanonicalPhoneNumber(entry.user->phone_number_.c_str()),
+                                 getCanonicalPhoneNumber(user->phone_number_.c_str())))
+        {
+            unindexUserPhone(*entry.user);
         }
+        compactUser(*userPtr);
+        entry.user = std::move(userPtr);
+        indexUserPhone(*user);
+
+        // Same name as another user gets " #n" appended, with lowest n not taken by someone else
+        removeDisplayName(userId, entry.displayName);
+        std::string baseName = makeDisplayName(*user);
+        if (isDisplayNameTaken(baseName)) {
+            auto     pHint = m_displayNameSuffixHint.find(baseName);
+            unsigned n     = (pHint != m_displayNameSuffixHint.end()) ? pHint->second : 1;
+            while (isDisplayNameTaken(makeSuffixedName(baseName, n)))
+                n++;
+            entry.displayName = makeSuffixedName(baseName, n);
+            m_displayNameSuffixHint[baseName] = n+1;
+        } else
+            entry.displayName = std::move(baseName);
+        addDisplayName(userId, entry.displayName);
+        CHECK_INDEXES();
     }
 }
 
@@ -404,10 +668,86 @@ void TdAccountData::updateSupergroupInfo(SupergroupId groupId, TdSupergroupInfoP
         m_supergroups[groupId].fullInfo = std::move(groupInfo);
 }
 
-void TdAccountData::updateSupergroupMembers(SupergroupId groupId, TdChatMembersPtr members)
+void TdAccountData::addSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                                         std::vector<const td::td_api::chatMember *> *addedMembers)
 {
-    if (members)
-        m_supergroups[groupId].members = std::move(members);
+    mergeSupergroupMembers(groupId, members, addedMembers, true);
+}
+
+void TdAccountData::addNewSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                                            std::vector<const td::td_api::chatMember *> &addedMembers)
+{
+    mergeSupergroupMembers(groupId, members, &addedMembers, false);
+}
+
+void TdAccountData::mergeSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                                           std::vector<const td::td_api::chatMember *> *addedMembers,
+                                           bool replaceKnown)
+{
+    SupergroupInfo &info = m_supergroups[groupId];
+    if (!info.members)
+        info.members = td::td_api::make_object<td::td_api::chatMembers>();
+    std::vector<td::td_api::object_ptr<td::td_api::chatMember>> &knownMembers = info.members->members_;
+
+    for (td::td_api::object_ptr<td::td_api::chatMember> &member: members.members_) {
+        UserId userId = member ? getUserId(*member) : UserId::invalid;
+        if (!userId.valid())
+            continue;
+        auto it = info.memberIndex.find(userId.value());
+        if (it != info.memberIndex.end()) {
+            if (replaceKnown)
+                knownMembers[it->second] = std::move(member);
+        } else {
+            info.memberIndex.emplace(userId.value(), knownMembers.size());
+            knownMembers.push_back(std::move(member));
+            if (addedMembers)
+                addedMembers->push_back(knownMembers.back().get());
+        }
+    }
+    CHECK_INDEXES();
+}
+
+bool TdAccountData::removeSupergroupMember(SupergroupId groupId, UserId userId)
+{
+    auto pGroup = m_supergroups.find(groupId);
+    if ((pGroup == m_supergroups.end()) || !pGroup->second.members)
+        return false;
+    SupergroupInfo &info = pGroup->second;
+    auto pIndex = info.memberIndex.find(userId.value());
+    if (pIndex == info.memberIndex.end())
+        return false;
+
+    // Order of members doesn't matter, so last one takes the place of removed one
+    std::vector<td::td_api::object_ptr<td::td_api::chatMember>> &knownMembers = info.members->members_;
+    size_t position = pIndex->second;
+    info.memberIndex.erase(pIndex);
+    if (position + 1 != knownMembers.size()) {
+        knownMembers[position] = std::move(knownMembers.back());
+        info.memberIndex[getUserId(*knownMembers[position]).value()] = position;
+    }
+    knownMembers.pop_back();
+    CHECK_INDEXES();
+    return true;
+}
+
+void TdAccountData::pauseSupergroupMembersPaging(SupergroupId groupId, int32_t offset, int32_t totalCount)
+{
+    SupergroupInfo &info  = m_supergroups[groupId];
+    info.pausedPageOffset = offset;
+    info.pausedPageTotal  = totalCount;
+}
+
+bool TdAccountData::resumeSupergroupMembersPaging(SupergroupId groupId, int32_t &offset, int32_t &totalCount)
+{
+    auto pGroup = m_supergroups.find(groupId);
+    if ((pGroup == m_supergroups.end()) || (pGroup->second.pausedPageOffset == 0))
+        return false;
+
+    offset     = pGroup->second.pausedPageOffset;
+    totalCount = pGroup->second.pausedPageTotal;
+    pGroup->second.pausedPageOffset = 0;
+    pGroup->second.pausedPageTotal  = 0;
+    return true;
 }
 
 void TdAccountData::addChat(TdChatPtr chat)
@@ -427,14 +767,25 @@ void TdAccountData::addChat(TdChatPtr chat)
         }
     }
 
-    auto it = m_chatInfo.find(getId(*chat));
-    if (it != m_chatInfo.end())
-        it->second.chat = std::move(chat);
-    else {
-        auto entry = m_chatInfo.emplace(getId(*chat), ChatInfo());
+    compactChat(*chat);
+    ChatId chatId = getId(*chat);
+    auto   it     = m_chatInfo.find(chatId);
+    m_unconfirmedChats.erase(chatId);
+    if (it != m_chatInfo.end()) {
+        // Chat type never changes in practice, but if it did, indexes would have to follow
+        if (!hasSameIndexKeys(*it->second.chat, *chat)) {
+            unindexChat(chatId, it->second);
+            it->second.chat = std::move(chat);
+            indexChat(chatId, it->second);
+        } else
+            it->second.chat = std::move(chat);
+    } else {
+        auto entry = m_chatInfo.emplace(chatId, ChatInfo());
         entry.first->second.chat     = std::move(chat);
         entry.first->second.purpleId = ++m_lastChatPurpleId;
+        indexChat(chatId, entry.first->second);
     }
+    CHECK_INDEXES();
 }
 
 void TdAccountData::updateChatPosition(ChatId chatId, td::td_api::object_ptr<td::td_api::chatPosition> &&position)
@@ -489,7 +840,9 @@ void TdAccountData::setContacts(const td::td_api::users &users)
 {
     for (unsigned i = 0; i < users.user_ids_.size(); i++) {
         UserId userId = getUserId(users, i);
-        if (getPrivateChatByUserId(userId) == nullptr) {
+        // Chat from snapshot may not exist any more, so it must be requested like an unknown one
+        const td::td_api::chat *chat = getPrivateChatByUserId(userId);
+        if (!chat || isUnconfirmedChat(getId(*chat))) {
             purpleDebug("Private chat not yet known for user {}", userId.value());
             m_contactUserIdsNoChat.push_back(userId);
         }
@@ -521,36 +874,20 @@ int TdAccountData::getPurpleChatId(ChatId tdChatId)
 
 const td::td_api::chat *TdAccountData::getChatByPurpleId(int32_t purpleChatId) const
 {
-    auto pChatInfo = std::find_if(m_chatInfo.begin(), m_chatInfo.end(),
-                                  [purpleChatId](const ChatMap::value_type &entry) {
-                                      return (entry.second.purpleId == purpleChatId);
-                                  });
-
-    if (pChatInfo != m_chatInfo.end())
-        return pChatInfo->second.chat.get();
+    auto it = m_chatByPurpleId.find(purpleChatId);
+    if (it != m_chatByPurpleId.end())
+        return getChat(it->second);
     else
         return nullptr;
 }
 
-static bool isPrivateChat(const td::td_api::chat &chat, UserId userId)
-{
-    if (chat.type_->get_id() == td::td_api::chatTypePrivate::ID) {
-        const td::td_api::chatTypePrivate &privType = static_cast<const td::td_api::chatTypePrivate &>(*chat.type_);
-        return (getUserId(privType) == userId);
-    }
-    return false;
-}
-
 const td::td_api::chat *TdAccountData::getPrivateChatByUserId(UserId userId) const
 {
-    auto pChatInfo = std::find_if(m_chatInfo.begin(), m_chatInfo.end(),
-                                  [userId](const ChatMap::value_type &entry) {
-                                      return isPrivateChat(*entry.second.chat, userId);
-                                  });
-    if (pChatInfo == m_chatInfo.end())
+    auto it = m_privateChatByUser.find(userId.value());
+    if (it == m_privateChatByUser.end())
         return nullptr;
     else
-        return pChatInfo->second.chat.get();
+        return getChat(it->second);
 }
 
 const td::td_api::user *TdAccountData::getUser(UserId userId) const
@@ -564,14 +901,11 @@ const td::td_api::user *TdAccountData::getUser(UserId userId) const
 
 const td::td_api::user *TdAccountData::getUserByPhone(const char *phoneNumber) const
 {
-    auto pUser = std::find_if(m_userInfo.begin(), m_userInfo.end(),
-                              [phoneNumber](const UserMap::value_type &entry) {
-                                  return isPhoneEqual(entry.second.user->phone_number_, phoneNumber);
-                              });
-    if (pUser == m_userInfo.end())
+    auto it = m_userByPhone.find(getCanonicalPhoneNumber(phoneNumber));
+    if (it == m_userByPhone.end())
         return nullptr;
     else
-        return pUser->second.user.get();
+        return getUser(it->second);
 }
 
 const td::td_api::user *TdAccountData::getUserByPrivateChat(const td::td_api::chat &chat)
@@ -603,9 +937,52 @@ void TdAccountData::getUsersByDisplayName(const char *displayName,
     if (!displayName || (*displayName == '\0'))
         return;
 
-    for (const UserMap::value_type &entry: m_userInfo)
-        if (entry.second.displayName == displayName)
-            users.push_back(entry.second.user.get());
+    auto it = m_usersByDisplayName.find(displayName);
+    if (it != m_usersByDisplayName.end())
+        for (UserId userId: it->second)
+            users.push_back(getUser(userId));
+}
+
+bool TdAccountData::isDisplayNameTaken(const std::string &displayName) const
+{
+    return (m_usersByDisplayName.find(displayName) != m_usersByDisplayName.end());
+}
+
+void TdAccountData::addDisplayName(UserId userId, const std::string &displayName)
+{
+    if (displayName.empty())
+        return;
+
+    std::vector<UserId> &userIds = m_usersByDisplayName[displayName];
+    userIds.insert(std::upper_bound(userIds.begin(), userIds.end(), userId), userId);
+}
+
+void TdAccountData::removeDisplayName(UserId userId, const std::string &displayName)
+{
+    auto it = m_usersByDisplayName.find(displayName);
+    if (it == m_usersByDisplayName.end())
+        return;
+
+    std::vector<UserId> &userIds = it->second;
+    userIds.erase(std::remove(userIds.begin(), userIds.end(), userId), userIds.end());
+    if (!userIds.empty())
+        return;
+    m_usersByDisplayName.erase(it);
+
+    // Freed "name #n" may be the lowest free suffix for "name" now, whether it was assigned as
+    // such or is someone's actual name
+    size_t separator = displayName.rfind(" #");
+    if ((separator != std::string::npos) && (separator + 2 < displayName.size()) &&
+        std::all_of(displayName.begin() + separator + 2, displayName.end(),
+                    [](char c) { return (c >= '0') && (c <= '9'); }))
+    {
+        auto pHint = m_displayNameSuffixHint.find(displayName.substr(0, separator));
+        if (pHint != m_displayNameSuffixHint.end()) {
+            unsigned long n = strtoul(displayName.c_str() + separator + 2, NULL, 10);
+            if ((n >= 1) && (n < pHint->second))
+                pHint->second = n;
+        }
+    }
 }
 
 const td::td_api::basicGroup *TdAccountData::getBasicGroup(BasicGroupId groupId) const
@@ -655,32 +1032,18 @@ const td::td_api::chatMembers *TdAccountData::getSupergroupMembers(SupergroupId
 
 const td::td_api::chat *TdAccountData::getBasicGroupChatByGroup(BasicGroupId groupId) const
 {
-    if (!groupId.valid())
-        return nullptr;
-
-    auto it = std::find_if(m_chatInfo.begin(), m_chatInfo.end(),
-                           [groupId](const ChatMap::value_type &entry) {
-                               return (getBasicGroupId(*entry.second.chat) == groupId);
-                           });
-
-    if (it != m_chatInfo.end())
-        return it->second.chat.get();
+    auto it = m_chatByBasicGroup.find(groupId.value());
+    if (it != m_chatByBasicGroup.end())
+        return getChat(it->second);
     else
         return nullptr;
 }
 
 const td::td_api::chat *TdAccountData::getSupergroupChatByGroup(SupergroupId groupId) const
 {
-    if (!groupId.valid())
-        return nullptr;
-
-    auto it = std::find_if(m_chatInfo.begin(), m_chatInfo.end(),
-                           [groupId](const ChatMap::value_type &entry) {
-                               return (getSupergroupId(*entry.second.chat) == groupId);
-                           });
-
-    if (it != m_chatInfo.end())
-        return it->second.chat.get();
+    auto it = m_chatBySupergroup.find(groupId.value());
+    if (it != m_chatBySupergroup.end())
+        return getChat(it->second);
     else
         return nullptr;
 }
@@ -702,13 +1065,9 @@ bool TdAccountData::isGroupChatWithMembership(const td::td_api::chat &chat) cons
 
 const td::td_api::chat *TdAccountData::getChatBySecretChat(SecretChatId secretChatId)
 {
-    auto it = std::find_if(m_chatInfo.begin(), m_chatInfo.end(),
-                           [secretChatId](const ChatMap::value_type &entry) {
-                               return (getSecretChatId(*entry.second.chat) == secretChatId);
-                           });
-
-    if (it != m_chatInfo.end())
-        return it->second.chat.get();
+    auto it = m_chatBySecretChat.find(secretChatId.value());
+    if (it != m_chatBySecretChat.end())
+        return getChat(it->second);
     else
         return nullptr;
 }
@@ -722,9 +1081,170 @@ void TdAccountData::getChats(std::vector<const td::td_api::chat *> &chats) const
 
 void TdAccountData::deleteChat(ChatId id)
 {
-    m_chatInfo.erase(id);
+    auto it = m_chatInfo.find(id);
+    if (it != m_chatInfo.end()) {
+        ChatInfo info = std::move(it->second);
+        m_chatInfo.erase(it);
+        unindexChat(id, info);
+    }
+    m_unconfirmedChats.erase(id);
+    CHECK_INDEXES();
+}
+
+void TdAccountData::indexChat(ChatId chatId, const ChatInfo &info)
+{
+    const td::td_api::chat &chat = *info.chat;
+    addToIndex(m_chatByPurpleId, info.purpleId, chatId);
+
+    UserId userId = getUserIdByPrivateChat(chat);
+    if (userId.valid())
+        addToIndex(m_privateChatByUser, userId.value(), chatId);
+    BasicGroupId groupId = getBasicGroupId(chat);
+    if (groupId.valid())
+        addToIndex(m_chatByBasicGroup, groupId.value(), chatId);
+    SupergroupId supergroupId = getSupergroupId(chat);
+    if (supergroupId.valid())
+        addToIndex(m_chatBySupergroup, supergroupId.value(), chatId);
+    SecretChatId secretChatId = getSecretChatId(chat);
+    if (secretChatId.valid())
+        addToIndex(m_chatBySecretChat, secretChatId.value(), chatId);
+}
+
+void TdAccountData::unindexChat(ChatId chatId, const ChatInfo &info)
+{
+    const td::td_api::chat &chat = *info.chat;
+    removeFromIndex(m_chatByPurpleId, info.purpleId, chatId);
+
+    bool removed = false;
+    UserId userId = getUserIdByPrivateChat(chat);
+    if (userId.valid())
+        removed = removeFromIndex(m_privateChatByUser, userId.value(), chatId) || removed;
+    BasicGroupId groupId = getBasicGroupId(chat);
+    if (groupId.valid())
+        removed = removeFromIndex(m_chatByBasicGroup, groupId.value(), chatId) || removed;
+    SupergroupId supergroupId = getSupergroupId(chat);
+    if (supergroupId.valid())
+        removed = removeFromIndex(m_chatBySupergroup, supergroupId.value(), chatId) || removed;
+    SecretChatId secretChatId = getSecretChatId(chat);
+    if (secretChatId.valid())
+        removed = removeFromIndex(m_chatBySecretChat, secretChatId.value(), chatId) || removed;
+
+    // Another chat with the same user or group may have been shadowed by this one. Single chats
+    // are only deleted when secret chats are closed, so a full pass is affordable here. Deleting
+    // many chats at once goes through reindexChats instead.
+    if (removed)
+        for (const ChatMap::value_type &entry: m_chatInfo)
+            if (entry.first != chatId)
+                indexChat(entry.first, entry.second);
+}
+
+void TdAccountData::reindexChats()
+{
+    m_privateChatByUser.clear();
+    m_chatByPurpleId.clear();
+    m_chatByBasicGroup.clear();
+    m_chatBySupergroup.clear();
+    m_chatBySecretChat.clear();
+    for (const ChatMap::value_type &entry: m_chatInfo)
+        indexChat(entry.first, entry.second);
+}
+
+void TdAccountData::indexUserPhone(const td::td_api::user &user)
+{
+    const char *phoneNumber = getCanonicalPhoneNumber(user.phone_number_.c_str());
+    if (*phoneNumber)
+        addToIndex(m_userByPhone, std::string(phoneNumber), getId(user));
+}
+
+void TdAccountData::unindexUserPhone(const td::td_api::user &user)
+{
+    std::string phoneNumber = getCanonicalPhoneNumber(user.phone_number_.c_str());
+    UserId      userId      = getId(user);
+    if (!phoneNumber.empty() && removeFromIndex(m_userByPhone, phoneNumber, userId)) {
+        for (const UserMap::value_type &entry: m_userInfo)
+            if ((entry.first != userId) &&
+                (getCanonicalPhoneNumber(entry.second.user->phone_number_.c_str()) == phoneNumber))
+            {
+                addToIndex(m_userByPhone, phoneNumber, entry.first);
+            }
+    }
 }
 
+#ifdef CHECK_ACCOUNT_DATA_INDEXES
+void TdAccountData::checkIndexes() const
+{
+    std::unordered_map<int64_t, ChatId>     privateChatByUser;
+    std::unordered_map<int32_t, ChatId>     chatByPurpleId;
+    std::unordered_map<int64_t, ChatId>     chatByBasicGroup;
+    std::unordered_map<int64_t, ChatId>     chatBySupergroup;
+    std::unordered_map<int32_t, ChatId>     chatBySecretChat;
+    std::unordered_map<std::string, UserId> userByPhone;
+    std::unordered_map<std::string, std::vector<UserId>> usersByDisplayName;
+
+    // Map iteration is in id order, so first insertion wins just like with linear search
+    for (const ChatMap::value_type &entry: m_chatInfo) {
+        const td::td_api::chat &chat = *entry.second.chat;
+        chatByPurpleId.emplace(entry.second.purpleId, entry.first);
+        if (getUserIdByPrivateChat(chat).valid())
+            privateChatByUser.emplace(getUserIdByPrivateChat(chat).value(), entry.first);
+        if (getBasicGroupId(chat).valid())
+            chatByBasicGroup.emplace(getBasicGroupId(chat).value(), entry.first);
+        if (getSupergroupId(chat).valid())
+            chatBySupergroup.emplace(getSupergroupId(chat).value(), entry.first);
+        if (getSecretChatId(chat).valid())
+            chatBySecretChat.emplace(getSecretChatId(chat).value(), entry.first);
+    }
+    for (const UserMap::value_type &entry: m_userInfo) {
+        const char *phoneNumber = getCanonicalPhoneNumber(entry.second.user->phone_number_.c_str());
+        if (*phoneNumber)
+            userByPhone.emplace(phoneNumber, entry.first);
+        if (!entry.second.displayName.empty())
+            usersByDisplayName[entry.second.displayName].push_back(entry.first);
+    }
+
+    bool memberIndexesValid = true;
+    for (const auto &entry: m_supergroups) {
+        std::unordered_map<int64_t, size_t> memberIndex;
+        if (entry.second.members)
+            for (size_t i = 0; i < entry.second.members->members_.size(); i++)
+                memberIndex.emplace(getUserId(*entry.second.members->members_[i]).value(), i);
+        if (memberIndex != entry.second.memberIndex)
+            memberIndexesValid = false;
+    }
+
+    bool suffixHintsValid = true;
+    for (const auto &hint: m_displayNameSuffixHint)
+        for (unsigned n = 1; n < hint.second; n++)
+            if (!isDisplayNameTaken(makeSuffixedName(hint.first, n)))
+                suffixHintsValid = false;
+
+    const char *broken = nullptr;
+    if (privateChatByUser != m_privateChatByUser)
+        broken = "private chat by user";
+    else if (chatByPurpleId != m_chatByPurpleId)
+        broken = "chat by purple id";
+    else if (chatByBasicGroup != m_chatByBasicGroup)
+        broken = "chat by basic group";
+    else if (chatBySupergroup != m_chatBySupergroup)
+        broken = "chat by supergroup";
+    else if (chatBySecretChat != m_chatBySecretChat)
+        broken = "chat by secret chat";
+    else if (userByPhone != m_userByPhone)
+        broken = "user by phone number";
+    else if (usersByDisplayName != m_usersByDisplayName)
+        broken = "users by display name";
+    else if (!suffixHintsValid)
+        broken = "display name suffixes";
+    else if (!memberIndexesValid)
+        broken = "supergroup members";
+
+    if (broken) {
+        purple_debug_warning(config::pluginId, "Account data index inconsistent: %s\n", broken);
+        abort();
+    }
+}
+#endif
+
 void TdAccountData::addExpectedChat(ChatId id)
 {
     if (!isExpectedChat(id))
@@ -744,79 +1264,248 @@ void TdAccountData::removeExpectedChat(ChatId id)
 
 }
 
+// Snapshot is a session recording (see session-recording.h) made of updateUser, updateBasicGroup,
+// updateSupergroup and updateNewChat, terminated by ok so that a truncated file is detected
+bool TdAccountData::saveSnapshot(const std::string &path)
+{
+    // Written to a temporary file first, so that failing halfway doesn't lose previous snapshot
+    std::string     tempPath = path + ".tmp";
+    SessionRecorder snapshot;
+    if (!snapshot.open(tempPath.c_str()))
+        return false;
+
+    // Objects are moved into update wrappers for storing, then moved back
+    for (UserMap::value_type &item: m_userInfo) {
+        td::td_api::updateUser update(std::move(item.second.user));
+        snapshot.recordResponse(0, update);
+        item.second.user = std::move(update.user_);
+    }
+    for (auto &item: m_groups)
+        if (item.second.group) {
+            td::td_api::updateBasicGroup update(std::move(item.second.group));
+            snapshot.recordResponse(0, update);
+            item.second.group = std::move(update.basic_group_);
+        }
+    for (auto &item: m_supergroups)
+        if (item.second.group) {
+            td::td_api::updateSupergroup update(std::move(item.second.group));
+            snapshot.recordResponse(0, update);
+            item.second.group = std::move(update.supergroup_);
+        }
+
+    // In purple chat id order, so that chats get the same ids, save for gaps, when loaded.
+    // Secret chats are skipped, they are useless without secretChat which is not stored.
+    std::vector<ChatInfo *> chats;
+    for (ChatMap::value_type &item: m_chatInfo)
+        if (!getSecretChatId(*item.second.chat).valid())
+            chats.push_back(&item.second);
+    std::sort(chats.begin(), chats.end(), [](const ChatInfo *info1, const ChatInfo *info2) {
+        return info1->purpleId < info2->purpleId;
+    });
+    for (ChatInfo *info: chats) {
+        td::td_api::updateNewChat update(std::move(info->chat));
+        snapshot.recordResponse(0, update);
+        info->chat = std::move(update.chat_);
+    }
+
+    snapshot.recordResponse(0, td::td_api::ok());
+    snapshot.close();
+
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        purple_debug_warning(config::pluginId, "Failed to save snapshot to %s\n", path.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+    purple_debug_misc(config::pluginId, "Saved snapshot of %zu users and %zu chats to %s\n",
+                      m_userInfo.size(), chats.size(), path.c_str());
+    return true;
+}
+
+bool TdAccountData::loadSnapshot(const std::string &path)
+{
+    SessionReader reader;
+    if (!reader.open(path.c_str()))
+        return false;
+
+    std::vector<td::td_api::object_ptr<td::td_api::Object>> objects;
+    SessionRecord record;
+    bool          complete = false;
+    while (!complete && reader.next(record)) {
+        if (!record.object)
+            break;
+        if (record.object->get_id() == td::td_api::ok::ID)
+            complete = true;
+        else
+            objects.push_back(std::move(record.object));
+    }
+    if (!complete) {
+        purple_debug_warning(config::pluginId, "Snapshot %s is corrupted, ignoring\n", path.c_str());
+        return false;
+    }
+
+    unsigned chatCount = 0;
+    for (auto &object: objects) {
+        switch (object->get_id()) {
+        case td::td_api::updateUser::ID:
+            updateUser(std::move(static_cast<td::td_api::updateUser &>(*object).user_));
+            break;
+        case td::td_api::updateBasicGroup::ID:
+            updateBasicGroup(std::move(static_cast<td::td_api::updateBasicGroup &>(*object).basic_group_));
+            break;
+        case td::td_api::updateSupergroup::ID:
+            updateSupergroup(std::move(static_cast<td::td_api::updateSupergroup &>(*object).supergroup_));
+            break;
+        case td::td_api::updateNewChat::ID: {
+            TdChatPtr &chat = static_cast<td::td_api::updateNewChat &>(*object).chat_;
+            if (chat) {
+                ChatId chatId = getId(*chat);
+                addChat(std::move(chat));
+                m_unconfirmedChats.insert(chatId);
+                chatCount++;
+            }
+            break;
+        }
+        }
+    }
+
+    purple_debug_misc(config::pluginId, "Loaded snapshot of %zu users and %u chats from %s\n",
+                      m_userInfo.size(), chatCount, path.c_str());
+    return true;
+}
+
+bool TdAccountData::isUnconfirmedChat(ChatId chatId) const
+{
+    return m_unconfirmedChats.find(chatId) != m_unconfirmedChats.end();
+}
+
+void TdAccountData::removeUnconfirmedChats()
+{
+    std::set<ChatId> chatIds;
+    std::swap(chatIds, m_unconfirmedChats);
+    if (chatIds.empty())
+        return;
+
+    // Could be a good part of a big account, so rebuild indexes once rather than unindexing
+    // chats one by one
+    for (ChatId chatId: chatIds) {
+        purpleDebug("Chat {} from snapshot no longer exists", chatId.value());
+        m_chatInfo.erase(chatId);
+    }
+    reindexChats();
+    CHECK_INDEXES();
+}
+
+template<typename Key>
+static void removeRequestFromIndex(std::unordered_multimap<Key, uint64_t> &index, Key key, uint64_t requestId)
+{
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->second == requestId) {
+            index.erase(it);
+            break;
+        }
+}
+
+// Oldest request, which is what a search in order of addition would find
+template<typename Key>
+static uint64_t findRequestInIndex(const std::unordered_multimap<Key, uint64_t> &index, Key key)
+{
+    auto     range     = index.equal_range(key);
+    uint64_t requestId = 0;
+    for (auto it = range.first; it != range.second; ++it)
+        if ((requestId == 0) || (it->second < requestId))
+            requestId = it->second;
+    return requestId;
+}
+
+void TdAccountData::addPendingRequestImpl(std::unique_ptr<PendingRequest> request)
+{
+    uint64_t requestId = request->requestId;
+    if (m_requests.find(requestId) != m_requests.end()) {
+        // Request ids are unique, so this is not supposed to happen
+        purple_debug_warning(config::pluginId, "Replacing pending request %" G_GUINT64_FORMAT "\n",
+                             requestId);
+        getPendingRequestImpl(requestId);
+    }
+
+    if (request->kind == PendingRequest::Kind::Download) {
+        const DownloadRequest &downloadReq = static_cast<const DownloadRequest &>(*request);
+        m_downloadRequestsByFile.emplace(downloadReq.fileId, requestId);
+    } else if (request->kind == PendingRequest::Kind::Contact) {
+        const ContactRequest &contactReq = static_cast<const ContactRequest &>(*request);
+        if (contactReq.userId.valid())
+            m_contactRequestsByUser.emplace(contactReq.userId.value(), requestId);
+    }
+
+    m_requests.emplace(requestId, std::move(request));
+}
+
 std::unique_ptr<PendingRequest> TdAccountData::getPendingRequestImpl(uint64_t requestId)
 {
-    auto it = std::find_if(m_requests.begin(), m_requests.end(),
-                           [requestId](const std::unique_ptr<PendingRequest> &req) {
-                               return (req->requestId == requestId);
-                           });
+    auto it = m_requests.find(requestId);
+    if (it == m_requests.end())
+        return nullptr;
+
+    std::unique_ptr<PendingRequest> result = std::move(it->second);
+    m_requests.erase(it);
 
-    if (it != m_requests.end()) {
-        auto result = std::move(*it);
-        m_requests.erase(it);
-        return result;
+    if (result->kind == PendingRequest::Kind::Download) {
+        const DownloadRequest &downloadReq = static_cast<const DownloadRequest &>(*result);
+        removeRequestFromIndex(m_downloadRequestsByFile, downloadReq.fileId, requestId);
+    } else if (result->kind == PendingRequest::Kind::Contact) {
+        const ContactRequest &contactReq = static_cast<const ContactRequest &>(*result);
+        if (contactReq.userId.valid())
+            removeRequestFromIndex(m_contactRequestsByUser, contactReq.userId.value(), requestId);
     }
 
-    return nullptr;
+    return result;
 }
 
 PendingRequest *TdAccountData::findPendingRequestImpl(uint64_t requestId)
 {
-    auto it = std::find_if(m_requests.begin(), m_requests.end(),
-                           [requestId](const std::unique_ptr<PendingRequest> &req) {
-                               return (req->requestId == requestId);
-                           });
-
+    auto it = m_requests.find(requestId);
     if (it != m_requests.end())
-        return it->get();
+        return it->second.get();
 
     return nullptr;
 }
 
 const ContactRequest *TdAccountData::findContactRequest(UserId userId)
 {
-    auto it = std::find_if(m_requests.begin(), m_requests.end(),
-                           [userId](const std::unique_ptr<PendingRequest> &req) {
-                               const ContactRequest *contactReq = dynamic_cast<const ContactRequest *>(req.get());
-                               return (contactReq && (contactReq->userId == userId));
-                           });
-
-    if (it != m_requests.end())
-        return static_cast<const ContactRequest *>(it->get());
-    return nullptr;
+    uint64_t requestId = findRequestInIndex(m_contactRequestsByUser, userId.value());
+    return requestId ? findPendingRequest<ContactRequest>(requestId) : nullptr;
 }
 
 DownloadRequest* TdAccountData::findDownloadRequest(int32_t fileId)
 {
-    auto it = std::find_if(m_requests.begin(), m_requests.end(),
-                           [fileId](const std::unique_ptr<PendingRequest> &req) {
-                               DownloadRequest *downloadReq = dynamic_cast<DownloadRequest *>(req.get());
-                               return (downloadReq && (downloadReq->fileId == fileId));
-                           });
-
-    if (it != m_requests.end())
-        return static_cast<DownloadRequest *>(it->get());
-    return nullptr;
+    uint64_t requestId = findRequestInIndex(m_downloadRequestsByFile, fileId);
+    return requestId ? findPendingRequest<DownloadRequest>(requestId) : nullptr;
 }
 
 void TdAccountData::extractFileTransferRequests(std::vector<PurpleXfer *> &transfers)
 {
     transfers.clear();
 
-    for (unsigned i = 0; i < m_requests.size(); ) {
-        UploadRequest *uploadReq = dynamic_cast<UploadRequest *>(m_requests[i].get());
-        NewPrivateChatForMessage *newChatReq = dynamic_cast<NewPrivateChatForMessage *>(m_requests[i].get());
-        PurpleXfer *xfer = NULL;
-        if (uploadReq)
-            xfer = uploadReq->xfer;
-        else if (newChatReq)
-            xfer = newChatReq->fileUpload;
-
-        if (xfer) {
-            transfers.push_back(xfer);
-            m_requests.erase(m_requests.begin() + i);
-        } else
-            i++;
+    // In order of request ids, like they were added
+    std::vector<uint64_t> requestIds;
+    for (const auto &entry: m_requests) {
+        const PendingRequest &request = *entry.second;
+        if (((request.kind == PendingRequest::Kind::Upload) &&
+             static_cast<const UploadRequest &>(request).xfer) ||
+            ((request.kind == PendingRequest::Kind::NewPrivateChat) &&
+             static_cast<const NewPrivateChatForMessage &>(request).fileUpload))
+        {
+            requestIds.push_back(entry.first);
+        }
+    }
+    std::sort(requestIds.begin(), requestIds.end());
+
+    for (uint64_t requestId: requestIds) {
+        std::unique_ptr<PendingRequest> request = getPendingRequestImpl(requestId);
+        if (request->kind == PendingRequest::Kind::Upload)
+            transfers.push_back(static_cast<UploadRequest &>(*request).xfer);
+        else
+            transfers.push_back(static_cast<NewPrivateChatForMessage &>(*request).fileUpload);
     }
 }
 
@@ -959,27 +1648,171 @@ void TdAccountData::removeActiveCall()
 
 void TdAccountData::addPendingReadReceipt(ChatId chatId, MessageId messageId)
 {
-    auto pChatReceipts = std::find_if(m_pendingReadReceipts.begin(), m_pendingReadReceipts.end(),
-                                      [chatId](const std::vector<ReadReceipt> &receipts) {
-                                          return (!receipts.empty() && (receipts[0].chatId == chatId));
-                                      });
-    if (pChatReceipts != m_pendingReadReceipts.end())
-        pChatReceipts->push_back(ReadReceipt{chatId, messageId});
-    else {
-        m_pendingReadReceipts.emplace_back();
-        m_pendingReadReceipts.back().push_back(ReadReceipt{chatId, messageId});
-    }
+    m_pendingReadReceipts[chatId.value()].push_back(ReadReceipt{chatId, messageId});
 }
 
 void TdAccountData::extractPendingReadReceipts(ChatId chatId, std::vector<ReadReceipt>& receipts)
 {
-    auto pChatReceipts = std::find_if(m_pendingReadReceipts.begin(), m_pendingReadReceipts.end(),
-                                      [chatId](const std::vector<ReadReceipt> &receipts) {
-                                          return (!receipts.empty() && (receipts[0].chatId == chatId));
-                                      });
-    if (pChatReceipts != m_pendingReadReceipts.end()) {
-        receipts = std::move(*pChatReceipts);
-        m_pendingReadReceipts.erase(pChatReceipts);
+    auto it = m_pendingReadReceipts.find(chatId.value());
+    if (it != m_pendingReadReceipts.end()) {
+        receipts = std::move(it->second);
+        m_pendingReadReceipts.erase(it);
     } else
         receipts.clear();
 }
+
+bool TdAccountData::hasPendingReadReceipts(ChatId chatId) const
+{
+    return (m_pendingReadReceipts.find(chatId.value()) != m_pendingReadReceipts.end());
+}
+
+void TdAccountData::scheduleReadReceipts(ChatId chatId, unsigned delayMs, GSourceFunc sendFunction)
+{
+    if (std::find(m_scheduledReadReceipts.begin(), m_scheduledReadReceipts.end(), chatId) ==
+        m_scheduledReadReceipts.end())
+    {
+        m_scheduledReadReceipts.push_back(chatId);
+    }
+    if (m_readReceiptsTimer == 0)
+        m_readReceiptsTimer = transceiver.addTimeout(delayMs, sendFunction, this);
+}
+
+void TdAccountData::extractScheduledReadReceipts(std::vector<ChatId> &chatIds)
+{
+    m_readReceiptsTimer = 0;
+    chatIds = std::move(m_scheduledReadReceipts);
+    m_scheduledReadReceipts.clear();
+}
+
+void TdAccountData::scheduleLastMessagesFlush(GSourceFunc flushFunction)
+{
+    if ((m_lastMessagesFlushTimer == 0) && lastMessages.hasPending())
+        m_lastMessagesFlushTimer = transceiver.addTimeout(LastMessageStore::FLUSH_INTERVAL_SECONDS * 1000,
+                                                          flushFunction, this);
+}
+
+void TdAccountData::flushLastMessages()
+{
+    m_lastMessagesFlushTimer = 0;
+    lastMessages.flush();
+}
+
+void TdAccountData::addReplySourceRequest(ChatId chatId, MessageId sourceId, MessageId pendingMessageId,
+                                          unsigned delayMs, GSourceFunc fetchFunction)
+{
+    m_replySourceRequests[chatId.value()].push_back(ReplySourceRequest{chatId, sourceId, pendingMessageId});
+    if (m_replySourcesTimer == 0)
+        m_replySourcesTimer = transceiver.addTimeout(delayMs, fetchFunction, this);
+}
+
+void TdAccountData::scheduleOverdueMessages(GSourceFunc releaseFunction)
+{
+    unsigned delayMs;
+    if ((m_overdueMessagesTimer == 0) && pendingMessages.getOverdueDelay(delayMs))
+        m_overdueMessagesTimer = transceiver.addTimeout(delayMs, releaseFunction, this);
+}
+
+void TdAccountData::extractOverdueMessages(std::vector<IncomingMessage> &readyMessages)
+{
+    m_overdueMessagesTimer = 0;
+    pendingMessages.extractOverdueMessages(readyMessages);
+}
+
+void TdAccountData::extractReplySourceRequests(std::vector<std::pair<ChatId, std::vector<ReplySourceRequest>>> &requests)
+{
+    if (m_replySourcesTimer != 0) {
+        transceiver.cancelTimeout(m_replySourcesTimer);
+        m_replySourcesTimer = 0;
+    }
+
+    requests.clear();
+    for (auto &item: m_replySourceRequests)
+        if (!item.second.empty())
+            requests.emplace_back(item.second.front().chatId, std::move(item.second));
+    m_replySourceRequests.clear();
+}
+
+void TdAccountData::getMemoryUsage(MemoryUsage &usage) const
+{
+    size_t bytes = memory::treeMapBytes(m_userInfo);
+    for (const auto &item: m_userInfo) {
+        if (item.second.user)
+            bytes += memory::userBytes(*item.second.user);
+        bytes += memory::stringBytes(item.second.displayName);
+    }
+    usage.add("users", m_userInfo.size(), bytes);
+
+    bytes = memory::treeMapBytes(m_chatInfo);
+    for (const auto &item: m_chatInfo)
+        if (item.second.chat)
+            bytes += memory::chatBytes(*item.second.chat);
+    usage.add("chats", m_chatInfo.size(), bytes);
+
+    bytes = memory::treeMapBytes(m_groups);
+    for (const auto &item: m_groups) {
+        if (item.second.group)
+            bytes += sizeof(*item.second.group) + sizeof(td::td_api::chatMemberStatusMember);
+        bytes += memory::basicGroupInfoBytes(item.second.fullInfo.get());
+    }
+    usage.add("basic_groups", m_groups.size(), bytes);
+
+    bytes = memory::treeMapBytes(m_supergroups);
+    size_t memberCount = 0;
+    size_t memberBytes = 0;
+    for (const auto &item: m_supergroups) {
+        const SupergroupInfo &info = item.second;
+        if (info.group)
+            bytes += sizeof(*info.group) + memory::stringBytes(info.group->username_) +
+                     sizeof(td::td_api::chatMemberStatusMember);
+        bytes += memory::supergroupInfoBytes(info.fullInfo.get());
+        if (info.members) {
+            memberCount += info.members->members_.size();
+            memberBytes += sizeof(*info.members) + memory::vectorBytes(info.members->members_);
+            for (const auto &member: info.members->members_)
+                memberBytes += memory::chatMemberBytes(member.get());
+        }
+        memberBytes += memory::hashMapBytes(info.memberIndex);
+    }
+    usage.add("supergroups", m_supergroups.size(), bytes);
+    usage.add("supergroup_members", memberCount, memberBytes);
+
+    usage.add("secret_chats", m_secretChats.size(),
+              memory::treeMapBytes(m_secretChats) + m_secretChats.size() * sizeof(td::td_api::secretChat));
+
+    bytes = memory::hashMapBytes(m_privateChatByUser) + memory::hashMapBytes(m_chatByPurpleId) +
+            memory::hashMapBytes(m_chatByBasicGroup) + memory::hashMapBytes(m_chatBySupergroup) +
+            memory::hashMapBytes(m_chatBySecretChat) + memory::hashMapBytes(m_userByPhone) +
+            memory::hashMapBytes(m_usersByDisplayName) + memory::hashMapBytes(m_displayNameSuffixHint) +
+            memory::hashMapBytes(m_downloadRequestsByFile) + memory::hashMapBytes(m_contactRequestsByUser);
+    for (const auto &item: m_userByPhone)
+        bytes += memory::stringBytes(item.first);
+    for (const auto &item: m_usersByDisplayName)
+        bytes += memory::stringBytes(item.first) + memory::vectorBytes(item.second);
+    for (const auto &item: m_displayNameSuffixHint)
+        bytes += memory::stringBytes(item.first);
+    usage.add("indexes", m_privateChatByUser.size() + m_chatByPurpleId.size() + m_userByPhone.size() +
+                         m_usersByDisplayName.size(), bytes);
+
+    // Request objects differ in size, DownloadRequest being one of the biggest
+    usage.add("pending_requests", m_requests.size(),
+              memory::hashMapBytes(m_requests) + m_requests.size() * sizeof(DownloadRequest));
+
+    bytes = memory::vectorBytes(m_sentMessages) + memory::vectorBytes(m_fileTransfers) +
+            memory::vectorBytes(m_contactUserIdsNoChat) + memory::vectorBytes(m_addContactRequests) +
+            memory::vectorBytes(m_expectedChats) + memory::treeMapBytes(m_unconfirmedChats);
+    for (const SendMessageInfo &info: m_sentMessages)
+        bytes += memory::stringBytes(info.tempFile);
+    usage.add("transfers_and_misc", m_sentMessages.size() + m_fileTransfers.size(), bytes);
+
+    size_t receiptCount = 0;
+    bytes = memory::hashMapBytes(m_pendingReadReceipts) + memory::vectorBytes(m_scheduledReadReceipts);
+    for (const auto &item: m_pendingReadReceipts) {
+        receiptCount += item.second.size();
+        bytes += memory::vectorBytes(item.second);
+    }
+    usage.add("read_receipts", receiptCount, bytes);
+
+    pendingMessages.getMemoryUsage(usage);
+    lastMessages.getMemoryUsage(usage);
+    recentMessages.getMemoryUsage(usage);
+}
@@ -4,12 +4,18 @@
 #include "buildopt.h"
 #include "identifiers.h"
 #include "transceiver.h"
+#include "last-message-store.h"
+#include "recent-message-cache.h"
+#include "memory-usage.h"
+#include "transceiver-stats.h"
 #include <td/telegram/td_api.h>
 
 #include <map>
+#include <unordered_map>
 #include <mutex>
 #include <set>
 #include <list>
+#include <deque>
 #include <purple.h>
 
 #ifndef NoVoip
@@ -33,6 +39,10 @@ SupergroupId getSupergroupId(const td::td_api::chat &chat);
 SecretChatId getSecretChatId(const td::td_api::chat &chat);
 bool        isGroupMember(const td::td_api::object_ptr<td::td_api::ChatMemberStatus> &status);
 bool        isSameUser(const td::td_api::MessageSender &member1, const td::td_api::MessageSender &member2);
+// Drop parts of user and chat objects which the plugin never looks at, so that they don't take
+// up memory for as long as the account is logged in
+void        compactUser(td::td_api::user &user);
+void        compactChat(td::td_api::chat &chat);
 
 enum {
     CHAT_HISTORY_REQUEST_LIMIT  = 50,
@@ -41,39 +51,62 @@ enum {
 
 class PendingRequest {
 public:
-    uint64_t requestId;
+    // Request class, so that TdAccountData can hand out the right subclass without dynamic_cast.
+    // Each subclass defines KIND.
+    enum class Kind: uint8_t {
+        GroupInfo,
+        SupergroupInfo,
+        SupergroupMembers,
+        Contact,
+        GroupJoin,
+        SendMessage,
+        Upload,
+        Download,
+        AvatarDownload,
+        NewPrivateChat,
+        ChatAction
+    };
+
+    uint64_t   requestId;
+    const Kind kind;
 
-    PendingRequest(uint64_t requestId) : requestId(requestId) {}
+    PendingRequest(uint64_t requestId, Kind kind) : requestId(requestId), kind(kind) {}
     virtual ~PendingRequest() {}
 };
 
 class GroupInfoRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::GroupInfo;
     BasicGroupId groupId;
 
     GroupInfoRequest(uint64_t requestId, BasicGroupId groupId)
-    : PendingRequest(requestId), groupId(groupId) {}
+    : PendingRequest(requestId, KIND), groupId(groupId) {}
 };
 
 class SupergroupInfoRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::SupergroupInfo;
     SupergroupId groupId;
 
     SupergroupInfoRequest(uint64_t requestId, SupergroupId groupId)
-    : PendingRequest(requestId), groupId(groupId) {}
+    : PendingRequest(requestId, KIND), groupId(groupId) {}
 };
 
-class GroupMembersRequestCont: public PendingRequest {
+// Next page of supergroup members
+class SupergroupMembersRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::SupergroupMembers;
     SupergroupId groupId;
-    td::td_api::object_ptr<td::td_api::chatMembers> members;
+    int32_t      offset;
+    int32_t      totalCount;
 
-    GroupMembersRequestCont(uint64_t requestId, SupergroupId groupId, td::td_api::chatMembers *members)
-    : PendingRequest(requestId), groupId(groupId), members(std::move(members)) {}
+    SupergroupMembersRequest(uint64_t requestId, SupergroupId groupId, int32_t offset, int32_t totalCount)
+    : PendingRequest(requestId, KIND), groupId(groupId), offset(offset), totalCount(totalCount) {}
 };
 
 class ContactRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::Contact;
     std::string phoneNumber;
     std::string alias;
     std::string groupName;
@@ -81,12 +114,13 @@ public:
 
     ContactRequest(uint64_t requestId, const std::string &phoneNumber, const std::string &alias,
                    const std::string &groupName, UserId userId)
-    : PendingRequest(requestId), phoneNumber(phoneNumber), alias(alias), groupName(groupName),
+    : PendingRequest(requestId, KIND), phoneNumber(phoneNumber), alias(alias), groupName(groupName),
       userId(userId) {}
 };
 
 class GroupJoinRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::GroupJoin;
     enum class Type {
         InviteLink,
         Username,
@@ -97,25 +131,27 @@ public:
 
     GroupJoinRequest(uint64_t requestId, const std::string &joinString, Type type,
                      ChatId chatId = ChatId::invalid)
-    : PendingRequest(requestId), joinString(joinString), type(type), chatId(chatId) {}
+    : PendingRequest(requestId, KIND), joinString(joinString), type(type), chatId(chatId) {}
 };
 
 class SendMessageRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::SendMessage;
     ChatId      chatId;
     std::string tempFile;
 
     SendMessageRequest(uint64_t requestId, ChatId chatId, const char *tempFile)
-    : PendingRequest(requestId), chatId(chatId), tempFile(tempFile ? tempFile : "") {}
+    : PendingRequest(requestId, KIND), chatId(chatId), tempFile(tempFile ? tempFile : "") {}
 };
 
 class UploadRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::Upload;
     PurpleXfer *xfer;
     ChatId      chatId;
 
     UploadRequest(uint64_t requestId, PurpleXfer *xfer, ChatId chatId)
-    : PendingRequest(requestId), xfer(xfer), chatId(chatId) {}
+    : PendingRequest(requestId, KIND), xfer(xfer), chatId(chatId) {}
 };
 
 struct TgMessageInfo {
@@ -154,6 +190,7 @@ class PurpleTdClient;
 // time-consuming downloads
 class DownloadRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::Download;
     ChatId         chatId;
 
     // For inline downloads this is a copy of original TgMessageInfo from IncomingMessage.
@@ -171,7 +208,7 @@ public:
     DownloadRequest(uint64_t requestId, ChatId chatId, TgMessageInfo &message,
                     int32_t fileId, int32_t fileSize, const std::string &fileDescription,
                     td::td_api::file *thumbnail)
-    : PendingRequest(requestId), chatId(chatId), fileId(fileId),
+    : PendingRequest(requestId, KIND), chatId(chatId), fileId(fileId),
       fileSize(fileSize), downloadedSize(0), fileDescription(fileDescription),
       thumbnail(thumbnail)
     {
@@ -187,31 +224,34 @@ public:
 
 class AvatarDownloadRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::AvatarDownload;
     UserId userId;
     ChatId chatId;
 
     AvatarDownloadRequest(uint64_t requestId, const td::td_api::user *user)
-    : PendingRequest(requestId), userId(getId(*user)), chatId(ChatId::invalid) {}
+    : PendingRequest(requestId, KIND), userId(getId(*user)), chatId(ChatId::invalid) {}
     AvatarDownloadRequest(uint64_t requestId, const td::td_api::chat *chat)
-    : PendingRequest(requestId), userId(UserId::invalid), chatId(getId(*chat)) {}
+    : PendingRequest(requestId, KIND), userId(UserId::invalid), chatId(getId(*chat)) {}
 };
 
 class NewPrivateChatForMessage: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::NewPrivateChat;
     std::string  username;
     std::string  message;
     PurpleXfer  *fileUpload;
 
     NewPrivateChatForMessage(uint64_t requestId, const char *username, const char *message)
-    : PendingRequest(requestId), username(username), message(message ? message : nullptr),
+    : PendingRequest(requestId, KIND), username(username), message(message ? message : nullptr),
       fileUpload(nullptr) {}
 
     NewPrivateChatForMessage(uint64_t requestId, const char *username, PurpleXfer *upload)
-    : PendingRequest(requestId), username(username), fileUpload(upload) {}
+    : PendingRequest(requestId, KIND), username(username), fileUpload(upload) {}
 };
 
 class ChatActionRequest: public PendingRequest {
 public:
+    static constexpr Kind KIND = Kind::ChatAction;
     enum class Type: uint8_t {
         Kick,
         Invite,
@@ -220,7 +260,7 @@ public:
     Type   type;
     ChatId chatId;
     ChatActionRequest(uint64_t requestId, Type type, ChatId chatId)
-    : PendingRequest(requestId), type(type), chatId(chatId) {}
+    : PendingRequest(requestId, KIND), type(type), chatId(chatId) {}
 };
 
 struct IncomingMessage {
@@ -254,6 +294,21 @@ public:
     static constexpr MessageAction Prepend = MessageAction::Prepend;
     using TdMessagePtr = td::td_api::object_ptr<td::td_api::message>;
 
+    // What happens to messages stuck behind one that is not ready yet, such as a photo being
+    // downloaded inline
+    enum class OrderPolicy {
+        // They wait, until the message is ready or its download times out
+        Strict,
+        // They wait for at most the reorder window, then are shown ahead of it
+        ReorderWindow,
+        // Inline downloads don't hold messages back at all: placeholder is shown right away and
+        // the file follows when downloaded
+        Placeholder
+    };
+
+    void             setOrderPolicy(OrderPolicy policy, unsigned reorderWindowMs);
+    OrderPolicy      getOrderPolicy() const { return m_policy; }
+
     IncomingMessage &addPendingMessage(IncomingMessage &&message, MessageAction action);
     void             setMessageReady(ChatId chatId, MessageId messageId,
                                      std::vector<IncomingMessage> &readyMessages);
@@ -263,22 +318,85 @@ public:
     void             setChatNotReady(ChatId chatId);
     void             setChatReady(ChatId chatId, std::vector<IncomingMessage> &readyMessages);
     bool             isChatReady(ChatId chatId);
+    // With reorder window: takes ready messages that have been held back for the whole window by
+    // messages not ready in front of them. Messages still not ready stay in the queue.
+    void             extractOverdueMessages(std::vector<IncomingMessage> &readyMessages);
+    // With reorder window: true if some ready message is being held back, and then delayMs is
+    // how soon extractOverdueMessages will have something to release
+    bool             getOverdueDelay(unsigned &delayMs) const;
+    void             getMemoryUsage(MemoryUsage &usage) const;
+    // Single-line JSON object: time messages spent in the queue and how many were reordered
+    std::string      getStatistics() const;
 private:
     struct Message {
         IncomingMessage message;
         bool            ready;
+        // Already shown ahead of messages in front of it, only kept until those leave the queue
+        bool            taken;
+        gint64          queuedAt;
     };
     struct ChatQueue {
-        ChatId             chatId;
-        bool               ready = true;
-        std::list<Message> messages;
+        ChatId              chatId;
+        bool                ready = true;
+        uint64_t            creationOrder;
+        // Position of messages.front(). Goes down on prepend and up when messages are taken from
+        // the front, so that a message keeps its position for as long as it is in the queue.
+        int64_t             frontPosition = 0;
+        // Deque rather than vector so that references returned by addPendingMessage stay valid
+        std::deque<Message> messages;
+        // Message id to position (several if the same message got queued twice)
+        std::unordered_multimap<int64_t, int64_t> positions;
+    };
+    std::unordered_map<int64_t, ChatQueue> m_queues;
+    uint64_t                               m_queuesCreated = 0;
+    OrderPolicy                            m_policy = OrderPolicy::Strict;
+    unsigned                               m_reorderWindowMs = 0;
+    LatencyHistogram                       m_waitTime;
+    uint64_t                               m_reordered = 0;
+
+    ChatQueue *getChatQueue(ChatId chatId);
+    ChatQueue &createChatQueue(ChatId chatId);
+    IncomingMessage &addMessage(ChatQueue &queue, IncomingMessage &&message, MessageAction action,
+                                bool ready);
+    Message *findMessage(ChatQueue &queue, MessageId messageId);
+    // Removes the queue if it ends up empty
+    void extractReadyMessages(ChatQueue &queue, std::vector<IncomingMessage> &readyMessages);
+    void takeMessage(ChatQueue &queue, Message &message, int64_t position,
+                     std::vector<IncomingMessage> &readyMessages, gint64 now);
+};
+
+// Chats waiting for history to be fetched after a gap, such as after a long disconnect. At most
+// a limited number of chats are fetched at a time. The rest wait, higher priority first and
+// otherwise in order of arrival.
+class HistoryFetchQueue {
+public:
+    struct Fetch {
+        ChatId    chatId;
+        MessageId fetchFrom;
+        MessageId stopAt;
+        unsigned  priority;
     };
-    std::vector<ChatQueue> m_queues;
 
-    std::vector<ChatQueue>::iterator getChatQueue(ChatId chatId);
-    Message &addMessage(ChatQueue &queue, MessageAction action);
-    void extractReadyMessages(std::vector<ChatQueue>::iterator pQueue,
-                              std::vector<IncomingMessage> &readyMessages);
+    // 0 means no limit
+    void        setLimit(unsigned limit) { m_limit = limit; }
+    // True if fetch can start right away, otherwise it is queued
+    bool        add(const Fetch &fetch);
+    // To be called when fetch for the chat is done. Returns true if another fetch is to start.
+    bool        finish(ChatId chatId, Fetch &next);
+    size_t      getRunning() const { return m_running.size(); }
+    size_t      getQueued() const { return m_queued.size(); }
+    // Single-line JSON object
+    std::string getStatistics() const;
+private:
+    struct QueuedFetch {
+        Fetch    fetch;
+        uint64_t order;
+    };
+    unsigned                 m_limit = 0;
+    std::vector<ChatId>      m_running;
+    std::vector<QueuedFetch> m_queued;
+    uint64_t                 m_added = 0;
+    uint64_t                 m_finished = 0;
 };
 
 struct ReadReceipt {
@@ -286,6 +404,13 @@ struct ReadReceipt {
     MessageId messageId;
 };
 
+// Message in PendingMessageQueue waiting for the message it replies to
+struct ReplySourceRequest {
+    ChatId    chatId;
+    MessageId sourceId;
+    MessageId pendingMessageId;
+};
+
 class TdAccountData {
 public:
     using TdUserPtr           = td::td_api::object_ptr<td::td_api::user>;
@@ -300,12 +425,20 @@ public:
     struct {
         unsigned maxCaptionLength = 0;
         unsigned maxMessageLength = 0;
+        // From account settings, 0 means read receipts are sent right away
+        unsigned readReceiptsDelayMs = 0;
+        // From account settings, 0 means every reply source is fetched with its own getMessage
+        unsigned replySourceBatchMs = 0;
+        // From account settings: catch up from tdlib message database before asking server,
+        // with page size adapted to the gap
+        bool     localFirstHistory = false;
     } options;
 
     PurpleAccount *const  purpleAccount;
     TdTransceiver        &transceiver;
     TdAccountData(PurpleAccount *purpleAccount, TdTransceiver &transceiver)
     : purpleAccount(purpleAccount), transceiver(transceiver) {}
+    ~TdAccountData();
 
     void updateUser(TdUserPtr user);
     void setUserStatus(UserId UserId, td::td_api::object_ptr<td::td_api::UserStatus> status);
@@ -318,7 +451,20 @@ public:
     void setSupergroupInfoRequested(SupergroupId groupId);
     bool isSupergroupInfoRequested(SupergroupId groupId);
     void updateSupergroupInfo(SupergroupId groupId, TdSupergroupInfoPtr groupInfo);
-    void updateSupergroupMembers(SupergroupId groupId, TdChatMembersPtr members);
+    // Merges members into those already known for the supergroup, by user id. Known members get
+    // new status, others are appended and, if addedMembers is given, listed there.
+    void addSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                              std::vector<const td::td_api::chatMember *> *addedMembers = nullptr);
+    // Same, but known members are left as they are. For members learned from messages, which
+    // don't carry their actual status.
+    void addNewSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                                 std::vector<const td::td_api::chatMember *> &addedMembers);
+    bool removeSupergroupMember(SupergroupId groupId, UserId userId);
+    // Members past the first page are only fetched while the chat has an open conversation.
+    // Paging stops where it got to until the conversation is opened.
+    void pauseSupergroupMembersPaging(SupergroupId groupId, int32_t offset, int32_t totalCount);
+    // True if paging was paused, offset and totalCount are then where to continue from
+    bool resumeSupergroupMembersPaging(SupergroupId groupId, int32_t &offset, int32_t &totalCount);
 
     void addChat(TdChatPtr chat); // Updates existing chat if any
     void updateChatPosition(ChatId chatId, td::td_api::object_ptr<td::td_api::chatPosition> &&position);
@@ -332,6 +478,16 @@ public:
     bool isExpectedChat(ChatId chatId);
     void removeExpectedChat(ChatId id);
 
+    // Warm start: users, groups and chats as of the end of previous session, so that lookups work
+    // before tdlib has sent them again. Chats loaded from snapshot remain unconfirmed until tdlib
+    // sends them (addChat). Returns false if the file is missing or corrupted, in which case
+    // nothing is loaded.
+    bool saveSnapshot(const std::string &path);
+    bool loadSnapshot(const std::string &path);
+    bool isUnconfirmedChat(ChatId chatId) const;
+    // Forgets chats from snapshot which tdlib has not sent again, i.e. which no longer exist
+    void removeUnconfirmedChats();
+
     const td::td_api::chat       *getChat(ChatId chatId) const;
     int                           getPurpleChatId(ChatId tdChatId);
     const td::td_api::chat       *getChatByPurpleId(int32_t purpleChatId) const;
@@ -358,23 +514,30 @@ public:
     template<typename ReqType, typename... ArgsType>
     void addPendingRequest(ArgsType... args)
     {
-        m_requests.push_back(std::make_unique<ReqType>(args...));
+        addPendingRequestImpl(std::make_unique<ReqType>(args...));
     }
     template<typename ReqType>
     void addPendingRequest(uint64_t requestId, std::unique_ptr<ReqType> &&request)
     {
-        m_requests.push_back(std::move(request));
-        m_requests.back()->requestId = requestId;
+        request->requestId = requestId;
+        addPendingRequestImpl(std::move(request));
     }
+    // Removes the request. If it is of a different type, it is still removed and NULL is returned.
     template<typename ReqType>
     std::unique_ptr<ReqType> getPendingRequest(uint64_t requestId)
     {
-        return std::unique_ptr<ReqType>(dynamic_cast<ReqType *>(getPendingRequestImpl(requestId).release()));
+        std::unique_ptr<PendingRequest> request = getPendingRequestImpl(requestId);
+        if (request && (request->kind == ReqType::KIND))
+            return std::unique_ptr<ReqType>(static_cast<ReqType *>(request.release()));
+        return nullptr;
     }
     template<typename ReqType>
     ReqType *findPendingRequest(uint64_t requestId)
     {
-        return dynamic_cast<ReqType *>(findPendingRequestImpl(requestId));
+        PendingRequest *request = findPendingRequestImpl(requestId);
+        if (request && (request->kind == ReqType::KIND))
+            return static_cast<ReqType *>(request);
+        return nullptr;
     }
 
     const ContactRequest *     findContactRequest(UserId userId);
@@ -403,9 +566,39 @@ public:
     void                       removeActiveCall();
 
     PendingMessageQueue        pendingMessages;
+    LastMessageStore           lastMessages;
+    RecentMessageCache         recentMessages;
+    HistoryFetchQueue          historyFetches;
 
     void                       addPendingReadReceipt(ChatId chatId, MessageId messageId);
     void                       extractPendingReadReceipts(ChatId chatId, std::vector<ReadReceipt> &receipts);
+    bool                       hasPendingReadReceipts(ChatId chatId) const;
+    // Remembers that read receipts for the chat are to be sent when the timer fires, starting
+    // the timer unless it is already running
+    void                       scheduleReadReceipts(ChatId chatId, unsigned delayMs, GSourceFunc sendFunction);
+    // To be called from timer function
+    void                       extractScheduledReadReceipts(std::vector<ChatId> &chatIds);
+
+    // Starts the timer for writing last message ids to the journal, unless it is already running
+    // or there is nothing to write
+    void                       scheduleLastMessagesFlush(GSourceFunc flushFunction);
+    // To be called from timer function
+    void                       flushLastMessages();
+
+    // Reply sources to be fetched with one getMessages per chat when the timer fires, starting
+    // the timer unless it is already running
+    void                       addReplySourceRequest(ChatId chatId, MessageId sourceId, MessageId pendingMessageId,
+                                                     unsigned delayMs, GSourceFunc fetchFunction);
+    // To be called from timer function, or to fetch right away without waiting for the timer
+    void                       extractReplySourceRequests(std::vector<std::pair<ChatId, std::vector<ReplySourceRequest>>> &requests);
+    // With reorder window: makes sure releaseFunction gets called when messages held back in
+    // pendingMessages are due to be shown
+    void                       scheduleOverdueMessages(GSourceFunc releaseFunction);
+    // To be called from that timer function
+    void                       extractOverdueMessages(std::vector<IncomingMessage> &readyMessages);
+
+    // Includes pendingMessages, lastMessages and recentMessages
+    void                       getMemoryUsage(MemoryUsage &usage) const;
 private:
     TdAccountData(const TdAccountData &other) = delete;
     TdAccountData &operator=(const TdAccountData &other) = delete;
@@ -432,7 +625,12 @@ private:
         TdSupergroupPtr     group;
         TdSupergroupInfoPtr fullInfo;
         TdChatMembersPtr    members;
+        // Position in members->members_ by user id
+        std::unordered_map<int64_t, size_t> memberIndex;
         bool                fullInfoRequested = false;
+        // Where fetching members stopped for lack of an open conversation, 0 if it didn't
+        int32_t             pausedPageOffset = 0;
+        int32_t             pausedPageTotal = 0;
     };
 
     struct SendMessageInfo {
@@ -450,6 +648,19 @@ private:
     using UserMap = std::map<UserId, UserInfo>;
     UserMap                            m_userInfo;
     ChatMap                            m_chatInfo;
+
+    // Reverse lookup indexes into m_chatInfo and m_userInfo, maintained by addChat, deleteChat and
+    // updateUser. If several chats or users share a key, the one with lowest id is indexed.
+    std::unordered_map<int64_t, ChatId>     m_privateChatByUser;
+    std::unordered_map<int32_t, ChatId>     m_chatByPurpleId;
+    std::unordered_map<int64_t, ChatId>     m_chatByBasicGroup;
+    std::unordered_map<int64_t, ChatId>     m_chatBySupergroup;
+    std::unordered_map<int32_t, ChatId>     m_chatBySecretChat;
+    std::unordered_map<std::string, UserId> m_userByPhone; // Canonical phone number
+    // Users by their (disambiguated) display name, in id order
+    std::unordered_map<std::string, std::vector<UserId>> m_usersByDisplayName;
+    // For display names which needed disambiguation: " #n" suffixes below this are all taken
+    std::unordered_map<std::string, unsigned>            m_displayNameSuffixHint;
     std::map<BasicGroupId, GroupInfo>  m_groups;
     std::map<SupergroupId, SupergroupInfo>  m_supergroups;
     std::map<SecretChatId, SecretChatPtr>   m_secretChats;
@@ -464,7 +675,13 @@ private:
     // Chats we want to libpurple-join when we get an updateNewChat about them
     std::vector<ChatId>                m_expectedChats;
 
-    std::vector<std::unique_ptr<PendingRequest>> m_requests;
+    // Chats loaded from snapshot for which there has been no updateNewChat yet
+    std::set<ChatId>                   m_unconfirmedChats;
+
+    std::unordered_map<uint64_t, std::unique_ptr<PendingRequest>> m_requests;
+    // Request ids of DownloadRequests by file id and of ContactRequests by user id
+    std::unordered_multimap<int32_t, uint64_t> m_downloadRequestsByFile;
+    std::unordered_multimap<int64_t, uint64_t> m_contactRequestsByUser;
 
     // Newly sent messages containing inline images, for which a temporary file must be removed when
     // transfer is completed
@@ -477,11 +694,35 @@ private:
     std::unique_ptr<tgvoip::VoIPController> m_callData;
     int32_t                                 m_callId;
 
+    void                            addPendingRequestImpl(std::unique_ptr<PendingRequest> request);
     std::unique_ptr<PendingRequest> getPendingRequestImpl(uint64_t requestId);
     PendingRequest *                findPendingRequestImpl(uint64_t requestId);
 
-    // Read receipts not sent immediately due to away status (grouped per chat)
-    std::vector<std::vector<ReadReceipt>> m_pendingReadReceipts;
+    void indexChat(ChatId chatId, const ChatInfo &info);
+    void unindexChat(ChatId chatId, const ChatInfo &info);
+    void mergeSupergroupMembers(SupergroupId groupId, td::td_api::chatMembers &members,
+                                std::vector<const td::td_api::chatMember *> *addedMembers, bool replaceKnown);
+    void reindexChats();
+    void indexUserPhone(const td::td_api::user &user);
+    void unindexUserPhone(const td::td_api::user &user);
+    bool isDisplayNameTaken(const std::string &displayName) const;
+    void addDisplayName(UserId userId, const std::string &displayName);
+    void removeDisplayName(UserId userId, const std::string &displayName);
+    // Compares indexes with what linear search would find, aborts on mismatch. Only compiled in
+    // with CHECK_ACCOUNT_DATA_INDEXES (debug builds and tests).
+    void checkIndexes() const;
+
+    // Read receipts not sent yet, because of away status or because they are being collected
+    // over a short time, by chat id
+    std::unordered_map<int64_t, std::vector<ReadReceipt>> m_pendingReadReceipts;
+    // Chats whose read receipts are sent when m_readReceiptsTimer fires
+    std::vector<ChatId>                m_scheduledReadReceipts;
+    guint                              m_readReceiptsTimer = 0;
+    guint                              m_lastMessagesFlushTimer = 0;
+    // Reply sources not fetched yet, by chat id
+    std::unordered_map<int64_t, std::vector<ReplySourceRequest>> m_replySourceRequests;
+    guint                              m_replySourcesTimer = 0;
+    guint                              m_overdueMessagesTimer = 0;
 };
 
 #endif
@@ -4,6 +4,7 @@
 #include "format.h"
 #include "receiving.h"
 #include "file-transfer.h"
+#include "td-client.h"
 #include <string.h>
 #include <stdlib.h>
 #include <algorithm>
@@ -235,6 +236,9 @@ PurpleConvChat *getChatConversation(TdAccountData &account, const td::td_api::ch
                     updateChatConversation(purpleChat, *supergroupInfo, account);
                 if (members)
                     updateSupergroupChatMembers(purpleChat, *members, account);
+                PurpleTdClient *tdClient = getTdClient(account.purpleAccount);
+                if (tdClient)
+                    tdClient->resumeSupergroupMembersPaging(supergroupId);
             }
         }
 
@@ -463,19 +467,39 @@ void removePrivateChat(TdAccountData &account, const td::td_api::chat &chat)
     //purple_account_remove_setting(account.purpleAccount, setting.c_str());
 }
 
+static gboolean flushLastMessages(gpointer data)
+{
+    static_cast<TdAccountData *>(data)->flushLastMessages();
+    return G_SOURCE_REMOVE;
+}
+
 void saveChatLastMessage(TdAccountData &account, ChatId chatId, MessageId messageId)
 {
-    std::string setting = lastMessageSetting(chatId);
-    std::string value = std::to_string(messageId.value());
-    purple_account_set_string(account.purpleAccount, setting.c_str(), value.c_str());
+    account.lastMessages.set(chatId, messageId);
+    account.scheduleLastMessagesFlush(flushLastMessages);
 }
 
 MessageId getChatLastMessage(TdAccountData &account, ChatId chatId)
 {
+    if (!account.lastMessages.contains(chatId))
+        migrateChatLastMessage(account, chatId);
+    return account.lastMessages.get(chatId);
+}
+
+void migrateChatLastMessage(TdAccountData &account, ChatId chatId)
+{
+    // Last message ids used to be kept in account settings, which makes libpurple rewrite
+    // accounts.xml on every message
     std::string setting = lastMessageSetting(chatId);
     const char *value = purple_account_get_string(account.purpleAccount, setting.c_str(), NULL);
-
-    return value ? MessageId::fromString(value) : MessageId();
+    if (value) {
+        MessageId messageId = MessageId::fromString(value);
+        if (messageId.valid() && !account.lastMessages.contains(chatId)) {
+            account.lastMessages.set(chatId, messageId);
+            account.scheduleLastMessagesFlush(flushLastMessages);
+        }
+        purple_account_remove_setting(account.purpleAccount, setting.c_str());
+    }
 }
 
 std::string makeBasicDisplayName(const td::td_api::user &user)
@@ -612,55 +636,69 @@ std::vector<PurpleChat *> findChatsByNewGroup(const char *name, int type)
     return result;
 }
 
-static void setChatMembers(PurpleConvChat *purpleChat,
-                           const std::vector<td::td_api::object_ptr<td::td_api::chatMember>> &members,
-                           const TdAccountData &account)
+static std::string getChatMemberName(const td::td_api::user &user, const TdAccountData &account)
 {
-    GList *flags = NULL;
-    std::vector<std::string> nameData;
+    std::string userName    = getPurpleBuddyName(user);
+    const char *phoneNumber = getCanonicalPhoneNumber(user.phone_number_.c_str());
+    if (purple_find_buddy(account.purpleAccount, userName.c_str()))
+        // libpurple will be able to map user name to alias because there is a buddy
+        return userName;
+    else if (!strcmp(getCanonicalPhoneNumber(purple_account_get_username(account.purpleAccount)), phoneNumber))
+        // This is us, so again libpurple will map phone number to alias
+        return purple_account_get_username(account.purpleAccount);
+    else
+        // Use first and last name instead
+        return account.getDisplayName(user);
+}
 
-    for (const auto &member: members) {
-        if (!member || !isGroupMember(member->status_))
-            continue;
-
-        const td::td_api::user *user = account.getUser(getUserId(*member));
-        if (!user || (user->type_ && (user->type_->get_id() == td::td_api::userTypeDeleted::ID)))
-            continue;
-
-        std::string userName    = getPurpleBuddyName(*user);
-        const char *phoneNumber = getCanonicalPhoneNumber(user->phone_number_.c_str());
-        if (purple_find_buddy(account.purpleAccount, userName.c_str()))
-            // libpurple will be able to map user name to alias because there is a buddy
-            nameData.emplace_back(userName);
-        else if (!strcmp(getCanonicalPhoneNumber(purple_account_get_username(account.purpleAccount)), phoneNumber))
-            // This is us, so again libpurple will map phone number to alias
-            nameData.emplace_back(purple_account_get_username(account.purpleAccount));
-        else {
-            // Use first and last name instead
-            std::string displayName = account.getDisplayName(*user);
-            nameData.emplace_back(displayName);
-        }
+static void addChatMember(const td::td_api::chatMember *member, const TdAccountData &account,
+                          std::vector<std::string> &nameData, GList *&flags)
+{
+    if (!member || !isGroupMember(member->status_))
+        return;
 
-        PurpleConvChatBuddyFlags flag;
-        if (member->status_->get_id() == td::td_api::chatMemberStatusCreator::ID)
-            flag = PURPLE_CBFLAGS_FOUNDER;
-        else if (member->status_->get_id() == td::td_api::chatMemberStatusAdministrator::ID)
-            flag = PURPLE_CBFLAGS_OP;
-        else
-            flag = PURPLE_CBFLAGS_NONE;
-        flags = g_list_append(flags, GINT_TO_POINTER(flag));
-    }
+    const td::td_api::user *user = account.getUser(getUserId(*member));
+    if (!user || (user->type_ && (user->type_->get_id() == td::td_api::userTypeDeleted::ID)))
+        return;
+
+    nameData.push_back(getChatMemberName(*user, account));
+
+    PurpleConvChatBuddyFlags flag;
+    if (member->status_->get_id() == td::td_api::chatMemberStatusCreator::ID)
+        flag = PURPLE_CBFLAGS_FOUNDER;
+    else if (member->status_->get_id() == td::td_api::chatMemberStatusAdministrator::ID)
+        flag = PURPLE_CBFLAGS_OP;
+    else
+        flag = PURPLE_CBFLAGS_NONE;
+    flags = g_list_append(flags, GINT_TO_POINTER(flag));
+}
 
+static void addChatUsers(PurpleConvChat *purpleChat, const std::vector<std::string> &nameData,
+                         GList *flags)
+{
     GList *names = NULL;
     for (const std::string &name: nameData)
         names = g_list_append(names, const_cast<char *>(name.c_str()));
 
-    purple_conv_chat_clear_users(purpleChat);
     purple_conv_chat_add_users(purpleChat, names, NULL, flags, false);
     g_list_free(names);
     g_list_free(flags);
 }
 
+static void setChatMembers(PurpleConvChat *purpleChat,
+                           const std::vector<td::td_api::object_ptr<td::td_api::chatMember>> &members,
+                           const TdAccountData &account)
+{
+    GList *flags = NULL;
+    std::vector<std::string> nameData;
+
+    for (const auto &member: members)
+        addChatMember(member.get(), account, nameData, flags);
+
+    purple_conv_chat_clear_users(purpleChat);
+    addChatUsers(purpleChat, nameData, flags);
+}
+
 void updateChatConversation(PurpleConvChat *purpleChat, const td::td_api::basicGroupFullInfo &groupInfo,
                     const TdAccountData &account)
 {
@@ -680,6 +718,31 @@ void updateSupergroupChatMembers(PurpleConvChat* purpleChat, const td::td_api::c
     setChatMembers(purpleChat, members.members_, account);
 }
 
+void addSupergroupChatMembers(PurpleConvChat *purpleChat,
+                              const std::vector<const td::td_api::chatMember *> &members,
+                              const TdAccountData &account)
+{
+    GList *flags = NULL;
+    std::vector<std::string> nameData;
+
+    for (const td::td_api::chatMember *member: members)
+        addChatMember(member, account, nameData, flags);
+
+    if (!nameData.empty())
+        addChatUsers(purpleChat, nameData, flags);
+    else
+        g_list_free(flags);
+}
+
+void removeSupergroupChatMember(PurpleConvChat *purpleChat, UserId userId, const TdAccountData &account)
+{
+    const td::td_api::user *user = account.getUser(userId);
+    if (user) {
+        std::string name = getChatMemberName(*user, account);
+        purple_conv_chat_remove_user(purpleChat, name.c_str(), NULL);
+    }
+}
+
 struct MessagePart {
     bool        isImage = false;
     int         imageId = 0;
@@ -30,6 +30,7 @@ void                removeGroupChat(PurpleAccount *purpleAccount, const td::td_a
 void                removePrivateChat(TdAccountData &account, const td::td_api::chat &chat);
 void                saveChatLastMessage(TdAccountData &account, ChatId chatId, MessageId messageId);
 MessageId           getChatLastMessage(TdAccountData &account, ChatId chatId);
+void                migrateChatLastMessage(TdAccountData &account, ChatId chatId);
 std::string         makeBasicDisplayName(const td::td_api::user &user);
 std::string         getIncomingGroupchatSenderPurpleName(const td::td_api::chat &chat, const td::td_api::message &message,
                                                          const TdAccountData &account);
@@ -52,6 +53,10 @@ void updateChatConversation(PurpleConvChat *purpleChat, const td::td_api::superg
                     const TdAccountData &account);
 void updateSupergroupChatMembers(PurpleConvChat *purpleChat, const td::td_api::chatMembers &members,
                                  const TdAccountData &account);
+void addSupergroupChatMembers(PurpleConvChat *purpleChat,
+                              const std::vector<const td::td_api::chatMember *> &members,
+                              const TdAccountData &account);
+void removeSupergroupChatMember(PurpleConvChat *purpleChat, UserId userId, const TdAccountData &account);
 
 int  transmitMessage(ChatId chatId, const char *message, TdTransceiver &transceiver,
                      TdAccountData &account, TdTransceiver::ResponseCb response);
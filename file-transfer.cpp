@@ -327,10 +327,14 @@ void downloadFileInline(int32_t fileId, ChatId chatId, TgMessageInfo &message,
                                                message, fileId, 0, fileDescription, thumbnail.release());
 
     account.addPendingRequest<DownloadRequest>(requestId, std::move(request));
-    transceiver.setQueryTimer(requestId,
-                              [&transceiver, &account](uint64_t reqId, td::td_api::object_ptr<td::td_api::Object>) {
-                                  handleLongInlineDownload(reqId, transceiver, account);
-                              }, 1, false);
+    if (account.pendingMessages.getOrderPolicy() == PendingMessageQueue::OrderPolicy::Placeholder)
+        // Don't even wait for quick downloads, so that nothing after this message is held back
+        handleLongInlineDownload(requestId, transceiver, account);
+    else
+        transceiver.setQueryTimer(requestId,
+                                  [&transceiver, &account](uint64_t reqId, td::td_api::object_ptr<td::td_api::Object>) {
+                                      handleLongInlineDownload(reqId, transceiver, account);
+                                  }, 1, false);
 }
 
 static void updateDownloadProgress(const td::td_api::file &file, PurpleXfer *xfer, TdAccountData &account)
@@ -95,6 +95,16 @@ UserId getUserId(const td::td_api::users &users, unsigned index)
     return UserId(users.user_ids_[index]);
 }
 
+UserId getUserId(const td::td_api::messageChatAddMembers &message, unsigned index)
+{
+    return UserId(message.member_user_ids_[index]);
+}
+
+UserId getUserId(const td::td_api::messageChatDeleteMember &message)
+{
+    return UserId(message.user_id_);
+}
+
 ChatId getChatId(const td::td_api::updateChatPosition &update)
 {
     return ChatId(update.chat_id_);
@@ -66,6 +66,8 @@ DEFINE_ID_CLASS(UserId, int64_t)
     friend UserId getUserId(const td::td_api::updateUserChatAction &update);
     friend UserId getUserId(const td::td_api::importedContacts &contacts, unsigned index);
     friend UserId getUserId(const td::td_api::users &users, unsigned index);
+    friend UserId getUserId(const td::td_api::messageChatAddMembers &message, unsigned index);
+    friend UserId getUserId(const td::td_api::messageChatDeleteMember &message);
 };
 
 DEFINE_ID_CLASS(ChatId, int64_t)
@@ -98,6 +100,7 @@ DEFINE_ID_CLASS(SecretChatId, int32_t)
 DEFINE_ID_CLASS(MessageId, int64_t)
     friend MessageId getId(const td::td_api::message &message);
     friend MessageId getReplyMessageId(const td::td_api::message &message);
+    friend class LastMessageStore;
 };
 
 #undef DEFINE_ID_CLASS
@@ -119,6 +122,8 @@ UserId       getUserId(const td::td_api::updateUserStatus &update);
 UserId       getUserId(const td::td_api::updateUserChatAction &update);
 UserId       getUserId(const td::td_api::importedContacts &contacts, unsigned index);
 UserId       getUserId(const td::td_api::users &users, unsigned index);
+UserId       getUserId(const td::td_api::messageChatAddMembers &message, unsigned index);
+UserId       getUserId(const td::td_api::messageChatDeleteMember &message);
 
 ChatId       getChatId(const td::td_api::updateChatPosition &update);
 ChatId       getChatId(const td::td_api::updateChatTitle &update);
@@ -0,0 +1,164 @@
+#include "last-message-store.h"
+#include "config.h"
+#include <string.h>
+
+static const char JOURNAL_MAGIC[8] = {'T', 'G', 'L', 'A', 'S', 'T', 'M', '1'};
+
+LastMessageStore::LastMessageStore()
+:   m_file(NULL),
+    m_journalRecords(0)
+{
+}
+
+LastMessageStore::~LastMessageStore()
+{
+    close();
+}
+
+bool LastMessageStore::open(const std::string &path)
+{
+    close();
+    m_path = path;
+    m_lastMessages.clear();
+    m_pending.clear();
+
+    // Missing, damaged or overgrown journal is rewritten from whatever could be read
+    if (!load() || (m_journalRecords > 2 * m_lastMessages.size() + COMPACT_SLACK))
+        return compact();
+
+    m_file = fopen(m_path.c_str(), "ab");
+    if (!m_file) {
+        purple_debug_warning(config::pluginId, "Failed to open %s for writing\n", m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void LastMessageStore::close()
+{
+    flush();
+    if (m_file) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+bool LastMessageStore::load()
+{
+    m_journalRecords = 0;
+
+    gchar  *contents = NULL;
+    gsize   length   = 0;
+    if (!g_file_get_contents(m_path.c_str(), &contents, &length, NULL))
+        return false;
+
+    bool ok = (length >= sizeof(JOURNAL_MAGIC)) &&
+              !memcmp(contents, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    if (ok) {
+        size_t position = sizeof(JOURNAL_MAGIC);
+        for (; position + sizeof(Record) <= length; position += sizeof(Record)) {
+            Record record;
+            memcpy(&record, contents + position, sizeof(record));
+            m_lastMessages[record.chatId] = record.messageId;
+            m_journalRecords++;
+        }
+        // Partial record at the end means crash while appending
+        if (position != length) {
+            purple_debug_warning(config::pluginId, "Ignoring truncated record at the end of %s\n",
+                                 m_path.c_str());
+            ok = false;
+        }
+    } else
+        purple_debug_warning(config::pluginId, "%s is not a last message journal\n", m_path.c_str());
+
+    g_free(contents);
+    purple_debug_misc(config::pluginId, "Loaded last message ids for %zu chats from %zu records\n",
+                      m_lastMessages.size(), m_journalRecords);
+    return ok;
+}
+
+bool LastMessageStore::compact()
+{
+    if (m_file) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    std::string tempPath = m_path + ".tmp";
+    FILE       *file     = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        purple_debug_warning(config::pluginId, "Failed to open %s for writing\n", tempPath.c_str());
+        return false;
+    }
+
+    bool ok = (fwrite(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC), 1, file) == 1);
+    for (auto it = m_lastMessages.begin(); ok && (it != m_lastMessages.end()); ++it) {
+        Record record = {it->first, it->second};
+        ok = (fwrite(&record, sizeof(record), 1, file) == 1);
+    }
+    if (fclose(file) != 0)
+        ok = false;
+    if (ok && (rename(tempPath.c_str(), m_path.c_str()) != 0))
+        ok = false;
+    if (!ok) {
+        purple_debug_warning(config::pluginId, "Failed to write %s\n", m_path.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    m_journalRecords = m_lastMessages.size();
+    m_file = fopen(m_path.c_str(), "ab");
+    return (m_file != NULL);
+}
+
+void LastMessageStore::set(ChatId chatId, MessageId messageId)
+{
+    auto it = m_lastMessages.find(chatId.value());
+    if ((it != m_lastMessages.end()) && (it->second == messageId.value()))
+        return;
+    m_lastMessages[chatId.value()] = messageId.value();
+
+    // Without a journal, just keep track in memory for this session
+    if (!m_file)
+        return;
+    m_pending.push_back({chatId.value(), messageId.value()});
+    if (m_pending.size() >= FLUSH_RECORDS)
+        flush();
+}
+
+void LastMessageStore::getMemoryUsage(MemoryUsage &usage) const
+{
+    usage.add("last_messages", m_lastMessages.size(),
+              memory::hashMapBytes(m_lastMessages) + memory::vectorBytes(m_pending) +
+              memory::stringBytes(m_path));
+}
+
+MessageId LastMessageStore::get(ChatId chatId) const
+{
+    auto it = m_lastMessages.find(chatId.value());
+    if (it != m_lastMessages.end())
+        return MessageId(it->second);
+    return MessageId::invalid;
+}
+
+bool LastMessageStore::contains(ChatId chatId) const
+{
+    return (m_lastMessages.find(chatId.value()) != m_lastMessages.end());
+}
+
+void LastMessageStore::flush()
+{
+    if (m_pending.empty() || !m_file)
+        return;
+
+    bool ok = (fwrite(m_pending.data(), sizeof(Record), m_pending.size(), m_file) == m_pending.size()) &&
+              (fflush(m_file) == 0);
+    m_journalRecords += m_pending.size();
+    m_pending.clear();
+
+    if (!ok) {
+        purple_debug_warning(config::pluginId, "Failed to append to %s\n", m_path.c_str());
+        compact();
+    } else if (m_journalRecords > 2 * m_lastMessages.size() + COMPACT_SLACK)
+        compact();
+}
@@ -0,0 +1,63 @@
+#ifndef _LAST_MESSAGE_STORE_H
+#define _LAST_MESSAGE_STORE_H
+
+#include "identifiers.h"
+#include "memory-usage.h"
+#include <purple.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Last seen message id for every chat, used to detect messages skipped by tdlib while offline.
+// Changes are kept in memory and appended to a journal file in batches, so that a message does
+// not cost a disk write. A batch is written once it has FLUSH_RECORDS changes; otherwise the owner
+// is expected to call flush() from a timer within FLUSH_INTERVAL_SECONDS of the first change.
+// Journal is rewritten from memory once it has grown to several times the number of chats. On
+// crash, changes since last flush are lost, which at worst means re-fetching a few messages that
+// were already shown.
+class LastMessageStore {
+public:
+    LastMessageStore();
+    ~LastMessageStore();
+    LastMessageStore(const LastMessageStore &) = delete;
+    LastMessageStore &operator=(const LastMessageStore &) = delete;
+
+    enum {
+        FLUSH_INTERVAL_SECONDS = 30
+    };
+
+    // Loads existing journal, if any, and keeps it open for appending
+    bool      open(const std::string &path);
+    void      close();
+
+    void      set(ChatId chatId, MessageId messageId);
+    MessageId get(ChatId chatId) const;
+    bool      contains(ChatId chatId) const;
+    void      flush();
+    // True if there are changes not written to the journal yet
+    bool      hasPending() const { return !m_pending.empty(); }
+    void      getMemoryUsage(MemoryUsage &usage) const;
+private:
+    enum {
+        FLUSH_RECORDS = 64,
+        // Journal is compacted once it has this many records more than twice the number of chats
+        COMPACT_SLACK = 1024
+    };
+
+    struct Record {
+        int64_t chatId;
+        int64_t messageId;
+    };
+
+    std::string                          m_path;
+    FILE                                *m_file;
+    std::unordered_map<int64_t, int64_t> m_lastMessages;
+    std::vector<Record>                  m_pending;
+    size_t                               m_journalRecords;
+
+    bool load();
+    bool compact();
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "memory-usage.h"
+
+void MemoryUsage::add(const char *name, size_t count, size_t bytes)
+{
+    items.push_back({name, count, bytes});
+}
+
+size_t MemoryUsage::totalBytes() const
+{
+    size_t total = 0;
+    for (const Item &item: items)
+        total += item.bytes;
+    return total;
+}
+
+std::string MemoryUsage::toJson() const
+{
+    std::string out;
+    out += "{\"total_bytes\":" + std::to_string(totalBytes());
+    for (const Item &item: items) {
+        // Item names need no escaping
+        out += ",\"" + item.name + "\":{\"count\":" + std::to_string(item.count);
+        out += ",\"bytes\":" + std::to_string(item.bytes) + '}';
+    }
+    out += '}';
+
+    return out;
+}
+
+namespace memory {
+
+size_t stringBytes(const std::string &s)
+{
+    // Short strings are stored inline
+    return (s.capacity() > 15) ? s.capacity() + 1 : 0;
+}
+
+size_t fileBytes(const td::td_api::file *file)
+{
+    if (!file)
+        return 0;
+    size_t result = sizeof(*file);
+    if (file->local_)
+        result += sizeof(*file->local_) + stringBytes(file->local_->path_);
+    if (file->remote_)
+        result += sizeof(*file->remote_) + stringBytes(file->remote_->id_) +
+                  stringBytes(file->remote_->unique_id_);
+    return result;
+}
+
+static size_t minithumbnailBytes(const td::td_api::minithumbnail *thumbnail)
+{
+    return thumbnail ? sizeof(*thumbnail) + stringBytes(thumbnail->data_) : 0;
+}
+
+static size_t formattedTextBytes(const td::td_api::formattedText *text)
+{
+    if (!text)
+        return 0;
+    // Entity types are small objects without strings except for URLs
+    return sizeof(*text) + stringBytes(text->text_) +
+           text->entities_.size() * (sizeof(td::td_api::textEntity) + sizeof(td::td_api::textEntityTypeBold));
+}
+
+static size_t photoBytes(const td::td_api::photo *photo)
+{
+    if (!photo)
+        return 0;
+    size_t result = sizeof(*photo) + minithumbnailBytes(photo->minithumbnail_.get());
+    for (const auto &size: photo->sizes_)
+        if (size)
+            result += sizeof(*size) + stringBytes(size->type_) + fileBytes(size->photo_.get());
+    return result;
+}
+
+static size_t contentBytes(const td::td_api::MessageContent *content)
+{
+    if (!content)
+        return 0;
+
+    switch (content->get_id()) {
+    case td::td_api::messageText::ID: {
+        const auto &text = static_cast<const td::td_api::messageText &>(*content);
+        return sizeof(text) + formattedTextBytes(text.text_.get());
+    }
+    case td::td_api::messagePhoto::ID: {
+        const auto &photo = static_cast<const td::td_api::messagePhoto &>(*content);
+        return sizeof(photo) + photoBytes(photo.photo_.get()) + formattedTextBytes(photo.caption_.get());
+    }
+    case td::td_api::messageSticker::ID: {
+        const auto &sticker = static_cast<const td::td_api::messageSticker &>(*content);
+        size_t result = sizeof(sticker);
+        if (sticker.sticker_)
+            result += sizeof(*sticker.sticker_) + stringBytes(sticker.sticker_->emoji_) +
+                      fileBytes(sticker.sticker_->sticker_.get());
+        return result;
+    }
+    case td::td_api::messageDocument::ID: {
+        const auto &document = static_cast<const td::td_api::messageDocument &>(*content);
+        size_t result = sizeof(document) + formattedTextBytes(document.caption_.get());
+        if (document.document_)
+            result += sizeof(*document.document_) + stringBytes(document.document_->file_name_) +
+                      stringBytes(document.document_->mime_type_) +
+                      fileBytes(document.document_->document_.get());
+        return result;
+    }
+    default:
+        // Other kinds are rare enough for a ballpark figure to do
+        return sizeof(td::td_api::messagePhoto);
+    }
+}
+
+size_t messageBytes(const td::td_api::message *message)
+{
+    if (!message)
+        return 0;
+    return sizeof(*message) + sizeof(td::td_api::messageSenderUser) +
+           stringBytes(message->author_signature_) + contentBytes(message->content_.get());
+}
+
+size_t userBytes(const td::td_api::user &user)
+{
+    size_t result = sizeof(user) + stringBytes(user.first_name_) + stringBytes(user.last_name_) +
+                    stringBytes(user.username_) + stringBytes(user.phone_number_) +
+                    stringBytes(user.restriction_reason_) + stringBytes(user.language_code_) +
+                    sizeof(td::td_api::userStatusOffline) + sizeof(td::td_api::userTypeRegular);
+    if (user.profile_photo_)
+        result += sizeof(*user.profile_photo_) + fileBytes(user.profile_photo_->small_.get()) +
+                  fileBytes(user.profile_photo_->big_.get()) +
+                  minithumbnailBytes(user.profile_photo_->minithumbnail_.get());
+    return result;
+}
+
+size_t chatBytes(const td::td_api::chat &chat)
+{
+    size_t result = sizeof(chat) + stringBytes(chat.title_) + stringBytes(chat.client_data_) +
+                    sizeof(td::td_api::chatTypeSupergroup) + messageBytes(chat.last_message_.get()) +
+                    chat.positions_.size() * (sizeof(td::td_api::chatPosition) + sizeof(td::td_api::chatListMain));
+    if (chat.photo_)
+        result += sizeof(*chat.photo_) + fileBytes(chat.photo_->small_.get()) +
+                  fileBytes(chat.photo_->big_.get()) + minithumbnailBytes(chat.photo_->minithumbnail_.get());
+    return result;
+}
+
+size_t chatMemberBytes(const td::td_api::chatMember *member)
+{
+    if (!member)
+        return 0;
+    // Creator and administrator status may have custom title, which is usually short
+    return sizeof(*member) + sizeof(td::td_api::messageSenderUser) +
+           sizeof(td::td_api::chatMemberStatusAdministrator);
+}
+
+size_t basicGroupInfoBytes(const td::td_api::basicGroupFullInfo *info)
+{
+    if (!info)
+        return 0;
+    size_t result = sizeof(*info) + stringBytes(info->description_) +
+                    info->members_.capacity() * sizeof(info->members_[0]);
+    for (const auto &member: info->members_)
+        result += chatMemberBytes(member.get());
+    if (info->invite_link_)
+        result += sizeof(*info->invite_link_) + stringBytes(info->invite_link_->invite_link_);
+    return result;
+}
+
+size_t supergroupInfoBytes(const td::td_api::supergroupFullInfo *info)
+{
+    if (!info)
+        return 0;
+    size_t result = sizeof(*info) + stringBytes(info->description_);
+    if (info->invite_link_)
+        result += sizeof(*info->invite_link_) + stringBytes(info->invite_link_->invite_link_);
+    return result;
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef _MEMORY_USAGE_H
+#define _MEMORY_USAGE_H
+
+#include <td/telegram/td_api.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Approximate heap taken by per-account data, by kind of object. Estimates count objects and
+// strings held by pointer plus typical container overhead, not allocator overhead, so they are
+// good for comparing accounts and spotting outliers rather than as absolute numbers.
+struct MemoryUsage {
+    struct Item {
+        std::string name;
+        size_t      count;
+        size_t      bytes;
+    };
+    std::vector<Item> items;
+
+    void        add(const char *name, size_t count, size_t bytes);
+    size_t      totalBytes() const;
+    // Single-line JSON object, in the same spirit as TdTransceiver::getStatistics
+    std::string toJson() const;
+};
+
+namespace memory {
+
+size_t stringBytes(const std::string &s);
+size_t fileBytes(const td::td_api::file *file);
+size_t userBytes(const td::td_api::user &user);
+size_t chatBytes(const td::td_api::chat &chat);
+size_t messageBytes(const td::td_api::message *message);
+size_t chatMemberBytes(const td::td_api::chatMember *member);
+size_t basicGroupInfoBytes(const td::td_api::basicGroupFullInfo *info);
+size_t supergroupInfoBytes(const td::td_api::supergroupFullInfo *info);
+
+// Container overhead, not counting what elements point to
+template<typename Map>
+size_t hashMapBytes(const Map &map)
+{
+    // Node with next pointer and cached hash, plus bucket array
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void *)) +
+           map.bucket_count() * sizeof(void *);
+}
+
+template<typename Map>
+size_t treeMapBytes(const Map &map)
+{
+    // Node with parent, left and right pointers and colour
+    return map.size() * (sizeof(typename Map::value_type) + 4 * sizeof(void *));
+}
+
+template<typename Vector>
+size_t vectorBytes(const Vector &vector)
+{
+    return vector.capacity() * sizeof(typename Vector::value_type);
+}
+
+}
+
+#endif
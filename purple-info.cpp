@@ -174,3 +174,64 @@ bool isReadReceiptsEnabled(PurpleAccount *account)
     else
         return true;
 }
+
+static unsigned getUnsignedOption(PurpleAccount *account, const char *name, const char *defaultValue)
+{
+    const char *value = purple_account_get_string(account, name, defaultValue);
+    char       *endptr;
+    unsigned long result = strtoul(value, &endptr, 10);
+
+    if ((*endptr != '\0') || (result > UINT_MAX)) {
+        purple_debug_warning(config::pluginId, "Invalid value '%s' for %s, using default\n", value, name);
+        result = strtoul(defaultValue, NULL, 10);
+    }
+
+    return result;
+}
+
+unsigned getDispatchTimeBudgetMs(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::DispatchTimeBudget,
+                             AccountOptions::DispatchTimeBudgetDefault);
+}
+
+unsigned getDispatchItemBudget(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::DispatchItemBudget,
+                             AccountOptions::DispatchItemBudgetDefault);
+}
+
+unsigned getStatisticsInterval(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::StatisticsInterval,
+                             AccountOptions::StatisticsIntervalDefault);
+}
+
+unsigned getReadReceiptsDelayMs(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::ReadReceiptsDelay,
+                             AccountOptions::ReadReceiptsDelayDefault);
+}
+
+unsigned getRecentMessagesCacheSize(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::RecentMessagesCacheSize,
+                             AccountOptions::RecentMessagesCacheSizeDefault);
+}
+
+unsigned getReplySourceBatchMs(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::ReplySourceBatch,
+                             AccountOptions::ReplySourceBatchDefault);
+}
+
+unsigned getHistoryFetchConcurrency(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::HistoryFetchConcurrency,
+                             AccountOptions::HistoryFetchConcurrencyDefault);
+}
+
+unsigned getReorderWindowMs(PurpleAccount *account)
+{
+    return getUnsignedOption(account, AccountOptions::ReorderWindow, AccountOptions::ReorderWindowDefault);
+}
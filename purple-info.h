@@ -48,6 +48,39 @@ namespace AccountOptions {
     constexpr gboolean    KeepInlineDownloadsDefault = FALSE;
     constexpr const char *ReadReceipts               = "read-receipts";
     constexpr gboolean    ReadReceiptsDefault        = TRUE;
+    constexpr const char *DispatchTimeBudget         = "dispatch-time-budget-ms";
+    constexpr const char *DispatchTimeBudgetDefault  = "0";
+    constexpr const char *DispatchItemBudget         = "dispatch-item-budget";
+    constexpr const char *DispatchItemBudgetDefault  = "0";
+    constexpr const char *CoalesceUpdates            = "coalesce-updates";
+    constexpr gboolean    CoalesceUpdatesDefault     = FALSE;
+    constexpr const char *PrioritizeMessages         = "prioritize-messages";
+    constexpr gboolean    PrioritizeMessagesDefault  = FALSE;
+    constexpr const char *SharedPollThread           = "shared-poll-thread";
+    constexpr gboolean    SharedPollThreadDefault    = FALSE;
+    constexpr const char *RecordSessionFile          = "record-session-file";
+    constexpr const char *RecordSessionFileDefault   = "";
+    constexpr const char *StatisticsInterval         = "statistics-interval";
+    constexpr const char *StatisticsIntervalDefault  = "0";
+    constexpr const char *WarmStart                  = "warm-start";
+    constexpr gboolean    WarmStartDefault           = FALSE;
+    constexpr const char *ReadReceiptsDelay          = "read-receipts-delay-ms";
+    constexpr const char *ReadReceiptsDelayDefault   = "0";
+    constexpr const char *RecentMessagesCacheSize    = "recent-messages-cache-size";
+    constexpr const char *RecentMessagesCacheSizeDefault = "0";
+    constexpr const char *ReplySourceBatch           = "reply-source-batch-ms";
+    constexpr const char *ReplySourceBatchDefault    = "0";
+    constexpr const char *LocalFirstHistory          = "local-first-history";
+    constexpr gboolean    LocalFirstHistoryDefault   = FALSE;
+    constexpr const char *HistoryFetchConcurrency    = "history-fetch-concurrency";
+    constexpr const char *HistoryFetchConcurrencyDefault = "0";
+    constexpr const char *MessageOrder               = "message-order";
+    constexpr const char *MessageOrderStrict         = "strict";
+    constexpr const char *MessageOrderReorderWindow  = "reorder-window";
+    constexpr const char *MessageOrderPlaceholder    = "placeholder";
+    constexpr const char *MessageOrderDefault        = MessageOrderStrict;
+    constexpr const char *ReorderWindow              = "reorder-window-ms";
+    constexpr const char *ReorderWindowDefault       = "300";
 };
 
 namespace BuddyOptions {
@@ -61,5 +94,13 @@ PurpleTdClient *getTdClient(PurpleAccount *account);
 const char *getUiName();
 bool        canDisableReadReceipts();
 bool        isReadReceiptsEnabled(PurpleAccount *account);
+unsigned    getDispatchTimeBudgetMs(PurpleAccount *account);
+unsigned    getDispatchItemBudget(PurpleAccount *account);
+unsigned    getStatisticsInterval(PurpleAccount *account);
+unsigned    getReadReceiptsDelayMs(PurpleAccount *account);
+unsigned    getRecentMessagesCacheSize(PurpleAccount *account);
+unsigned    getReplySourceBatchMs(PurpleAccount *account);
+unsigned    getHistoryFetchConcurrency(PurpleAccount *account);
+unsigned    getReorderWindowMs(PurpleAccount *account);
 
 #endif
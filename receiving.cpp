@@ -9,7 +9,12 @@
 #include <algorithm>
 
 enum {
-    HISTORY_MESSAGES_ABSOLUTE_LIMIT = 10000
+    HISTORY_MESSAGES_ABSOLUTE_LIMIT = 10000,
+    // Page size used before local-first catch-up was added
+    HISTORY_PAGE_SIZE_DEFAULT       = 30,
+    HISTORY_PAGE_SIZE_MIN           = 20,
+    // Most tdlib will return from getChatHistory
+    HISTORY_PAGE_SIZE_MAX           = 100
 };
 
 std::string makeNoticeWithSender(const td::td_api::chat &chat, const TgMessageInfo &message,
@@ -43,6 +48,37 @@ static PurpleMessageFlags getNotificationFlags(PurpleMessageFlags extraFlags)
     return (PurpleMessageFlags)flags;
 }
 
+static void sendChatReadReceipts(TdAccountData &account, ChatId chatId)
+{
+    std::vector<ReadReceipt> receipts;
+    account.extractPendingReadReceipts(chatId, receipts);
+
+    if (!receipts.empty()) {
+        purple_debug_misc(config::pluginId, "Sending %zu read receipts for chat %" G_GINT64_FORMAT "\n",
+                          receipts.size(), chatId.value());
+        td::td_api::object_ptr<td::td_api::viewMessages> viewMessagesReq = td::td_api::make_object<td::td_api::viewMessages>();
+        viewMessagesReq->chat_id_ = chatId.value();
+        viewMessagesReq->force_read_ = true; // no idea what "closed chats" are at this point
+        viewMessagesReq->message_ids_.resize(receipts.size());
+        for (size_t i = 0; i < receipts.size(); i++)
+            viewMessagesReq->message_ids_[i] = receipts[i].messageId.value();
+        account.transceiver.sendQuery(std::move(viewMessagesReq), nullptr);
+    }
+}
+
+// Timer function for read receipts collected over TdAccountData::options.readReceiptsDelayMs,
+// sends one viewMessages per chat
+static gboolean sendScheduledReadReceipts(gpointer data)
+{
+    TdAccountData      &account = *static_cast<TdAccountData *>(data);
+    std::vector<ChatId> chatIds;
+    account.extractScheduledReadReceipts(chatIds);
+    for (ChatId chatId: chatIds)
+        sendChatReadReceipts(account, chatId);
+
+    return G_SOURCE_REMOVE;
+}
+
 void sendConversationReadReceipts(TdAccountData &account, PurpleConversation *conv)
 {
     if (!conversationHasFocus(conv))
@@ -66,20 +102,10 @@ void sendConversationReadReceipts(TdAccountData &account, PurpleConversation *co
     } else if (convType == PURPLE_CONV_TYPE_CHAT)
         chatId = getTdlibChatId(convName);
 
-    std::vector<ReadReceipt> receipts;
-    account.extractPendingReadReceipts(chatId, receipts);
-
-    if (!receipts.empty()) {
-        purple_debug_misc(config::pluginId, "Sending %zu read receipts for chat %" G_GINT64_FORMAT "\n",
-                          receipts.size(), chatId.value());
-        td::td_api::object_ptr<td::td_api::viewMessages> viewMessagesReq = td::td_api::make_object<td::td_api::viewMessages>();
-        viewMessagesReq->chat_id_ = chatId.value();
-        viewMessagesReq->force_read_ = true; // no idea what "closed chats" are at this point
-        viewMessagesReq->message_ids_.resize(receipts.size());
-        for (size_t i = 0; i < receipts.size(); i++)
-            viewMessagesReq->message_ids_[i] = receipts[i].messageId.value();
-        account.transceiver.sendQuery(std::move(viewMessagesReq), nullptr);
-    }
+    if (account.options.readReceiptsDelayMs == 0)
+        sendChatReadReceipts(account, chatId);
+    else if (account.hasPendingReadReceipts(chatId))
+        account.scheduleReadReceipts(chatId, account.options.readReceiptsDelayMs, sendScheduledReadReceipts);
 }
 
 void showMessageTextIm(TdAccountData &account, const char *purpleUserName, const char *text,
@@ -963,6 +989,56 @@ bool isMessageReady(const IncomingMessage &fullMessage, const TdAccountData &acc
     return true;
 }
 
+static void replySourcesResponse(TdAccountData &account, const std::vector<ReplySourceRequest> &requests,
+                                 td::td_api::object_ptr<td::td_api::Object> object)
+{
+    td::td_api::messages *messages = nullptr;
+    if (object && (object->get_id() == td::td_api::messages::ID))
+        messages = static_cast<td::td_api::messages *>(object.get());
+    else
+        purple_debug_misc(config::pluginId, "Failed to fetch %zu reply sources for chat %" G_GINT64_FORMAT "\n",
+                          requests.size(), requests.front().chatId.value());
+
+    // Messages come in the same order as requested, with null for those not found
+    for (size_t i = 0; i < requests.size(); i++) {
+        IncomingMessage *pendingMessage = account.pendingMessages.findPendingMessage(requests[i].chatId,
+                                                                                     requests[i].pendingMessageId);
+        if (!pendingMessage) continue;
+
+        pendingMessage->repliedMessageFetchDoneOrFailed = true;
+        if (messages && (i < messages->messages_.size()) && messages->messages_[i]) {
+            pendingMessage->repliedMessage = std::move(messages->messages_[i]);
+            account.recentMessages.add(*pendingMessage->repliedMessage);
+        }
+        checkMessageReady(pendingMessage, account.transceiver, account);
+    }
+}
+
+static void fetchReplySources(TdAccountData &account)
+{
+    std::vector<std::pair<ChatId, std::vector<ReplySourceRequest>>> requests;
+    account.extractReplySourceRequests(requests);
+
+    for (auto &chatRequests: requests) {
+        auto getMessagesReq = td::td_api::make_object<td::td_api::getMessages>();
+        getMessagesReq->chat_id_ = chatRequests.first.value();
+        for (const ReplySourceRequest &request: chatRequests.second)
+            getMessagesReq->message_ids_.push_back(request.sourceId.value());
+        purple_debug_misc(config::pluginId, "Fetching %zu reply sources for chat %" G_GINT64_FORMAT "\n",
+                          chatRequests.second.size(), chatRequests.first.value());
+        account.transceiver.sendQueryWithTimeout(std::move(getMessagesReq),
+            [&account, sources = std::move(chatRequests.second)](uint64_t, td::td_api::object_ptr<td::td_api::Object> object) {
+                replySourcesResponse(account, sources, std::move(object));
+            }, 1);
+    }
+}
+
+static gboolean fetchScheduledReplySources(gpointer data)
+{
+    fetchReplySources(*static_cast<TdAccountData *>(data));
+    return G_SOURCE_REMOVE;
+}
+
 void fetchExtras(IncomingMessage &fullMessage, TdTransceiver &transceiver, TdAccountData &account,
                  TdTransceiver::ResponseCb2 onFetchReply)
 {
@@ -973,7 +1049,13 @@ void fetchExtras(IncomingMessage &fullMessage, TdTransceiver &transceiver, TdAcc
     ChatId    chatId         = getChatId(message);
     const td::td_api::chat *chat = account.getChat(chatId);
 
-    if (replyMessageId.valid()) {
+    // Reply source may already be there from recent message cache
+    bool fetchReplySource = replyMessageId.valid() && !fullMessage.repliedMessageFetchDoneOrFailed;
+    if (fetchReplySource && (account.options.replySourceBatchMs != 0)) {
+        // Fetched together with other reply sources from the same chat
+        account.addReplySourceRequest(chatId, replyMessageId, messageId, account.options.replySourceBatchMs,
+                                      fetchScheduledReplySources);
+    } else if (fetchReplySource) {
         purple_debug_misc(config::pluginId, "Fetching message %" G_GINT64_FORMAT " which message %" G_GINT64_FORMAT " replies to\n",
                         replyMessageId.value(), messageId.value());
         auto getMessageReq = td::td_api::make_object<td::td_api::getMessage>();
@@ -1007,6 +1089,19 @@ void fetchExtras(IncomingMessage &fullMessage, TdTransceiver &transceiver, TdAcc
     }
 }
 
+static gboolean releaseOverdueMessages(gpointer data)
+{
+    TdAccountData &account = *static_cast<TdAccountData *>(data);
+    std::vector<IncomingMessage> readyMessages;
+    account.extractOverdueMessages(readyMessages);
+    if (!readyMessages.empty())
+        purple_debug_misc(config::pluginId, "Showing %zu messages ahead of messages not ready yet\n",
+                          readyMessages.size());
+    showMessages(readyMessages, account);
+    account.scheduleOverdueMessages(releaseOverdueMessages);
+    return G_SOURCE_REMOVE;
+}
+
 void checkMessageReady(const IncomingMessage *message, TdTransceiver &transceiver,
                        TdAccountData &account, std::vector<IncomingMessage> *rvReadyMessages)
 {
@@ -1018,6 +1113,8 @@ void checkMessageReady(const IncomingMessage *message, TdTransceiver &transceive
                                                rvReadyMessages ? *rvReadyMessages : readyMessages);
         message = nullptr;
         showMessages(rvReadyMessages ? *rvReadyMessages : readyMessages, account);
+        // Ready but still behind something that isn't
+        account.scheduleOverdueMessages(releaseOverdueMessages);
     }
 }
 
@@ -1028,9 +1125,10 @@ static void findMessageResponse(TdAccountData &account, ChatId chatId, MessageId
     if (!pendingMessage) return;
 
     pendingMessage->repliedMessageFetchDoneOrFailed = true;
-    if (object && (object->get_id() == td::td_api::message::ID))
+    if (object && (object->get_id() == td::td_api::message::ID)) {
         pendingMessage->repliedMessage = td::move_tl_object_as<td::td_api::message>(object);
-    else
+        account.recentMessages.add(*pendingMessage->repliedMessage);
+    } else
         purple_debug_misc(config::pluginId, "Failed to fetch reply source for message %" G_GINT64_FORMAT "\n",
                           pendingMessageId.value());
 
@@ -1047,13 +1145,23 @@ void handleIncomingMessage(TdAccountData &account, const td::td_api::chat &chat,
     if (isReadReceiptsEnabled(account.purpleAccount))
         account.addPendingReadReceipt(chatId, getId(*message));
 
+    account.recentMessages.add(*message);
     IncomingMessage fullMessage;
     makeFullMessage(chat, std::move(message), fullMessage, account);
 
+    MessageId replyMessageId = getReplyMessageId(*fullMessage.message);
+    if (replyMessageId.valid()) {
+        fullMessage.repliedMessage = account.recentMessages.find(chatId, replyMessageId);
+        if (fullMessage.repliedMessage)
+            fullMessage.repliedMessageFetchDoneOrFailed = true;
+    }
+
     if (isMessageReady(fullMessage, account)) {
         IncomingMessage readyMessage = account.pendingMessages.addReadyMessage(std::move(fullMessage), action);
         if (readyMessage.message)
             showMessage(chat, readyMessage, account.transceiver, account);
+        else
+            account.scheduleOverdueMessages(releaseOverdueMessages);
     } else {
         MessageId messageId = getId(*fullMessage.message);
         IncomingMessage &addedMessage = account.pendingMessages.addPendingMessage(std::move(fullMessage), action);
@@ -1065,20 +1173,39 @@ void handleIncomingMessage(TdAccountData &account, const td::td_api::chat &chat,
     }
 }
 
-static void fetchHistoryRequest(TdAccountData &account, ChatId chatId, unsigned messagesFetched,
-                                MessageId fetchBackFrom, MessageId lastReceivedMessage);
+// State of fetching history of one chat, passed from request to response
+struct HistoryFetch {
+    ChatId    chatId;
+    MessageId stopAt;
+    unsigned  messagesFetched;
+    // Only ask for what is in tdlib message database, until it runs out
+    bool      onlyLocal;
+    // Page size for requests to server, doubled after every full page if adaptive
+    unsigned  remotePageSize;
+    bool      adaptive;
+};
+
+static void fetchHistoryRequest(TdAccountData &account, const HistoryFetch &fetch, MessageId fetchBackFrom);
+static void startHistoryFetch(TdAccountData &account, const HistoryFetchQueue::Fetch &queuedFetch);
 
-static void fetchHistoryResponse(TdAccountData &account, ChatId chatId, MessageId stopAt,
-                                 unsigned messagesFetched,
+static void fetchHistoryResponse(TdAccountData &account, HistoryFetch fetch, MessageId fetchBackFrom,
                                  td::td_api::object_ptr<td::td_api::Object> response)
 {
+    ChatId    chatId          = fetch.chatId;
+    MessageId stopAt          = fetch.stopAt;
+    bool      requestMore     = false;
     MessageId requestMoreFrom = MessageId::invalid;
     const td::td_api::chat *chat = account.getChat(chatId);
 
     if (response && (response->get_id() == td::td_api::messages::ID)) {
         td::td_api::messages &messages = static_cast<td::td_api::messages &>(*response);
-        purple_debug_misc(config::pluginId, "Fetched %zu messages for chat %" G_GINT64_FORMAT "\n",
-                          messages.messages_.size(), chatId.value());
+        purple_debug_misc(config::pluginId, "Fetched %zu %smessages for chat %" G_GINT64_FORMAT "\n",
+                          messages.messages_.size(), fetch.onlyLocal ? "local " : "", chatId.value());
+        // History comes newest first, so remember the whole page before handling replies in it
+        for (const auto &message: messages.messages_)
+            if (message)
+                account.recentMessages.add(*message);
+
         auto stop = messages.messages_.begin();
         MessageId lastMessageId = MessageId::invalid;
         for (; stop != messages.messages_.end(); ++stop) {
@@ -1092,20 +1219,35 @@ static void fetchHistoryResponse(TdAccountData &account, ChatId chatId, MessageI
                                   stopAt.value());
                 break;
             }
-            if ((!stopAt.valid() && (messagesFetched == 100)) ||
-                (messagesFetched == HISTORY_MESSAGES_ABSOLUTE_LIMIT))
+            if ((!stopAt.valid() && (fetch.messagesFetched == 100)) ||
+                (fetch.messagesFetched == HISTORY_MESSAGES_ABSOLUTE_LIMIT))
             {
                 purple_debug_misc(config::pluginId, "Reached history limit, stopping\n");
                 break;
             }
-            messagesFetched++;
+            fetch.messagesFetched++;
             lastMessageId = getId(*message);
             if (chat)
                 handleIncomingMessage(account, *chat, std::move(message), PendingMessageQueue::Prepend);
         }
 
-        if (stop == messages.messages_.end())
-            requestMoreFrom = lastMessageId;
+        if (stop == messages.messages_.end()) {
+            if (fetch.onlyLocal) {
+                // Short page means the database has nothing older, rest has to come from server
+                requestMore = true;
+                requestMoreFrom = lastMessageId.valid() ? lastMessageId : fetchBackFrom;
+                if (messages.messages_.size() < HISTORY_PAGE_SIZE_MAX)
+                    fetch.onlyLocal = false;
+            } else if (lastMessageId.valid()) {
+                requestMore = true;
+                requestMoreFrom = lastMessageId;
+                // Gap is bigger than estimated, so ask for more at a time
+                if (fetch.adaptive)
+                    fetch.remotePageSize = std::min<unsigned>(2 * fetch.remotePageSize, HISTORY_PAGE_SIZE_MAX);
+            }
+        }
+        // No point waiting for more replies to batch, the whole page has been seen
+        fetchReplySources(account);
     } else {
         std::string message = formatMessage(_("Failed to fetch earlier messages: {}"),
                                             getDisplayedError(response));
@@ -1114,39 +1256,128 @@ static void fetchHistoryResponse(TdAccountData &account, ChatId chatId, MessageI
             showChatNotification(account, *chat, message.c_str(), PURPLE_MESSAGE_ERROR);
     }
 
-    if (requestMoreFrom.valid())
-        fetchHistoryRequest(account, chatId, messagesFetched, requestMoreFrom, stopAt);
+    if (requestMore)
+        fetchHistoryRequest(account, fetch, requestMoreFrom);
     else {
         purple_debug_misc(config::pluginId, "Done fetching history for chat %" G_GINT64_FORMAT "\n",
                           chatId.value());
         std::vector<IncomingMessage> readyMessages;
         account.pendingMessages.setChatReady(chatId, readyMessages);
         showMessages(readyMessages, account);
+
+        HistoryFetchQueue::Fetch next;
+        bool startNext = account.historyFetches.finish(chatId, next);
+        if (startNext || account.historyFetches.getQueued())
+            purple_debug_info(config::pluginId, "History catch-up: %zu chats being fetched, %zu waiting\n",
+                              account.historyFetches.getRunning(), account.historyFetches.getQueued());
+        if (startNext)
+            startHistoryFetch(account, next);
     }
 }
 
-static void fetchHistoryRequest(TdAccountData &account, ChatId chatId, unsigned messagesFetched,
-                                MessageId fetchBackFrom, MessageId stopAt)
+static void fetchHistoryRequest(TdAccountData &account, const HistoryFetch &fetch, MessageId fetchBackFrom)
 {
     auto request = td::td_api::make_object<td::td_api::getChatHistory>();
-    request->chat_id_ = chatId.value();
+    request->chat_id_ = fetch.chatId.value();
     request->from_message_id_ = fetchBackFrom.valid() ? fetchBackFrom.value() : 0;
-    request->limit_ = 30;
+    request->limit_ = fetch.onlyLocal ? HISTORY_PAGE_SIZE_MAX : fetch.remotePageSize;
     request->offset_ = 0;
-    request->only_local_ = false;
-    purple_debug_misc(config::pluginId, "Requesting history for chat %" G_GINT64_FORMAT
-                      " starting from %" G_GINT64_FORMAT "\n", chatId.value(), fetchBackFrom.value());
+    request->only_local_ = fetch.onlyLocal;
+    purple_debug_misc(config::pluginId, "Requesting %d %smessages of history for chat %" G_GINT64_FORMAT
+                      " starting from %" G_GINT64_FORMAT "\n", request->limit_, fetch.onlyLocal ? "local " : "",
+                      fetch.chatId.value(), fetchBackFrom.value());
     account.transceiver.sendQuery(std::move(request),
-        [&account, chatId, messagesFetched, stopAt](uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> response) {
-            fetchHistoryResponse(account, chatId, stopAt, messagesFetched, std::move(response));
+        [&account, fetch, fetchBackFrom](uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> response) {
+            fetchHistoryResponse(account, fetch, fetchBackFrom, std::move(response));
         });
 }
 
+// Server message ids go up by 1 << 20, sequentially within a supergroup and across private chats
+// and basic groups otherwise, so id difference gives an upper bound on the number of messages
+static unsigned estimateHistoryPageSize(MessageId fetchFrom, MessageId stopAt)
+{
+    if (!fetchFrom.valid() || !stopAt.valid())
+        return HISTORY_PAGE_SIZE_MAX;
+    if (fetchFrom.value() <= stopAt.value())
+        return HISTORY_PAGE_SIZE_MIN;
+
+    // + 2 for the messages at both ends
+    int64_t messages = ((fetchFrom.value() - stopAt.value()) >> 20) + 2;
+    return std::max<int64_t>(HISTORY_PAGE_SIZE_MIN, std::min<int64_t>(messages, HISTORY_PAGE_SIZE_MAX));
+}
+
+static void startHistoryFetch(TdAccountData &account, const HistoryFetchQueue::Fetch &queuedFetch)
+{
+    HistoryFetch fetch;
+    fetch.chatId          = queuedFetch.chatId;
+    fetch.stopAt          = queuedFetch.stopAt;
+    fetch.messagesFetched = 0;
+    fetch.onlyLocal       = account.options.localFirstHistory;
+    fetch.adaptive        = account.options.localFirstHistory;
+    if (fetch.adaptive)
+        fetch.remotePageSize = estimateHistoryPageSize(queuedFetch.fetchFrom, queuedFetch.stopAt);
+    else
+        fetch.remotePageSize = HISTORY_PAGE_SIZE_DEFAULT;
+    fetchHistoryRequest(account, fetch, queuedFetch.fetchFrom);
+}
+
+enum {
+    HISTORY_PRIORITY_CHANNEL           = 0,
+    HISTORY_PRIORITY_GROUP             = 1,
+    HISTORY_PRIORITY_PRIVATE           = 2,
+    HISTORY_PRIORITY_OPEN_CONVERSATION = 3
+};
+
+static unsigned getHistoryFetchPriority(TdAccountData &account, ChatId chatId)
+{
+    const td::td_api::chat *chat = account.getChat(chatId);
+    if (!chat)
+        return HISTORY_PRIORITY_GROUP;
+
+    std::string  buddyName;
+    SecretChatId secretChatId = getSecretChatId(*chat);
+    if (isPrivateChat(*chat)) {
+        const td::td_api::user *user = account.getUser(getUserIdByPrivateChat(*chat));
+        if (user)
+            buddyName = getPurpleBuddyName(*user);
+    } else if (secretChatId.valid())
+        buddyName = getSecretChatBuddyName(secretChatId);
+
+    if (isPrivateChat(*chat) || secretChatId.valid()) {
+        if (!buddyName.empty() && purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, buddyName.c_str(),
+                                                                         account.purpleAccount))
+        {
+            return HISTORY_PRIORITY_OPEN_CONVERSATION;
+        }
+        return HISTORY_PRIORITY_PRIVATE;
+    }
+
+    if (findChatConversation(account.purpleAccount, *chat))
+        return HISTORY_PRIORITY_OPEN_CONVERSATION;
+    if (chat->type_ && (chat->type_->get_id() == td::td_api::chatTypeSupergroup::ID) &&
+        static_cast<const td::td_api::chatTypeSupergroup &>(*chat->type_).is_channel_)
+    {
+        return HISTORY_PRIORITY_CHANNEL;
+    }
+    return HISTORY_PRIORITY_GROUP;
+}
+
 void fetchHistory(TdAccountData &account, ChatId chatId, MessageId fetchFrom, MessageId stopAt)
 {
     if (!account.pendingMessages.isChatReady(chatId))
         return;
 
+    // New messages wait behind history also while the chat is waiting for its turn
     account.pendingMessages.setChatNotReady(chatId);
-    fetchHistoryRequest(account, chatId, 0, fetchFrom, stopAt);
+
+    HistoryFetchQueue::Fetch fetch;
+    fetch.chatId    = chatId;
+    fetch.fetchFrom = fetchFrom;
+    fetch.stopAt    = stopAt;
+    fetch.priority  = getHistoryFetchPriority(account, chatId);
+    if (account.historyFetches.add(fetch))
+        startHistoryFetch(account, fetch);
+    else
+        purple_debug_misc(config::pluginId, "Chat %" G_GINT64_FORMAT " waits for history fetch, %zu waiting\n",
+                          chatId.value(), account.historyFetches.getQueued());
 }
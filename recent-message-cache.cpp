@@ -0,0 +1,166 @@
+#include "recent-message-cache.h"
+
+static td::td_api::object_ptr<td::td_api::formattedText> copyText(const td::td_api::formattedText *text)
+{
+    if (!text)
+        return nullptr;
+    // Entities are not needed for quoting
+    auto result = td::td_api::make_object<td::td_api::formattedText>();
+    result->text_ = text->text_;
+    return result;
+}
+
+// Same content with only the fields used for quoting, or null if the content is not worth caching
+static td::td_api::object_ptr<td::td_api::MessageContent> copyQuotableContent(const td::td_api::MessageContent &content)
+{
+    switch (content.get_id()) {
+        case td::td_api::messageText::ID: {
+            const auto &text = static_cast<const td::td_api::messageText &>(content);
+            auto result = td::td_api::make_object<td::td_api::messageText>();
+            result->text_ = copyText(text.text_.get());
+            return std::move(result);
+        }
+        case td::td_api::messagePhoto::ID: {
+            const auto &photo = static_cast<const td::td_api::messagePhoto &>(content);
+            auto result = td::td_api::make_object<td::td_api::messagePhoto>();
+            result->caption_ = copyText(photo.caption_.get());
+            return std::move(result);
+        }
+        case td::td_api::messageDocument::ID: {
+            const auto &document = static_cast<const td::td_api::messageDocument &>(content);
+            auto result = td::td_api::make_object<td::td_api::messageDocument>();
+            if (document.document_) {
+                result->document_ = td::td_api::make_object<td::td_api::document>();
+                result->document_->file_name_ = document.document_->file_name_;
+                result->document_->mime_type_ = document.document_->mime_type_;
+            }
+            result->caption_ = copyText(document.caption_.get());
+            return std::move(result);
+        }
+        case td::td_api::messageVideo::ID: {
+            const auto &video = static_cast<const td::td_api::messageVideo &>(content);
+            auto result = td::td_api::make_object<td::td_api::messageVideo>();
+            if (video.video_) {
+                result->video_ = td::td_api::make_object<td::td_api::video>();
+                result->video_->file_name_ = video.video_->file_name_;
+            }
+            result->caption_ = copyText(video.caption_.get());
+            return std::move(result);
+        }
+        case td::td_api::messageSticker::ID:
+            return td::td_api::make_object<td::td_api::messageSticker>();
+        case td::td_api::messageAnimatedEmoji::ID: {
+            const auto &animatedEmoji = static_cast<const td::td_api::messageAnimatedEmoji &>(content);
+            auto result = td::td_api::make_object<td::td_api::messageAnimatedEmoji>();
+            result->emoji_ = animatedEmoji.emoji_;
+            return std::move(result);
+        }
+        default:
+            // Quoted using description of the full content, so let it be fetched
+            return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::message> copyQuotableMessage(const td::td_api::message &message)
+{
+    if (!message.content_)
+        return nullptr;
+    auto content = copyQuotableContent(*message.content_);
+    if (!content)
+        return nullptr;
+
+    auto result = td::td_api::make_object<td::td_api::message>();
+    result->id_      = message.id_;
+    result->chat_id_ = message.chat_id_;
+    result->date_    = message.date_;
+    UserId senderId  = getSenderUserId(message);
+    if (senderId.valid())
+        result->sender_ = td::td_api::make_object<td::td_api::messageSenderUser>(senderId.value());
+    result->content_ = std::move(content);
+    return result;
+}
+
+void RecentMessageCache::setLimit(unsigned limit)
+{
+    m_limit = limit;
+    trim();
+}
+
+void RecentMessageCache::trim()
+{
+    while (m_entries.size() > m_limit) {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+}
+
+void RecentMessageCache::add(const td::td_api::message &message)
+{
+    if (m_limit == 0)
+        return;
+
+    Key key = {message.chat_id_, message.id_};
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+
+    td::td_api::object_ptr<td::td_api::message> copy = copyQuotableMessage(message);
+    if (!copy)
+        return;
+    m_entries.push_front(Entry{key, std::move(copy)});
+    m_index[key] = m_entries.begin();
+    trim();
+}
+
+void RecentMessageCache::updateContent(const td::td_api::updateMessageContent &update)
+{
+    auto it = m_index.find(Key{update.chat_id_, update.message_id_});
+    if (it == m_index.end())
+        return;
+
+    td::td_api::object_ptr<td::td_api::MessageContent> content;
+    if (update.new_content_)
+        content = copyQuotableContent(*update.new_content_);
+    if (content)
+        it->second->message->content_ = std::move(content);
+    else {
+        // Not quotable from cache any more, so let it be fetched
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+}
+
+td::td_api::object_ptr<td::td_api::message> RecentMessageCache::find(ChatId chatId, MessageId messageId)
+{
+    if (m_limit == 0)
+        return nullptr;
+
+    auto it = m_index.find(Key{chatId.value(), messageId.value()});
+    if (it == m_index.end()) {
+        m_misses++;
+        return nullptr;
+    }
+
+    m_hits++;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return copyQuotableMessage(*it->second->message);
+}
+
+std::string RecentMessageCache::getStatistics() const
+{
+    uint64_t lookups = m_hits + m_misses;
+    unsigned hitPercent = lookups ? unsigned(m_hits * 100 / lookups) : 0;
+    return "{\"size\":" + std::to_string(m_entries.size()) + ",\"limit\":" + std::to_string(m_limit) +
+           ",\"hits\":" + std::to_string(m_hits) + ",\"misses\":" + std::to_string(m_misses) +
+           ",\"hit_percent\":" + std::to_string(hitPercent) + "}";
+}
+
+void RecentMessageCache::getMemoryUsage(MemoryUsage &usage) const
+{
+    size_t bytes = memory::hashMapBytes(m_index) + m_entries.size() * (sizeof(Entry) + 2 * sizeof(void *));
+    for (const Entry &entry: m_entries)
+        bytes += memory::messageBytes(entry.message.get());
+    usage.add("recent_messages", m_entries.size(), bytes);
+}
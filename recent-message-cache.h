@@ -0,0 +1,63 @@
+#ifndef _RECENT_MESSAGE_CACHE_H
+#define _RECENT_MESSAGE_CACHE_H
+
+#include "identifiers.h"
+#include "memory-usage.h"
+#include <td/telegram/td_api.h>
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Recently seen messages, so that the source of a reply can usually be quoted without a getMessage
+// round trip. Only what quoting needs is kept (sender, text, caption, file name), and only for
+// kinds of content that can be quoted from that. Edited messages are refreshed from
+// updateMessageContent, so that quotes don't show text from before the edit. Least recently used
+// messages are dropped once there are more than the limit; limit of 0 disables the cache.
+class RecentMessageCache {
+public:
+    void     setLimit(unsigned limit);
+    unsigned getLimit() const { return m_limit; }
+
+    void     add(const td::td_api::message &message);
+    // Replaces content of the message if it is cached
+    void     updateContent(const td::td_api::updateMessageContent &update);
+    // Compact copy of the message, or null if it is not cached. Counts as hit or miss.
+    td::td_api::object_ptr<td::td_api::message> find(ChatId chatId, MessageId messageId);
+
+    uint64_t    getHits() const { return m_hits; }
+    uint64_t    getMisses() const { return m_misses; }
+    // Single-line JSON object
+    std::string getStatistics() const;
+    void        getMemoryUsage(MemoryUsage &usage) const;
+private:
+    struct Key {
+        int64_t chatId;
+        int64_t messageId;
+        bool operator==(const Key &other) const
+        {
+            return (chatId == other.chatId) && (messageId == other.messageId);
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        {
+            return std::hash<int64_t>()(key.chatId) ^ (std::hash<int64_t>()(key.messageId) * 31);
+        }
+    };
+    struct Entry {
+        Key                                         key;
+        td::td_api::object_ptr<td::td_api::message> message;
+    };
+
+    unsigned                                                m_limit = 0;
+    // Most recently used first
+    std::list<Entry>                                        m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    uint64_t                                                m_hits = 0;
+    uint64_t                                                m_misses = 0;
+
+    void trim();
+};
+
+#endif
@@ -0,0 +1,1453 @@
+#include "session-recording.h"
+#include "config.h"
+#include <string.h>
+
+// File starts with this, followed by records. Record is kind (1 byte), time since previous record
+// (varint, microseconds), request id (varint), constructor id (zigzag varint), content flag (1 byte)
+// and, if content flag is set, object fields. Nested polymorphic objects start with constructor
+// id, 0 meaning NULL; nullable nested objects of a fixed type start with a presence flag.
+static const char SESSION_MAGIC[8] = {'T', 'D', 'P', 'S', 'E', 'S', 'S', '1'};
+
+namespace {
+
+class Output {
+public:
+    explicit Output(std::string &out) : m_out(out) {}
+
+    void putVarint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            m_out += char(value | 0x80);
+            value >>= 7;
+        }
+        m_out += char(value);
+    }
+    void putInt(int64_t value) { putVarint((uint64_t(value) << 1) ^ uint64_t(value >> 63)); }
+    void putBool(bool value) { m_out += value ? '\1' : '\0'; }
+    void putDouble(double value)
+    {
+        char bytes[sizeof(value)];
+        memcpy(bytes, &value, sizeof(value));
+        m_out.append(bytes, sizeof(bytes));
+    }
+    void putString(const std::string &value)
+    {
+        putVarint(value.size());
+        m_out += value;
+    }
+private:
+    std::string &m_out;
+};
+
+class Input {
+public:
+    Input(const std::string &data, size_t &position) : m_data(data), m_position(position), m_failed(false) {}
+
+    bool     failed() const { return m_failed; }
+    void     fail() { m_failed = true; }
+    bool     atEnd() const { return m_position >= m_data.size(); }
+
+    uint8_t getByte()
+    {
+        if (m_position >= m_data.size()) {
+            m_failed = true;
+            return 0;
+        }
+        return m_data[m_position++];
+    }
+
+    uint64_t getVarint()
+    {
+        uint64_t result = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = getByte();
+            result |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return result;
+        }
+        m_failed = true;
+        return 0;
+    }
+
+    int64_t getInt()
+    {
+        uint64_t value = getVarint();
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    bool getBool() { return getByte() != 0; }
+
+    double getDouble()
+    {
+        double value = 0;
+        if (m_data.size() - m_position < sizeof(value))
+            m_failed = true;
+        else {
+            memcpy(&value, m_data.data() + m_position, sizeof(value));
+            m_position += sizeof(value);
+        }
+        return value;
+    }
+
+    std::string getString()
+    {
+        uint64_t length = getVarint();
+        if (length > m_data.size() - m_position) {
+            m_failed = true;
+            return std::string();
+        }
+        std::string result = m_data.substr(m_position, length);
+        m_position += length;
+        return result;
+    }
+
+    // For preallocating vectors without trusting corrupted length
+    size_t getCount()
+    {
+        uint64_t count = getVarint();
+        if (count > m_data.size() - m_position) {
+            m_failed = true;
+            return 0;
+        }
+        return count;
+    }
+private:
+    const std::string &m_data;
+    size_t            &m_position;
+    bool               m_failed;
+};
+
+}
+
+static bool isRecordedAuthorizationState(const td::td_api::AuthorizationState &state)
+{
+    switch (state.get_id()) {
+    case td::td_api::authorizationStateWaitTdlibParameters::ID:
+    case td::td_api::authorizationStateWaitEncryptionKey::ID:
+    case td::td_api::authorizationStateWaitPhoneNumber::ID:
+    case td::td_api::authorizationStateReady::ID:
+    case td::td_api::authorizationStateLoggingOut::ID:
+    case td::td_api::authorizationStateClosing::ID:
+    case td::td_api::authorizationStateClosed::ID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isRecordedChatAction(const td::td_api::ChatAction &action)
+{
+    switch (action.get_id()) {
+    case td::td_api::chatActionTyping::ID:
+    case td::td_api::chatActionCancel::ID:
+    case td::td_api::chatActionRecordingVideo::ID:
+    case td::td_api::chatActionRecordingVoiceNote::ID:
+    case td::td_api::chatActionChoosingLocation::ID:
+    case td::td_api::chatActionChoosingContact::ID:
+    case td::td_api::chatActionStartPlayingGame::ID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isRecordedWithContent(const td::td_api::Object &object)
+{
+    switch (object.get_id()) {
+    case td::td_api::updateAuthorizationState::ID: {
+        auto &update = static_cast<const td::td_api::updateAuthorizationState &>(object);
+        return update.authorization_state_ && isRecordedAuthorizationState(*update.authorization_state_);
+    }
+    case td::td_api::updateUserChatAction::ID: {
+        auto &update = static_cast<const td::td_api::updateUserChatAction &>(object);
+        return update.action_ && isRecordedChatAction(*update.action_);
+    }
+    case td::td_api::updateConnectionState::ID:
+    case td::td_api::updateUser::ID:
+    case td::td_api::updateUserStatus::ID:
+    case td::td_api::updateNewChat::ID:
+    case td::td_api::updateNewMessage::ID:
+    case td::td_api::updateChatPosition::ID:
+    case td::td_api::updateChatTitle::ID:
+    case td::td_api::updateChatLastMessage::ID:
+    case td::td_api::updateChatReadInbox::ID:
+    case td::td_api::updateChatReadOutbox::ID:
+    case td::td_api::updateOption::ID:
+    case td::td_api::updateBasicGroup::ID:
+    case td::td_api::updateSupergroup::ID:
+    case td::td_api::updateMessageSendSucceeded::ID:
+    case td::td_api::updateMessageSendFailed::ID:
+    case td::td_api::ok::ID:
+    case td::td_api::error::ID:
+    case td::td_api::users::ID:
+    case td::td_api::chats::ID:
+    case td::td_api::user::ID:
+    case td::td_api::chat::ID:
+    case td::td_api::message::ID:
+    case td::td_api::messages::ID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Storing
+
+static void storeUserStatus(Output &out, const td::td_api::UserStatus *status)
+{
+    int32_t id = status ? status->get_id() : 0;
+    switch (id) {
+    case td::td_api::userStatusOnline::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::userStatusOnline &>(*status).expires_);
+        break;
+    case td::td_api::userStatusOffline::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::userStatusOffline &>(*status).was_online_);
+        break;
+    case td::td_api::userStatusEmpty::ID:
+    case td::td_api::userStatusRecently::ID:
+    case td::td_api::userStatusLastWeek::ID:
+    case td::td_api::userStatusLastMonth::ID:
+        out.putInt(id);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeUserType(Output &out, const td::td_api::UserType *type)
+{
+    int32_t id = type ? type->get_id() : 0;
+    switch (id) {
+    case td::td_api::userTypeBot::ID: {
+        auto &bot = static_cast<const td::td_api::userTypeBot &>(*type);
+        out.putInt(id);
+        out.putBool(bot.can_join_groups_);
+        out.putBool(bot.can_read_all_group_messages_);
+        out.putBool(bot.is_inline_);
+        out.putString(bot.inline_query_placeholder_);
+        out.putBool(bot.need_location_);
+        break;
+    }
+    case td::td_api::userTypeRegular::ID:
+    case td::td_api::userTypeDeleted::ID:
+    case td::td_api::userTypeUnknown::ID:
+        out.putInt(id);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeUser(Output &out, const td::td_api::user *user)
+{
+    out.putBool(user != nullptr);
+    if (!user)
+        return;
+    out.putInt(user->id_);
+    out.putString(user->first_name_);
+    out.putString(user->last_name_);
+    out.putString(user->username_);
+    out.putString(user->phone_number_);
+    storeUserStatus(out, user->status_.get());
+    out.putBool(user->is_contact_);
+    out.putBool(user->is_mutual_contact_);
+    out.putBool(user->have_access_);
+    storeUserType(out, user->type_.get());
+    out.putString(user->language_code_);
+}
+
+static void storeChatType(Output &out, const td::td_api::ChatType *type)
+{
+    int32_t id = type ? type->get_id() : 0;
+    switch (id) {
+    case td::td_api::chatTypePrivate::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::chatTypePrivate &>(*type).user_id_);
+        break;
+    case td::td_api::chatTypeBasicGroup::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::chatTypeBasicGroup &>(*type).basic_group_id_);
+        break;
+    case td::td_api::chatTypeSupergroup::ID: {
+        auto &supergroupType = static_cast<const td::td_api::chatTypeSupergroup &>(*type);
+        out.putInt(id);
+        out.putInt(supergroupType.supergroup_id_);
+        out.putBool(supergroupType.is_channel_);
+        break;
+    }
+    case td::td_api::chatTypeSecret::ID: {
+        auto &secretType = static_cast<const td::td_api::chatTypeSecret &>(*type);
+        out.putInt(id);
+        out.putInt(secretType.secret_chat_id_);
+        out.putInt(secretType.user_id_);
+        break;
+    }
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeChatList(Output &out, const td::td_api::ChatList *list)
+{
+    int32_t id = list ? list->get_id() : 0;
+    switch (id) {
+    case td::td_api::chatListFilter::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::chatListFilter &>(*list).chat_filter_id_);
+        break;
+    case td::td_api::chatListMain::ID:
+    case td::td_api::chatListArchive::ID:
+        out.putInt(id);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeChatPosition(Output &out, const td::td_api::chatPosition *position)
+{
+    out.putBool(position != nullptr);
+    if (!position)
+        return;
+    storeChatList(out, position->list_.get());
+    out.putInt(position->order_);
+    out.putBool(position->is_pinned_);
+}
+
+static void storeChatPositions(Output &out, const std::vector<td::td_api::object_ptr<td::td_api::chatPosition>> &positions)
+{
+    out.putVarint(positions.size());
+    for (const auto &position: positions)
+        storeChatPosition(out, position.get());
+}
+
+static void storeTextEntityType(Output &out, const td::td_api::TextEntityType *type)
+{
+    int32_t id = type ? type->get_id() : 0;
+    switch (id) {
+    case td::td_api::textEntityTypePreCode::ID:
+        out.putInt(id);
+        out.putString(static_cast<const td::td_api::textEntityTypePreCode &>(*type).language_);
+        break;
+    case td::td_api::textEntityTypeTextUrl::ID:
+        out.putInt(id);
+        out.putString(static_cast<const td::td_api::textEntityTypeTextUrl &>(*type).url_);
+        break;
+    case td::td_api::textEntityTypeMentionName::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::textEntityTypeMentionName &>(*type).user_id_);
+        break;
+    case td::td_api::textEntityTypeMention::ID:
+    case td::td_api::textEntityTypeHashtag::ID:
+    case td::td_api::textEntityTypeCashtag::ID:
+    case td::td_api::textEntityTypeBotCommand::ID:
+    case td::td_api::textEntityTypeUrl::ID:
+    case td::td_api::textEntityTypeEmailAddress::ID:
+    case td::td_api::textEntityTypePhoneNumber::ID:
+    case td::td_api::textEntityTypeBankCardNumber::ID:
+    case td::td_api::textEntityTypeBold::ID:
+    case td::td_api::textEntityTypeItalic::ID:
+    case td::td_api::textEntityTypeUnderline::ID:
+    case td::td_api::textEntityTypeStrikethrough::ID:
+    case td::td_api::textEntityTypeCode::ID:
+    case td::td_api::textEntityTypePre::ID:
+        out.putInt(id);
+        break;
+    default:
+        // Entity will be dropped
+        out.putInt(0);
+    }
+}
+
+static void storeFormattedText(Output &out, const td::td_api::formattedText *text)
+{
+    out.putBool(text != nullptr);
+    if (!text)
+        return;
+    out.putString(text->text_);
+    out.putVarint(text->entities_.size());
+    for (const auto &entity: text->entities_) {
+        if (entity) {
+            out.putInt(entity->offset_);
+            out.putInt(entity->length_);
+            storeTextEntityType(out, entity->type_.get());
+        } else {
+            out.putInt(0);
+            out.putInt(0);
+            out.putInt(0);
+        }
+    }
+}
+
+static void storeMessageContent(Output &out, const td::td_api::MessageContent *content)
+{
+    if (!content)
+        out.putInt(0);
+    else if (content->get_id() == td::td_api::messageText::ID) {
+        out.putInt(td::td_api::messageText::ID);
+        storeFormattedText(out, static_cast<const td::td_api::messageText &>(*content).text_.get());
+    } else
+        // Replayed as unsupported message, which still goes through the usual message flow
+        out.putInt(td::td_api::messageUnsupported::ID);
+}
+
+static void storeMessageSender(Output &out, const td::td_api::MessageSender *sender)
+{
+    int32_t id = sender ? sender->get_id() : 0;
+    switch (id) {
+    case td::td_api::messageSenderUser::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::messageSenderUser &>(*sender).user_id_);
+        break;
+    case td::td_api::messageSenderChat::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::messageSenderChat &>(*sender).chat_id_);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeMessageSendingState(Output &out, const td::td_api::MessageSendingState *state)
+{
+    int32_t id = state ? state->get_id() : 0;
+    switch (id) {
+    case td::td_api::messageSendingStatePending::ID:
+        out.putInt(id);
+        break;
+    case td::td_api::messageSendingStateFailed::ID: {
+        auto &failed = static_cast<const td::td_api::messageSendingStateFailed &>(*state);
+        out.putInt(id);
+        out.putInt(failed.error_code_);
+        out.putString(failed.error_message_);
+        out.putBool(failed.can_retry_);
+        out.putDouble(failed.retry_after_);
+        break;
+    }
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeMessage(Output &out, const td::td_api::message *message)
+{
+    out.putBool(message != nullptr);
+    if (!message)
+        return;
+    out.putInt(message->id_);
+    storeMessageSender(out, message->sender_.get());
+    out.putInt(message->chat_id_);
+    storeMessageSendingState(out, message->sending_state_.get());
+    out.putBool(message->is_outgoing_);
+    out.putBool(message->is_channel_post_);
+    out.putInt(message->date_);
+    out.putInt(message->edit_date_);
+    out.putInt(message->reply_in_chat_id_);
+    out.putInt(message->reply_to_message_id_);
+    out.putInt(message->media_album_id_);
+    storeMessageContent(out, message->content_.get());
+}
+
+static void storeChat(Output &out, const td::td_api::chat *chat)
+{
+    out.putBool(chat != nullptr);
+    if (!chat)
+        return;
+    out.putInt(chat->id_);
+    storeChatType(out, chat->type_.get());
+    out.putString(chat->title_);
+    storeMessage(out, chat->last_message_.get());
+    storeChatPositions(out, chat->positions_);
+    out.putBool(chat->is_marked_as_unread_);
+    out.putInt(chat->unread_count_);
+    out.putInt(chat->last_read_inbox_message_id_);
+    out.putInt(chat->last_read_outbox_message_id_);
+    out.putInt(chat->unread_mention_count_);
+}
+
+static void storeChatMemberStatus(Output &out, const td::td_api::ChatMemberStatus *status)
+{
+    int32_t id = status ? status->get_id() : 0;
+    switch (id) {
+    case td::td_api::chatMemberStatusCreator::ID: {
+        auto &creator = static_cast<const td::td_api::chatMemberStatusCreator &>(*status);
+        out.putInt(id);
+        out.putString(creator.custom_title_);
+        out.putBool(creator.is_anonymous_);
+        out.putBool(creator.is_member_);
+        break;
+    }
+    case td::td_api::chatMemberStatusBanned::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::chatMemberStatusBanned &>(*status).banned_until_date_);
+        break;
+    case td::td_api::chatMemberStatusMember::ID:
+    case td::td_api::chatMemberStatusLeft::ID:
+        out.putInt(id);
+        break;
+    case td::td_api::chatMemberStatusAdministrator::ID:
+    case td::td_api::chatMemberStatusRestricted::ID:
+        // Rights are not recorded, replayed as ordinary member
+        out.putInt(td::td_api::chatMemberStatusMember::ID);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+static void storeBasicGroup(Output &out, const td::td_api::basicGroup *group)
+{
+    out.putBool(group != nullptr);
+    if (!group)
+        return;
+    out.putInt(group->id_);
+    out.putInt(group->member_count_);
+    storeChatMemberStatus(out, group->status_.get());
+    out.putBool(group->is_active_);
+    out.putInt(group->upgraded_to_supergroup_id_);
+}
+
+static void storeSupergroup(Output &out, const td::td_api::supergroup *group)
+{
+    out.putBool(group != nullptr);
+    if (!group)
+        return;
+    out.putInt(group->id_);
+    out.putString(group->username_);
+    out.putInt(group->date_);
+    storeChatMemberStatus(out, group->status_.get());
+    out.putInt(group->member_count_);
+    out.putBool(group->sign_messages_);
+    out.putBool(group->is_channel_);
+    out.putBool(group->is_verified_);
+}
+
+static void storeOptionValue(Output &out, const td::td_api::OptionValue *value)
+{
+    int32_t id = value ? value->get_id() : 0;
+    switch (id) {
+    case td::td_api::optionValueBoolean::ID:
+        out.putInt(id);
+        out.putBool(static_cast<const td::td_api::optionValueBoolean &>(*value).value_);
+        break;
+    case td::td_api::optionValueInteger::ID:
+        out.putInt(id);
+        out.putInt(static_cast<const td::td_api::optionValueInteger &>(*value).value_);
+        break;
+    case td::td_api::optionValueString::ID:
+        out.putInt(id);
+        out.putString(static_cast<const td::td_api::optionValueString &>(*value).value_);
+        break;
+    case td::td_api::optionValueEmpty::ID:
+        out.putInt(id);
+        break;
+    default:
+        out.putInt(0);
+    }
+}
+
+// Fieldless objects: authorization states (checked by isRecordedAuthorizationState except for
+// authorizationStateWaitEncryptionKey), connection states and chat actions
+static void storeSimpleObject(Output &out, const td::td_api::Object *object)
+{
+    out.putInt(object ? object->get_id() : 0);
+    if (object && (object->get_id() == td::td_api::authorizationStateWaitEncryptionKey::ID))
+        out.putBool(static_cast<const td::td_api::authorizationStateWaitEncryptionKey &>(*object).is_encrypted_);
+}
+
+static void storeObject(Output &out, const td::td_api::Object &object)
+{
+    switch (object.get_id()) {
+    case td::td_api::updateAuthorizationState::ID:
+        storeSimpleObject(out, static_cast<const td::td_api::updateAuthorizationState &>(object).authorization_state_.get());
+        break;
+    case td::td_api::updateConnectionState::ID:
+        storeSimpleObject(out, static_cast<const td::td_api::updateConnectionState &>(object).state_.get());
+        break;
+    case td::td_api::updateUser::ID:
+        storeUser(out, static_cast<const td::td_api::updateUser &>(object).user_.get());
+        break;
+    case td::td_api::updateUserStatus::ID: {
+        auto &update = static_cast<const td::td_api::updateUserStatus &>(object);
+        out.putInt(update.user_id_);
+        storeUserStatus(out, update.status_.get());
+        break;
+    }
+    case td::td_api::updateUserChatAction::ID: {
+        auto &update = static_cast<const td::td_api::updateUserChatAction &>(object);
+        out.putInt(update.chat_id_);
+        out.putInt(update.message_thread_id_);
+        out.putInt(update.user_id_);
+        storeSimpleObject(out, update.action_.get());
+        break;
+    }
+    case td::td_api::updateNewChat::ID:
+        storeChat(out, static_cast<const td::td_api::updateNewChat &>(object).chat_.get());
+        break;
+    case td::td_api::updateNewMessage::ID:
+        storeMessage(out, static_cast<const td::td_api::updateNewMessage &>(object).message_.get());
+        break;
+    case td::td_api::updateChatPosition::ID: {
+        auto &update = static_cast<const td::td_api::updateChatPosition &>(object);
+        out.putInt(update.chat_id_);
+        storeChatPosition(out, update.position_.get());
+        break;
+    }
+    case td::td_api::updateChatTitle::ID: {
+        auto &update = static_cast<const td::td_api::updateChatTitle &>(object);
+        out.putInt(update.chat_id_);
+        out.putString(update.title_);
+        break;
+    }
+    case td::td_api::updateChatLastMessage::ID: {
+        auto &update = static_cast<const td::td_api::updateChatLastMessage &>(object);
+        out.putInt(update.chat_id_);
+        storeMessage(out, update.last_message_.get());
+        storeChatPositions(out, update.positions_);
+        break;
+    }
+    case td::td_api::updateChatReadInbox::ID: {
+        auto &update = static_cast<const td::td_api::updateChatReadInbox &>(object);
+        out.putInt(update.chat_id_);
+        out.putInt(update.last_read_inbox_message_id_);
+        out.putInt(update.unread_count_);
+        break;
+    }
+    case td::td_api::updateChatReadOutbox::ID: {
+        auto &update = static_cast<const td::td_api::updateChatReadOutbox &>(object);
+        out.putInt(update.chat_id_);
+        out.putInt(update.last_read_outbox_message_id_);
+        break;
+    }
+    case td::td_api::updateOption::ID: {
+        auto &update = static_cast<const td::td_api::updateOption &>(object);
+        out.putString(update.name_);
+        storeOptionValue(out, update.value_.get());
+        break;
+    }
+    case td::td_api::updateBasicGroup::ID:
+        storeBasicGroup(out, static_cast<const td::td_api::updateBasicGroup &>(object).basic_group_.get());
+        break;
+    case td::td_api::updateSupergroup::ID:
+        storeSupergroup(out, static_cast<const td::td_api::updateSupergroup &>(object).supergroup_.get());
+        break;
+    case td::td_api::updateMessageSendSucceeded::ID: {
+        auto &update = static_cast<const td::td_api::updateMessageSendSucceeded &>(object);
+        storeMessage(out, update.message_.get());
+        out.putInt(update.old_message_id_);
+        break;
+    }
+    case td::td_api::updateMessageSendFailed::ID: {
+        auto &update = static_cast<const td::td_api::updateMessageSendFailed &>(object);
+        storeMessage(out, update.message_.get());
+        out.putInt(update.old_message_id_);
+        out.putInt(update.error_code_);
+        out.putString(update.error_message_);
+        break;
+    }
+    case td::td_api::ok::ID:
+        break;
+    case td::td_api::error::ID: {
+        auto &error = static_cast<const td::td_api::error &>(object);
+        out.putInt(error.code_);
+        out.putString(error.message_);
+        break;
+    }
+    case td::td_api::users::ID: {
+        auto &users = static_cast<const td::td_api::users &>(object);
+        out.putInt(users.total_count_);
+        out.putVarint(users.user_ids_.size());
+        for (auto userId: users.user_ids_)
+            out.putInt(userId);
+        break;
+    }
+    case td::td_api::chats::ID: {
+        auto &chats = static_cast<const td::td_api::chats &>(object);
+        out.putInt(chats.total_count_);
+        out.putVarint(chats.chat_ids_.size());
+        for (auto chatId: chats.chat_ids_)
+            out.putInt(chatId);
+        break;
+    }
+    case td::td_api::user::ID:
+        storeUser(out, static_cast<const td::td_api::user *>(&object));
+        break;
+    case td::td_api::chat::ID:
+        storeChat(out, static_cast<const td::td_api::chat *>(&object));
+        break;
+    case td::td_api::message::ID:
+        storeMessage(out, static_cast<const td::td_api::message *>(&object));
+        break;
+    case td::td_api::messages::ID: {
+        auto &messages = static_cast<const td::td_api::messages &>(object);
+        out.putInt(messages.total_count_);
+        out.putVarint(messages.messages_.size());
+        for (const auto &message: messages.messages_)
+            storeMessage(out, message.get());
+        break;
+    }
+    }
+}
+
+// Parsing
+
+static td::td_api::object_ptr<td::td_api::UserStatus> parseUserStatus(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::userStatusOnline::ID: {
+        auto status = td::td_api::make_object<td::td_api::userStatusOnline>();
+        status->expires_ = in.getInt();
+        return std::move(status);
+    }
+    case td::td_api::userStatusOffline::ID: {
+        auto status = td::td_api::make_object<td::td_api::userStatusOffline>();
+        status->was_online_ = in.getInt();
+        return std::move(status);
+    }
+    case td::td_api::userStatusEmpty::ID:
+        return td::td_api::make_object<td::td_api::userStatusEmpty>();
+    case td::td_api::userStatusRecently::ID:
+        return td::td_api::make_object<td::td_api::userStatusRecently>();
+    case td::td_api::userStatusLastWeek::ID:
+        return td::td_api::make_object<td::td_api::userStatusLastWeek>();
+    case td::td_api::userStatusLastMonth::ID:
+        return td::td_api::make_object<td::td_api::userStatusLastMonth>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::UserType> parseUserType(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::userTypeBot::ID: {
+        auto bot = td::td_api::make_object<td::td_api::userTypeBot>();
+        bot->can_join_groups_             = in.getBool();
+        bot->can_read_all_group_messages_ = in.getBool();
+        bot->is_inline_                   = in.getBool();
+        bot->inline_query_placeholder_    = in.getString();
+        bot->need_location_               = in.getBool();
+        return std::move(bot);
+    }
+    case td::td_api::userTypeRegular::ID:
+        return td::td_api::make_object<td::td_api::userTypeRegular>();
+    case td::td_api::userTypeDeleted::ID:
+        return td::td_api::make_object<td::td_api::userTypeDeleted>();
+    case td::td_api::userTypeUnknown::ID:
+        return td::td_api::make_object<td::td_api::userTypeUnknown>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::user> parseUser(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto user = td::td_api::make_object<td::td_api::user>();
+    user->id_                = in.getInt();
+    user->first_name_        = in.getString();
+    user->last_name_         = in.getString();
+    user->username_          = in.getString();
+    user->phone_number_      = in.getString();
+    user->status_            = parseUserStatus(in);
+    user->is_contact_        = in.getBool();
+    user->is_mutual_contact_ = in.getBool();
+    user->have_access_       = in.getBool();
+    user->type_              = parseUserType(in);
+    user->language_code_     = in.getString();
+    return user;
+}
+
+static td::td_api::object_ptr<td::td_api::ChatType> parseChatType(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::chatTypePrivate::ID: {
+        auto type = td::td_api::make_object<td::td_api::chatTypePrivate>();
+        type->user_id_ = in.getInt();
+        return std::move(type);
+    }
+    case td::td_api::chatTypeBasicGroup::ID: {
+        auto type = td::td_api::make_object<td::td_api::chatTypeBasicGroup>();
+        type->basic_group_id_ = in.getInt();
+        return std::move(type);
+    }
+    case td::td_api::chatTypeSupergroup::ID: {
+        auto type = td::td_api::make_object<td::td_api::chatTypeSupergroup>();
+        type->supergroup_id_ = in.getInt();
+        type->is_channel_    = in.getBool();
+        return std::move(type);
+    }
+    case td::td_api::chatTypeSecret::ID: {
+        auto type = td::td_api::make_object<td::td_api::chatTypeSecret>();
+        type->secret_chat_id_ = in.getInt();
+        type->user_id_        = in.getInt();
+        return std::move(type);
+    }
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::ChatList> parseChatList(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::chatListFilter::ID: {
+        auto list = td::td_api::make_object<td::td_api::chatListFilter>();
+        list->chat_filter_id_ = in.getInt();
+        return std::move(list);
+    }
+    case td::td_api::chatListMain::ID:
+        return td::td_api::make_object<td::td_api::chatListMain>();
+    case td::td_api::chatListArchive::ID:
+        return td::td_api::make_object<td::td_api::chatListArchive>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::chatPosition> parseChatPosition(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto position = td::td_api::make_object<td::td_api::chatPosition>();
+    position->list_      = parseChatList(in);
+    position->order_     = in.getInt();
+    position->is_pinned_ = in.getBool();
+    return position;
+}
+
+static void parseChatPositions(Input &in, std::vector<td::td_api::object_ptr<td::td_api::chatPosition>> &positions)
+{
+    size_t count = in.getCount();
+    for (size_t i = 0; (i < count) && !in.failed(); i++)
+        positions.push_back(parseChatPosition(in));
+}
+
+static td::td_api::object_ptr<td::td_api::TextEntityType> parseTextEntityType(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::textEntityTypePreCode::ID: {
+        auto type = td::td_api::make_object<td::td_api::textEntityTypePreCode>();
+        type->language_ = in.getString();
+        return std::move(type);
+    }
+    case td::td_api::textEntityTypeTextUrl::ID: {
+        auto type = td::td_api::make_object<td::td_api::textEntityTypeTextUrl>();
+        type->url_ = in.getString();
+        return std::move(type);
+    }
+    case td::td_api::textEntityTypeMentionName::ID: {
+        auto type = td::td_api::make_object<td::td_api::textEntityTypeMentionName>();
+        type->user_id_ = in.getInt();
+        return std::move(type);
+    }
+    case td::td_api::textEntityTypeMention::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeMention>();
+    case td::td_api::textEntityTypeHashtag::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeHashtag>();
+    case td::td_api::textEntityTypeCashtag::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeCashtag>();
+    case td::td_api::textEntityTypeBotCommand::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeBotCommand>();
+    case td::td_api::textEntityTypeUrl::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeUrl>();
+    case td::td_api::textEntityTypeEmailAddress::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeEmailAddress>();
+    case td::td_api::textEntityTypePhoneNumber::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypePhoneNumber>();
+    case td::td_api::textEntityTypeBankCardNumber::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeBankCardNumber>();
+    case td::td_api::textEntityTypeBold::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeBold>();
+    case td::td_api::textEntityTypeItalic::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeItalic>();
+    case td::td_api::textEntityTypeUnderline::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeUnderline>();
+    case td::td_api::textEntityTypeStrikethrough::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeStrikethrough>();
+    case td::td_api::textEntityTypeCode::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypeCode>();
+    case td::td_api::textEntityTypePre::ID:
+        return td::td_api::make_object<td::td_api::textEntityTypePre>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::formattedText> parseFormattedText(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto text = td::td_api::make_object<td::td_api::formattedText>();
+    text->text_ = in.getString();
+    size_t count = in.getCount();
+    for (size_t i = 0; (i < count) && !in.failed(); i++) {
+        auto entity = td::td_api::make_object<td::td_api::textEntity>();
+        entity->offset_ = in.getInt();
+        entity->length_ = in.getInt();
+        entity->type_   = parseTextEntityType(in);
+        if (entity->type_)
+            text->entities_.push_back(std::move(entity));
+    }
+    return text;
+}
+
+static td::td_api::object_ptr<td::td_api::MessageContent> parseMessageContent(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::messageText::ID: {
+        auto content = td::td_api::make_object<td::td_api::messageText>();
+        content->text_ = parseFormattedText(in);
+        return std::move(content);
+    }
+    case td::td_api::messageUnsupported::ID:
+        return td::td_api::make_object<td::td_api::messageUnsupported>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::MessageSender> parseMessageSender(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::messageSenderUser::ID: {
+        auto sender = td::td_api::make_object<td::td_api::messageSenderUser>();
+        sender->user_id_ = in.getInt();
+        return std::move(sender);
+    }
+    case td::td_api::messageSenderChat::ID: {
+        auto sender = td::td_api::make_object<td::td_api::messageSenderChat>();
+        sender->chat_id_ = in.getInt();
+        return std::move(sender);
+    }
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::MessageSendingState> parseMessageSendingState(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::messageSendingStatePending::ID:
+        return td::td_api::make_object<td::td_api::messageSendingStatePending>();
+    case td::td_api::messageSendingStateFailed::ID: {
+        auto failed = td::td_api::make_object<td::td_api::messageSendingStateFailed>();
+        failed->error_code_    = in.getInt();
+        failed->error_message_ = in.getString();
+        failed->can_retry_     = in.getBool();
+        failed->retry_after_   = in.getDouble();
+        return std::move(failed);
+    }
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::message> parseMessage(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto message = td::td_api::make_object<td::td_api::message>();
+    message->id_                  = in.getInt();
+    message->sender_              = parseMessageSender(in);
+    message->chat_id_             = in.getInt();
+    message->sending_state_       = parseMessageSendingState(in);
+    message->is_outgoing_         = in.getBool();
+    message->is_channel_post_     = in.getBool();
+    message->date_                = in.getInt();
+    message->edit_date_           = in.getInt();
+    message->reply_in_chat_id_    = in.getInt();
+    message->reply_to_message_id_ = in.getInt();
+    message->media_album_id_      = in.getInt();
+    message->content_             = parseMessageContent(in);
+    return message;
+}
+
+static td::td_api::object_ptr<td::td_api::chat> parseChat(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto chat = td::td_api::make_object<td::td_api::chat>();
+    chat->id_           = in.getInt();
+    chat->type_         = parseChatType(in);
+    chat->title_        = in.getString();
+    chat->last_message_ = parseMessage(in);
+    parseChatPositions(in, chat->positions_);
+    chat->is_marked_as_unread_         = in.getBool();
+    chat->unread_count_                = in.getInt();
+    chat->last_read_inbox_message_id_  = in.getInt();
+    chat->last_read_outbox_message_id_ = in.getInt();
+    chat->unread_mention_count_        = in.getInt();
+    return chat;
+}
+
+static td::td_api::object_ptr<td::td_api::ChatMemberStatus> parseChatMemberStatus(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::chatMemberStatusCreator::ID: {
+        auto creator = td::td_api::make_object<td::td_api::chatMemberStatusCreator>();
+        creator->custom_title_ = in.getString();
+        creator->is_anonymous_ = in.getBool();
+        creator->is_member_    = in.getBool();
+        return std::move(creator);
+    }
+    case td::td_api::chatMemberStatusBanned::ID: {
+        auto banned = td::td_api::make_object<td::td_api::chatMemberStatusBanned>();
+        banned->banned_until_date_ = in.getInt();
+        return std::move(banned);
+    }
+    case td::td_api::chatMemberStatusMember::ID:
+        return td::td_api::make_object<td::td_api::chatMemberStatusMember>();
+    case td::td_api::chatMemberStatusLeft::ID:
+        return td::td_api::make_object<td::td_api::chatMemberStatusLeft>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::basicGroup> parseBasicGroup(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto group = td::td_api::make_object<td::td_api::basicGroup>();
+    group->id_                         = in.getInt();
+    group->member_count_               = in.getInt();
+    group->status_                     = parseChatMemberStatus(in);
+    group->is_active_                  = in.getBool();
+    group->upgraded_to_supergroup_id_  = in.getInt();
+    return group;
+}
+
+static td::td_api::object_ptr<td::td_api::supergroup> parseSupergroup(Input &in)
+{
+    if (!in.getBool())
+        return nullptr;
+    auto group = td::td_api::make_object<td::td_api::supergroup>();
+    group->id_            = in.getInt();
+    group->username_      = in.getString();
+    group->date_          = in.getInt();
+    group->status_        = parseChatMemberStatus(in);
+    group->member_count_  = in.getInt();
+    group->sign_messages_ = in.getBool();
+    group->is_channel_    = in.getBool();
+    group->is_verified_   = in.getBool();
+    return group;
+}
+
+static td::td_api::object_ptr<td::td_api::OptionValue> parseOptionValue(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::optionValueBoolean::ID: {
+        auto value = td::td_api::make_object<td::td_api::optionValueBoolean>();
+        value->value_ = in.getBool();
+        return std::move(value);
+    }
+    case td::td_api::optionValueInteger::ID: {
+        auto value = td::td_api::make_object<td::td_api::optionValueInteger>();
+        value->value_ = in.getInt();
+        return std::move(value);
+    }
+    case td::td_api::optionValueString::ID: {
+        auto value = td::td_api::make_object<td::td_api::optionValueString>();
+        value->value_ = in.getString();
+        return std::move(value);
+    }
+    case td::td_api::optionValueEmpty::ID:
+        return td::td_api::make_object<td::td_api::optionValueEmpty>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::AuthorizationState> parseAuthorizationState(Input &in)
+{
+    switch (in.getInt()) {
+    case td::td_api::authorizationStateWaitTdlibParameters::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateWaitTdlibParameters>();
+    case td::td_api::authorizationStateWaitEncryptionKey::ID: {
+        auto state = td::td_api::make_object<td::td_api::authorizationStateWaitEncryptionKey>();
+        state->is_encrypted_ = in.getBool();
+        return std::move(state);
+    }
+    case td::td_api::authorizationStateWaitPhoneNumber::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateWaitPhoneNumber>();
+    case td::td_api::authorizationStateReady::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateReady>();
+    case td::td_api::authorizationStateLoggingOut::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateLoggingOut>();
+    case td::td_api::authorizationStateClosing::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateClosing>();
+    case td::td_api::authorizationStateClosed::ID:
+        return td::td_api::make_object<td::td_api::authorizationStateClosed>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::ConnectionState> parseConnectionState(Input &in)
+{
+    switch (in.getInt()) {
+    case 0:
+        return nullptr;
+    case td::td_api::connectionStateWaitingForNetwork::ID:
+        return td::td_api::make_object<td::td_api::connectionStateWaitingForNetwork>();
+    case td::td_api::connectionStateConnectingToProxy::ID:
+        return td::td_api::make_object<td::td_api::connectionStateConnectingToProxy>();
+    case td::td_api::connectionStateConnecting::ID:
+        return td::td_api::make_object<td::td_api::connectionStateConnecting>();
+    case td::td_api::connectionStateUpdating::ID:
+        return td::td_api::make_object<td::td_api::connectionStateUpdating>();
+    case td::td_api::connectionStateReady::ID:
+        return td::td_api::make_object<td::td_api::connectionStateReady>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::ChatAction> parseChatAction(Input &in)
+{
+    switch (in.getInt()) {
+    case td::td_api::chatActionTyping::ID:
+        return td::td_api::make_object<td::td_api::chatActionTyping>();
+    case td::td_api::chatActionCancel::ID:
+        return td::td_api::make_object<td::td_api::chatActionCancel>();
+    case td::td_api::chatActionRecordingVideo::ID:
+        return td::td_api::make_object<td::td_api::chatActionRecordingVideo>();
+    case td::td_api::chatActionRecordingVoiceNote::ID:
+        return td::td_api::make_object<td::td_api::chatActionRecordingVoiceNote>();
+    case td::td_api::chatActionChoosingLocation::ID:
+        return td::td_api::make_object<td::td_api::chatActionChoosingLocation>();
+    case td::td_api::chatActionChoosingContact::ID:
+        return td::td_api::make_object<td::td_api::chatActionChoosingContact>();
+    case td::td_api::chatActionStartPlayingGame::ID:
+        return td::td_api::make_object<td::td_api::chatActionStartPlayingGame>();
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+static td::td_api::object_ptr<td::td_api::Object> parseObject(Input &in, int32_t constructorId)
+{
+    switch (constructorId) {
+    case td::td_api::updateAuthorizationState::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateAuthorizationState>();
+        update->authorization_state_ = parseAuthorizationState(in);
+        return std::move(update);
+    }
+    case td::td_api::updateConnectionState::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateConnectionState>();
+        update->state_ = parseConnectionState(in);
+        return std::move(update);
+    }
+    case td::td_api::updateUser::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateUser>();
+        update->user_ = parseUser(in);
+        return std::move(update);
+    }
+    case td::td_api::updateUserStatus::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateUserStatus>();
+        update->user_id_ = in.getInt();
+        update->status_  = parseUserStatus(in);
+        return std::move(update);
+    }
+    case td::td_api::updateUserChatAction::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateUserChatAction>();
+        update->chat_id_           = in.getInt();
+        update->message_thread_id_ = in.getInt();
+        update->user_id_           = in.getInt();
+        update->action_            = parseChatAction(in);
+        return std::move(update);
+    }
+    case td::td_api::updateNewChat::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateNewChat>();
+        update->chat_ = parseChat(in);
+        return std::move(update);
+    }
+    case td::td_api::updateNewMessage::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateNewMessage>();
+        update->message_ = parseMessage(in);
+        return std::move(update);
+    }
+    case td::td_api::updateChatPosition::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateChatPosition>();
+        update->chat_id_  = in.getInt();
+        update->position_ = parseChatPosition(in);
+        return std::move(update);
+    }
+    case td::td_api::updateChatTitle::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateChatTitle>();
+        update->chat_id_ = in.getInt();
+        update->title_   = in.getString();
+        return std::move(update);
+    }
+    case td::td_api::updateChatLastMessage::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateChatLastMessage>();
+        update->chat_id_      = in.getInt();
+        update->last_message_ = parseMessage(in);
+        parseChatPositions(in, update->positions_);
+        return std::move(update);
+    }
+    case td::td_api::updateChatReadInbox::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateChatReadInbox>();
+        update->chat_id_                    = in.getInt();
+        update->last_read_inbox_message_id_ = in.getInt();
+        update->unread_count_               = in.getInt();
+        return std::move(update);
+    }
+    case td::td_api::updateChatReadOutbox::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateChatReadOutbox>();
+        update->chat_id_                     = in.getInt();
+        update->last_read_outbox_message_id_ = in.getInt();
+        return std::move(update);
+    }
+    case td::td_api::updateOption::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateOption>();
+        update->name_  = in.getString();
+        update->value_ = parseOptionValue(in);
+        return std::move(update);
+    }
+    case td::td_api::updateBasicGroup::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateBasicGroup>();
+        update->basic_group_ = parseBasicGroup(in);
+        return std::move(update);
+    }
+    case td::td_api::updateSupergroup::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateSupergroup>();
+        update->supergroup_ = parseSupergroup(in);
+        return std::move(update);
+    }
+    case td::td_api::updateMessageSendSucceeded::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateMessageSendSucceeded>();
+        update->message_        = parseMessage(in);
+        update->old_message_id_ = in.getInt();
+        return std::move(update);
+    }
+    case td::td_api::updateMessageSendFailed::ID: {
+        auto update = td::td_api::make_object<td::td_api::updateMessageSendFailed>();
+        update->message_        = parseMessage(in);
+        update->old_message_id_ = in.getInt();
+        update->error_code_     = in.getInt();
+        update->error_message_  = in.getString();
+        return std::move(update);
+    }
+    case td::td_api::ok::ID:
+        return td::td_api::make_object<td::td_api::ok>();
+    case td::td_api::error::ID: {
+        auto error = td::td_api::make_object<td::td_api::error>();
+        error->code_    = in.getInt();
+        error->message_ = in.getString();
+        return std::move(error);
+    }
+    case td::td_api::users::ID: {
+        auto users = td::td_api::make_object<td::td_api::users>();
+        users->total_count_ = in.getInt();
+        size_t count = in.getCount();
+        for (size_t i = 0; (i < count) && !in.failed(); i++)
+            users->user_ids_.push_back(in.getInt());
+        return std::move(users);
+    }
+    case td::td_api::chats::ID: {
+        auto chats = td::td_api::make_object<td::td_api::chats>();
+        chats->total_count_ = in.getInt();
+        size_t count = in.getCount();
+        for (size_t i = 0; (i < count) && !in.failed(); i++)
+            chats->chat_ids_.push_back(in.getInt());
+        return std::move(chats);
+    }
+    case td::td_api::user::ID:
+        return parseUser(in);
+    case td::td_api::chat::ID:
+        return parseChat(in);
+    case td::td_api::message::ID:
+        return parseMessage(in);
+    case td::td_api::messages::ID: {
+        auto messages = td::td_api::make_object<td::td_api::messages>();
+        messages->total_count_ = in.getInt();
+        size_t count = in.getCount();
+        for (size_t i = 0; (i < count) && !in.failed(); i++)
+            messages->messages_.push_back(parseMessage(in));
+        return std::move(messages);
+    }
+    default:
+        in.fail();
+        return nullptr;
+    }
+}
+
+SessionRecorder::SessionRecorder()
+:   m_file(nullptr),
+    m_startTime(0),
+    m_lastTime(0)
+{
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    close();
+}
+
+bool SessionRecorder::open(const char *path)
+{
+    close();
+    m_file = fopen(path, "wb");
+    if (!m_file) {
+        purple_debug_warning(config::pluginId, "Failed to open %s for recording session\n", path);
+        return false;
+    }
+
+    purple_debug_info(config::pluginId, "Recording session to %s\n", path);
+    m_startTime = g_get_monotonic_time();
+    m_lastTime  = m_startTime;
+    m_buffer.assign(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+    return true;
+}
+
+void SessionRecorder::close()
+{
+    if (m_file) {
+        flush();
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void SessionRecorder::flush()
+{
+    if (m_file && !m_buffer.empty()) {
+        if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size())
+            purple_debug_warning(config::pluginId, "Failed to write session recording\n");
+        m_buffer.clear();
+    }
+}
+
+void SessionRecorder::writeHeader(SessionRecord::Kind kind, uint64_t requestId)
+{
+    Output out(m_buffer);
+    gint64 now = g_get_monotonic_time();
+    m_buffer += char(kind);
+    out.putVarint(now - m_lastTime);
+    out.putVarint(requestId);
+    m_lastTime = now;
+}
+
+void SessionRecorder::recordRequest(uint64_t requestId, const td::td_api::Function &function)
+{
+    if (!m_file)
+        return;
+
+    Output out(m_buffer);
+    writeHeader(SessionRecord::Kind::Request, requestId);
+    out.putInt(function.get_id());
+    out.putBool(false);
+    if (m_buffer.size() >= FLUSH_THRESHOLD)
+        flush();
+}
+
+void SessionRecorder::recordResponse(uint64_t requestId, const td::td_api::Object &object)
+{
+    if (!m_file)
+        return;
+
+    Output out(m_buffer);
+    bool   withContent = isRecordedWithContent(object);
+    writeHeader(SessionRecord::Kind::Response, requestId);
+    out.putInt(object.get_id());
+    out.putBool(withContent);
+    if (withContent)
+        storeObject(out, object);
+    if (m_buffer.size() >= FLUSH_THRESHOLD)
+        flush();
+}
+
+SessionReader::SessionReader()
+:   m_position(0),
+    m_time(0),
+    m_failed(false)
+{
+}
+
+bool SessionReader::open(const char *path)
+{
+    gchar *contents;
+    gsize  length;
+    m_position = 0;
+    m_time     = 0;
+    m_failed   = false;
+
+    if (!g_file_get_contents(path, &contents, &length, NULL)) {
+        m_failed = true;
+        return false;
+    }
+    m_data.assign(contents, length);
+    g_free(contents);
+
+    if ((m_data.size() < sizeof(SESSION_MAGIC)) || memcmp(m_data.data(), SESSION_MAGIC, sizeof(SESSION_MAGIC))) {
+        m_failed = true;
+        return false;
+    }
+    m_position = sizeof(SESSION_MAGIC);
+    return true;
+}
+
+bool SessionReader::next(SessionRecord &record)
+{
+    if (m_failed || (m_position >= m_data.size()))
+        return false;
+
+    Input   in(m_data, m_position);
+    uint8_t kind = in.getByte();
+    if (kind > uint8_t(SessionRecord::Kind::Response))
+        in.fail();
+    m_time += in.getVarint();
+
+    record.kind          = SessionRecord::Kind(kind);
+    record.time          = m_time;
+    record.requestId     = in.getVarint();
+    record.constructorId = in.getInt();
+    record.object        = nullptr;
+    if (in.getBool())
+        record.object = parseObject(in, record.constructorId);
+
+    if (in.failed()) {
+        m_failed = true;
+        record.object = nullptr;
+        return false;
+    }
+    return true;
+}
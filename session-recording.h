@@ -0,0 +1,72 @@
+#ifndef _SESSION_RECORDING_H
+#define _SESSION_RECORDING_H
+
+#include <td/telegram/td_api.h>
+#include <purple.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Requests, responses and updates passing through TdTransceiver, as stored in a session recording
+struct SessionRecord {
+    enum class Kind: uint8_t {
+        Request  = 0,
+        Response = 1  // response to a request or, if requestId is 0, an update
+    };
+
+    Kind     kind;
+    gint64   time;          // microseconds since the recording was started
+    uint64_t requestId;
+    int32_t  constructorId;
+    // Decoded object, for responses and updates only. NULL for object types which are recorded
+    // by constructor id only (see isRecordedWithContent).
+    td::td_api::object_ptr<td::td_api::Object> object;
+};
+
+// Only the objects which make up the bulk of a login or message flow (users, chats, messages,
+// groups, chat positions, options etc.) are stored with their content, and only the fields the
+// plugin looks at. Everything else, including all requests, is stored as constructor id.
+bool isRecordedWithContent(const td::td_api::Object &object);
+
+// Writes a session recording to a compact binary file
+class SessionRecorder {
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    bool open(const char *path);
+    void recordRequest(uint64_t requestId, const td::td_api::Function &function);
+    void recordResponse(uint64_t requestId, const td::td_api::Object &object);
+    void close();
+private:
+    enum {
+        FLUSH_THRESHOLD = 65536
+    };
+
+    FILE       *m_file;
+    std::string m_buffer;
+    gint64      m_startTime;
+    gint64      m_lastTime;
+
+    void writeHeader(SessionRecord::Kind kind, uint64_t requestId);
+    void flush();
+};
+
+// Reads a session recording created by SessionRecorder
+class SessionReader {
+public:
+    SessionReader();
+    bool open(const char *path);
+    // Returns false at the end of recording or if it is corrupted
+    bool next(SessionRecord &record);
+    bool failed() const { return m_failed; }
+private:
+    std::string m_data;
+    size_t      m_position;
+    gint64      m_time;
+    bool        m_failed;
+};
+
+#endif
@@ -15,7 +15,12 @@
 enum {
     // Typing notifications seems to be resent every 5-6 seconds, so 10s timeout hould be appropriate
     REMOTE_TYPING_NOTICE_TIMEOUT = 10,
+    // Page size for fetching supergroup members
     SUPERGROUP_MEMBER_LIMIT      = 200,
+    // Telegram doesn't give out more recent members than this anyway
+    SUPERGROUP_MEMBER_CACHE_LIMIT = 10000,
+    // How often snapshot for warm start is rewritten while updates are coming
+    SNAPSHOT_INTERVAL_SECONDS    = 300,
 };
 
 PurpleTdClient::PurpleTdClient(PurpleAccount *acct, ITransceiverBackend *testBackend)
@@ -25,10 +30,39 @@ PurpleTdClient::PurpleTdClient(PurpleAccount *acct, ITransceiverBackend *testBac
     StickerConversionThread::setCallback(&PurpleTdClient::onAnimatedStickerConverted);
     m_account = acct;
     setPurpleConnectionInProgress();
+
+    m_warmStart = purple_account_get_bool(m_account, AccountOptions::WarmStart,
+                                          AccountOptions::WarmStartDefault);
+    if (m_warmStart)
+        m_snapshotLoaded = m_data.loadSnapshot(getSnapshotPath());
+
+    g_mkdir_with_parents(getBaseDatabasePath().c_str(), 0700);
+    m_data.lastMessages.open(getLastMessagesPath());
+    m_data.options.readReceiptsDelayMs = getReadReceiptsDelayMs(m_account);
+    m_data.recentMessages.setLimit(getRecentMessagesCacheSize(m_account));
+    m_data.options.replySourceBatchMs = getReplySourceBatchMs(m_account);
+    m_data.options.localFirstHistory = purple_account_get_bool(m_account, AccountOptions::LocalFirstHistory,
+                                                               AccountOptions::LocalFirstHistoryDefault);
+    m_data.historyFetches.setLimit(getHistoryFetchConcurrency(m_account));
+
+    const char *messageOrder = purple_account_get_string(m_account, AccountOptions::MessageOrder,
+                                                         AccountOptions::MessageOrderDefault);
+    PendingMessageQueue::OrderPolicy orderPolicy = PendingMessageQueue::OrderPolicy::Strict;
+    if (!strcmp(messageOrder, AccountOptions::MessageOrderReorderWindow))
+        orderPolicy = PendingMessageQueue::OrderPolicy::ReorderWindow;
+    else if (!strcmp(messageOrder, AccountOptions::MessageOrderPlaceholder))
+        orderPolicy = PendingMessageQueue::OrderPolicy::Placeholder;
+    m_data.pendingMessages.setOrderPolicy(orderPolicy, getReorderWindowMs(m_account));
 }
 
 PurpleTdClient::~PurpleTdClient()
 {
+    // Unless login never got far enough to know anything, which would overwrite good snapshot
+    // with an empty one
+    if (m_warmStart && (m_chatListReady || m_snapshotLoaded))
+        saveSnapshot();
+    m_data.lastMessages.close();
+
     std::vector<PurpleXfer *> transfers;
     m_data.removeAllFileTransfers(transfers);
     for (PurpleXfer *xfer: transfers) {
@@ -68,6 +102,11 @@ void PurpleTdClient::setTdlibFatalErrorCallback(td::Log::FatalErrorCallbackPtr c
 void PurpleTdClient::processUpdate(td::td_api::Object &update)
 {
     purple_debug_misc(config::pluginId, "Incoming update\n");
+    if (m_warmStart && m_chatListReady &&
+        (g_get_monotonic_time() - m_lastSnapshotTime >= SNAPSHOT_INTERVAL_SECONDS * G_USEC_PER_SEC))
+    {
+        saveSnapshot();
+    }
 
     switch (update.get_id()) {
     case td::td_api::updateAuthorizationState::ID: {
@@ -143,6 +182,14 @@ void PurpleTdClient::processUpdate(td::td_api::Object &update)
         break;
     };
 
+    case td::td_api::updateMessageContent::ID: {
+        auto &contentUpdate = static_cast<const td::td_api::updateMessageContent &>(update);
+        purple_debug_misc(config::pluginId, "Incoming update: content of message %" G_GINT64_FORMAT " changed\n",
+                          contentUpdate.message_id_);
+        m_data.recentMessages.updateContent(contentUpdate);
+        break;
+    }
+
     case td::td_api::updateMessageSendSucceeded::ID: {
         auto &sendSucceeded = static_cast<const td::td_api::updateMessageSendSucceeded &>(update);
         purple_debug_misc(config::pluginId, "Incoming update: message %" G_GINT64_FORMAT " send succeeded\n",
@@ -364,6 +411,30 @@ std::string PurpleTdClient::getBaseDatabasePath()
     return std::string(purple_user_dir()) + G_DIR_SEPARATOR_S + config::configSubdir;
 }
 
+std::string PurpleTdClient::getSnapshotPath()
+{
+    return getBaseDatabasePath() + G_DIR_SEPARATOR_S + purple_account_get_username(m_account) + ".snapshot";
+}
+
+std::string PurpleTdClient::getLastMessagesPath()
+{
+    return getBaseDatabasePath() + G_DIR_SEPARATOR_S + purple_account_get_username(m_account) + ".last-messages";
+}
+
+std::string PurpleTdClient::getMemoryUsage() const
+{
+    MemoryUsage usage;
+    m_data.getMemoryUsage(usage);
+    return usage.toJson();
+}
+
+void PurpleTdClient::saveSnapshot()
+{
+    m_lastSnapshotTime = g_get_monotonic_time();
+    g_mkdir_with_parents(getBaseDatabasePath().c_str(), 0700);
+    m_data.saveSnapshot(getSnapshotPath());
+}
+
 static void stuff(td::td_api::tdlibParameters &parameters)
 {
     std::string s(config::stuff);
@@ -634,6 +705,14 @@ void PurpleTdClient::onLoggedIn()
 {
     purple_connection_set_state (purple_account_get_connection(m_account), PURPLE_CONNECTED);
 
+    // Contacts from previous session are shown right away, to be corrected as tdlib sends updates
+    if (m_snapshotLoaded) {
+        std::vector<const td::td_api::chat *> chats;
+        m_data.getChats(chats);
+        showContactStatuses(chats);
+        purple_blist_add_account(m_account);
+    }
+
     // This query ensures an updateUser for every contact
     m_transceiver.sendQuery(td::td_api::make_object<td::td_api::getContacts>(),
                             &PurpleTdClient::getContactsResponse);
@@ -724,7 +803,7 @@ void PurpleTdClient::requestSupergroupFullInfo(SupergroupId groupId)
     }
 }
 
-// TODO process messageChatAddMembers and messageChatDeleteMember
+// TODO process messageChatAddMembers and messageChatDeleteMember for basic groups
 // TODO process messageChatUpgradeTo and messageChatUpgradeFrom
 void PurpleTdClient::groupInfoResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object)
 {
@@ -755,47 +834,139 @@ void PurpleTdClient::supergroupMembersResponse(uint64_t requestId, td::td_api::o
     if (request && object && (object->get_id() == td::td_api::chatMembers::ID)) {
         td::td_api::object_ptr<td::td_api::chatMembers> members =
             td::move_tl_object_as<td::td_api::chatMembers>(object);
+        int32_t received = members->members_.size();
+        m_data.addSupergroupMembers(request->groupId, *members);
 
         auto getMembersReq = td::td_api::make_object<td::td_api::getSupergroupMembers>();
         getMembersReq->supergroup_id_ = request->groupId.value();
         getMembersReq->filter_ = td::td_api::make_object<td::td_api::supergroupMembersFilterAdministrators>();
         getMembersReq->limit_ = SUPERGROUP_MEMBER_LIMIT;
         uint64_t newRequestId = m_transceiver.sendQuery(std::move(getMembersReq), &PurpleTdClient::supergroupAdministratorsResponse);
-        m_data.addPendingRequest<GroupMembersRequestCont>(newRequestId, request->groupId, members.release());
+        m_data.addPendingRequest<SupergroupMembersRequest>(newRequestId, request->groupId, received,
+                                                           members->total_count_);
     }
 }
 
 void PurpleTdClient::supergroupAdministratorsResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object)
 {
-    std::unique_ptr<GroupMembersRequestCont> request = m_data.getPendingRequest<GroupMembersRequestCont>(requestId);
+    std::unique_ptr<SupergroupMembersRequest> request = m_data.getPendingRequest<SupergroupMembersRequest>(requestId);
     if (request) {
-        auto members = std::move(request->members);
-
         if (object && (object->get_id() == td::td_api::chatMembers::ID)) {
-            td::td_api::object_ptr<td::td_api::chatMembers> newMembers =
+            td::td_api::object_ptr<td::td_api::chatMembers> admins =
                 td::move_tl_object_as<td::td_api::chatMembers>(object);
-            for (auto &pNewMember: newMembers->members_) {
-                if (! pNewMember || !pNewMember->member_id_) continue;
-                const td::td_api::MessageSender *pNewMemberInfo = pNewMember->member_id_.get();
-                if (std::find_if(members->members_.begin(), members->members_.end(),
-                              [pNewMemberInfo](const td::td_api::object_ptr<td::td_api::chatMember> &pExistingMember) {
-                                  return pExistingMember && pExistingMember->member_id_ &&
-                                         isSameUser(*pExistingMember->member_id_, *pNewMemberInfo);
-                              }) == members->members_.end())
-                {
-                    members->members_.push_back(std::move(pNewMember));
-                }
-            }
+            m_data.addSupergroupMembers(request->groupId, *admins);
         }
 
-        const td::td_api::chat *chat = m_data.getSupergroupChatByGroup(request->groupId);
-        if (chat) {
+        const td::td_api::chat        *chat    = m_data.getSupergroupChatByGroup(request->groupId);
+        const td::td_api::chatMembers *members = m_data.getSupergroupMembers(request->groupId);
+        if (chat && members) {
             PurpleConvChat *purpleChat = findChatConversation(m_account, *chat);
             if (purpleChat)
                 updateSupergroupChatMembers(purpleChat, *members, m_data);
         }
 
-        m_data.updateSupergroupMembers(request->groupId, std::move(members));
+        requestSupergroupMembersPage(request->groupId, request->offset, request->totalCount);
+    }
+}
+
+void PurpleTdClient::requestSupergroupMembersPage(SupergroupId groupId, int32_t offset, int32_t totalCount)
+{
+    // Rest of the member list is fetched one page at a time after the first page and administrators
+    if ((offset <= 0) || (offset >= totalCount) || (offset >= SUPERGROUP_MEMBER_CACHE_LIMIT))
+        return;
+
+    // Only worth the requests and memory if someone is looking at the member list
+    const td::td_api::chat *chat = m_data.getSupergroupChatByGroup(groupId);
+    if (!chat || !findChatConversation(m_account, *chat)) {
+        purple_debug_misc(config::pluginId, "Not requesting more members of supergroup %" G_GINT64_FORMAT
+                          " until conversation is open\n", groupId.value());
+        m_data.pauseSupergroupMembersPaging(groupId, offset, totalCount);
+        return;
+    }
+
+    purple_debug_misc(config::pluginId, "Requesting members %d-%d of supergroup %" G_GINT64_FORMAT "\n",
+                      offset, std::min<int32_t>(offset + SUPERGROUP_MEMBER_LIMIT, totalCount),
+                      groupId.value());
+    auto getMembersReq = td::td_api::make_object<td::td_api::getSupergroupMembers>();
+    getMembersReq->supergroup_id_ = groupId.value();
+    getMembersReq->filter_ = td::td_api::make_object<td::td_api::supergroupMembersFilterRecent>();
+    getMembersReq->offset_ = offset;
+    getMembersReq->limit_ = SUPERGROUP_MEMBER_LIMIT;
+    uint64_t requestId = m_transceiver.sendQuery(std::move(getMembersReq), &PurpleTdClient::supergroupMembersPageResponse);
+    m_data.addPendingRequest<SupergroupMembersRequest>(requestId, groupId, offset, totalCount);
+}
+
+void PurpleTdClient::resumeSupergroupMembersPaging(SupergroupId groupId)
+{
+    int32_t offset, totalCount;
+    if (m_data.resumeSupergroupMembersPaging(groupId, offset, totalCount))
+        requestSupergroupMembersPage(groupId, offset, totalCount);
+}
+
+void PurpleTdClient::supergroupMembersPageResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object)
+{
+    std::unique_ptr<SupergroupMembersRequest> request = m_data.getPendingRequest<SupergroupMembersRequest>(requestId);
+
+    if (request && object && (object->get_id() == td::td_api::chatMembers::ID)) {
+        td::td_api::object_ptr<td::td_api::chatMembers> members =
+            td::move_tl_object_as<td::td_api::chatMembers>(object);
+        int32_t received = members->members_.size();
+
+        std::vector<const td::td_api::chatMember *> addedMembers;
+        m_data.addSupergroupMembers(request->groupId, *members, &addedMembers);
+
+        const td::td_api::chat *chat = m_data.getSupergroupChatByGroup(request->groupId);
+        if (chat && !addedMembers.empty()) {
+            PurpleConvChat *purpleChat = findChatConversation(m_account, *chat);
+            if (purpleChat)
+                addSupergroupChatMembers(purpleChat, addedMembers, m_data);
+        }
+
+        // Empty page means member count went down since the first page
+        if (received > 0)
+            requestSupergroupMembersPage(request->groupId, request->offset + received,
+                                         std::max(members->total_count_, request->totalCount));
+    }
+}
+
+void PurpleTdClient::updateSupergroupMembership(SupergroupId groupId, const td::td_api::message &message)
+{
+    // Until first page of members is in, there is nothing to update
+    if (!message.content_ || !m_data.getSupergroupMembers(groupId))
+        return;
+
+    const td::td_api::chat *chat       = m_data.getSupergroupChatByGroup(groupId);
+    PurpleConvChat         *purpleChat = chat ? findChatConversation(m_account, *chat) : nullptr;
+    td::td_api::chatMembers newMembers;
+
+    switch (message.content_->get_id()) {
+    case td::td_api::messageChatAddMembers::ID: {
+        const td::td_api::messageChatAddMembers &addMembers = static_cast<const td::td_api::messageChatAddMembers &>(*message.content_);
+        for (unsigned i = 0; i < addMembers.member_user_ids_.size(); i++)
+            newMembers.members_.push_back(td::td_api::make_object<td::td_api::chatMember>(
+                td::td_api::make_object<td::td_api::messageSenderUser>(getUserId(addMembers, i).value()),
+                getSenderUserId(message).value(), message.date_,
+                td::td_api::make_object<td::td_api::chatMemberStatusMember>()));
+        break;
+    }
+    case td::td_api::messageChatJoinByLink::ID:
+        newMembers.members_.push_back(td::td_api::make_object<td::td_api::chatMember>(
+            td::td_api::make_object<td::td_api::messageSenderUser>(getSenderUserId(message).value()),
+            0, message.date_, td::td_api::make_object<td::td_api::chatMemberStatusMember>()));
+        break;
+    case td::td_api::messageChatDeleteMember::ID: {
+        UserId userId = getUserId(static_cast<const td::td_api::messageChatDeleteMember &>(*message.content_));
+        if (m_data.removeSupergroupMember(groupId, userId) && purpleChat)
+            removeSupergroupChatMember(purpleChat, userId, m_data);
+        break;
+    }
+    }
+
+    if (!newMembers.members_.empty()) {
+        std::vector<const td::td_api::chatMember *> addedMembers;
+        m_data.addNewSupergroupMembers(groupId, newMembers, addedMembers);
+        if (purpleChat && !addedMembers.empty())
+            addSupergroupChatMembers(purpleChat, addedMembers, m_data);
     }
 }
 
@@ -825,12 +996,8 @@ void PurpleTdClient::updateSupergroupFull(SupergroupId groupId, td::td_api::obje
     m_data.updateSupergroupInfo(groupId, std::move(groupInfo));
 }
 
-void PurpleTdClient::onChatListReady()
+void PurpleTdClient::showContactStatuses(const std::vector<const td::td_api::chat *> &chats)
 {
-    m_chatListReady = true;
-    std::vector<const td::td_api::chat *> chats;
-    m_data.getChats(chats);
-
     for (const td::td_api::chat *chat: chats) {
         const td::td_api::user *user = m_data.getUserByPrivateChat(*chat);
         if (user && isChatInContactList(*chat, user)) {
@@ -839,6 +1006,21 @@ void PurpleTdClient::onChatListReady()
                                         getPurpleStatusId(*user->status_), NULL);
         }
     }
+}
+
+void PurpleTdClient::onChatListReady()
+{
+    m_chatListReady = true;
+    if (m_warmStart) {
+        m_data.removeUnconfirmedChats();
+        saveSnapshot();
+    }
+
+    std::vector<const td::td_api::chat *> chats;
+    m_data.getChats(chats);
+    showContactStatuses(chats);
+    for (const td::td_api::chat *chat: chats)
+        migrateChatLastMessage(m_data, getId(*chat));
 
     for (PurpleRoomlist *roomlist: m_pendingRoomLists) {
         populateGroupChatList(roomlist, chats, m_data);
@@ -948,6 +1130,10 @@ void PurpleTdClient::onIncomingMessage(td::td_api::object_ptr<td::td_api::messag
         return;
     }
 
+    SupergroupId supergroupId = getSupergroupId(*chat);
+    if (supergroupId.valid())
+        updateSupergroupMembership(supergroupId, *message);
+
     handleIncomingMessage(m_data, *chat, std::move(message), PendingMessageQueue::Append);
 }
 
@@ -53,6 +53,14 @@ public:
     bool terminateCall(PurpleConversation *conv);
 
     void createSecretChat(const char *buddyName);
+    // Called when a supergroup conversation gets opened
+    void resumeSupergroupMembersPaging(SupergroupId groupId);
+
+    std::string getTransceiverStatistics() const { return m_transceiver.getStatistics(); }
+    std::string getMemoryUsage() const;
+    std::string getReplyCacheStatistics() const { return m_data.recentMessages.getStatistics(); }
+    std::string getHistoryFetchStatistics() const { return m_data.historyFetches.getStatistics(); }
+    std::string getMessageQueueStatistics() const { return m_data.pendingMessages.getStatistics(); }
 private:
     using TdObjectPtr   = td::td_api::object_ptr<td::td_api::Object>;
     using ResponseCb    = void (PurpleTdClient::*)(uint64_t requestId, TdObjectPtr object);
@@ -87,8 +95,13 @@ private:
     // List of chats is requested after connection is ready, and when response is received,
     // then we report to libpurple that we are connected
     void       onChatListReady();
+    void       showContactStatuses(const std::vector<const td::td_api::chat *> &chats);
     // Login sequence end
 
+    std::string getSnapshotPath();
+    std::string getLastMessagesPath();
+    void       saveSnapshot();
+
     void       onIncomingMessage(td::td_api::object_ptr<td::td_api::message> message);
     void       updateChatLastMessage(td::td_api::updateChatLastMessage &lastMessage);
 
@@ -107,6 +120,9 @@ private:
     void       supergroupInfoResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object);
     void       supergroupMembersResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object);
     void       supergroupAdministratorsResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object);
+    void       requestSupergroupMembersPage(SupergroupId groupId, int32_t offset, int32_t totalCount);
+    void       supergroupMembersPageResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> object);
+    void       updateSupergroupMembership(SupergroupId groupId, const td::td_api::message &message);
     void       updateGroupFull(BasicGroupId groupId, td::td_api::object_ptr<td::td_api::basicGroupFullInfo> groupInfo);
     void       updateSupergroupFull(SupergroupId groupId, td::td_api::object_ptr<td::td_api::supergroupFullInfo> groupInfo);
 
@@ -144,6 +160,9 @@ private:
     int32_t               m_lastAuthState = 0;
     std::vector<UserId>   m_usersForNewPrivateChats;
     bool                  m_chatListReady = false;
+    bool                  m_warmStart = false;
+    bool                  m_snapshotLoaded = false;
+    gint64                m_lastSnapshotTime = 0;
     bool                  m_isProxyAdded = false;
     std::vector<PurpleRoomlist *>               m_pendingRoomLists;
     td::td_api::object_ptr<td::td_api::proxy>   m_addedProxy;
@@ -1026,6 +1026,104 @@ static void tgprpl_init (PurplePlugin *plugin)
                                               AccountOptions::ReadReceiptsDefault);
         prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
     }
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new (_("Update processing time per main loop iteration, ms (0 for unlimited)"),
+                                            AccountOptions::DispatchTimeBudget,
+                                            AccountOptions::DispatchTimeBudgetDefault);
+    prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new (_("Updates processed per main loop iteration (0 for unlimited)"),
+                                            AccountOptions::DispatchItemBudget,
+                                            AccountOptions::DispatchItemBudgetDefault);
+    prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (boolean)
+    opt = purple_account_option_bool_new(_("Skip outdated status and progress updates under load"),
+                                         AccountOptions::CoalesceUpdates,
+                                         AccountOptions::CoalesceUpdatesDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (boolean)
+    opt = purple_account_option_bool_new(_("Process messages before status and progress updates"),
+                                         AccountOptions::PrioritizeMessages,
+                                         AccountOptions::PrioritizeMessagesDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (boolean)
+    opt = purple_account_option_bool_new(_("Share tdlib receive thread with other accounts"),
+                                         AccountOptions::SharedPollThread,
+                                         AccountOptions::SharedPollThreadDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (text)
+    opt = purple_account_option_string_new(_("Record tdlib session to file (for debugging)"),
+                                           AccountOptions::RecordSessionFile,
+                                           AccountOptions::RecordSessionFileDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Log performance statistics every N seconds (0 = never)"),
+                                           AccountOptions::StatisticsInterval,
+                                           AccountOptions::StatisticsIntervalDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (boolean)
+    opt = purple_account_option_bool_new(_("Show contacts from previous session while connecting"),
+                                         AccountOptions::WarmStart,
+                                         AccountOptions::WarmStartDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Collect read receipts for N ms before sending (0 = send at once)"),
+                                           AccountOptions::ReadReceiptsDelay,
+                                           AccountOptions::ReadReceiptsDelayDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Remember N recent messages for quoting replies (0 = none)"),
+                                           AccountOptions::RecentMessagesCacheSize,
+                                           AccountOptions::RecentMessagesCacheSizeDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Collect replied messages to fetch for N ms (0 = fetch each at once)"),
+                                           AccountOptions::ReplySourceBatch,
+                                           AccountOptions::ReplySourceBatchDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (boolean)
+    opt = purple_account_option_bool_new(_("Fetch missed messages from local database first"),
+                                         AccountOptions::LocalFirstHistory,
+                                         AccountOptions::LocalFirstHistoryDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Fetch missed messages for at most N chats at a time (0 = no limit)"),
+                                           AccountOptions::HistoryFetchConcurrency,
+                                           AccountOptions::HistoryFetchConcurrencyDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    static_assert(AccountOptions::MessageOrderDefault == AccountOptions::MessageOrderStrict,
+                  "default choice must be first");
+    choices = NULL;
+    // TRANSLATOR: Account settings, value for messages waiting behind a file being downloaded
+    addChoice(choices, _("Always in order"), AccountOptions::MessageOrderStrict);
+    // TRANSLATOR: Account settings, value for messages waiting behind a file being downloaded
+    addChoice(choices, _("In order unless held back too long"), AccountOptions::MessageOrderReorderWindow);
+    // TRANSLATOR: Account settings, value for messages waiting behind a file being downloaded
+    addChoice(choices, _("Show files when downloaded"), AccountOptions::MessageOrderPlaceholder);
+
+    // TRANSLATOR: Account settings, key (choice)
+    opt = purple_account_option_list_new(_("Messages after a downloading file"), AccountOptions::MessageOrder, choices);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
+
+    // TRANSLATOR: Account settings, key (number)
+    opt = purple_account_option_string_new(_("Hold messages back for at most N ms (if not always in order)"),
+                                           AccountOptions::ReorderWindow,
+                                           AccountOptions::ReorderWindowDefault);
+    prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, opt);
 }
 
 static void setTwoFactorAuth(RequestData *data, PurpleRequestFields* fields);
@@ -1110,6 +1208,47 @@ static void configureTwoFactorAuth(PurplePluginAction *action)
     requestTwoFactorAuth(gc, _("Enter new password and recovery e-mail address"), NULL);
 }
 
+static void showTransceiverStatistics(PurplePluginAction *action)
+{
+    PurpleConnection *gc       = static_cast<PurpleConnection *>(action->context);
+    PurpleTdClient   *tdClient = static_cast<PurpleTdClient *>(purple_connection_get_protocol_data(gc));
+
+    if (tdClient) {
+        std::string statistics = tdClient->getTransceiverStatistics();
+        purple_debug_info(config::pluginId, "Transceiver statistics: %s\n", statistics.c_str());
+        std::string replyCache = tdClient->getReplyCacheStatistics();
+        purple_debug_info(config::pluginId, "Reply cache statistics: %s\n", replyCache.c_str());
+        statistics += "\n" + replyCache;
+        std::string catchUp = tdClient->getHistoryFetchStatistics();
+        purple_debug_info(config::pluginId, "History fetch statistics: %s\n", catchUp.c_str());
+        statistics += "\n" + catchUp;
+        std::string messageQueue = tdClient->getMessageQueueStatistics();
+        purple_debug_info(config::pluginId, "Message queue statistics: %s\n", messageQueue.c_str());
+        statistics += "\n" + messageQueue;
+        // TRANSLATOR: Performance statistics dialog, title
+        purple_notify_info(gc, _("Performance statistics"),
+                           // TRANSLATOR: Performance statistics dialog, primary content
+                           _("Request latencies, update handling times, queue depth, reply cache hits, history catch-up and message wait times"),
+                           statistics.c_str());
+    }
+}
+
+static void showMemoryUsage(PurplePluginAction *action)
+{
+    PurpleConnection *gc       = static_cast<PurpleConnection *>(action->context);
+    PurpleTdClient   *tdClient = static_cast<PurpleTdClient *>(purple_connection_get_protocol_data(gc));
+
+    if (tdClient) {
+        std::string usage = tdClient->getMemoryUsage();
+        purple_debug_info(config::pluginId, "Memory usage: %s\n", usage.c_str());
+        // TRANSLATOR: Memory usage dialog, title
+        purple_notify_info(gc, _("Memory usage"),
+                           // TRANSLATOR: Memory usage dialog, primary content
+                           _("Approximate memory taken by cached users, chats and messages"),
+                           usage.c_str());
+    }
+}
+
 static GList *tgprpl_actions (PurplePlugin *plugin, gpointer context)
 {
     GList *actionsList = NULL;
@@ -1120,6 +1259,15 @@ static GList *tgprpl_actions (PurplePlugin *plugin, gpointer context)
                                       configureTwoFactorAuth);
     actionsList = g_list_append(actionsList, action);
 
+    // TRANSLATOR: Account action, opens performance statistics dialog
+    action = purple_plugin_action_new(_("Show performance statistics..."),
+                                      showTransceiverStatistics);
+    actionsList = g_list_append(actionsList, action);
+
+    // TRANSLATOR: Account action, opens memory usage dialog
+    action = purple_plugin_action_new(_("Show memory usage..."), showMemoryUsage);
+    actionsList = g_list_append(actionsList, action);
+
     return actionsList;
 }
 
@@ -0,0 +1,104 @@
+#include "bench.h"
+#include "account-data.h"
+#include "test-transceiver.h"
+#include <vector>
+#include <malloc.h>
+
+enum {
+    MEMORY_USERS = 20000,
+    MEMORY_CHATS = 2000
+};
+
+using namespace td::td_api;
+
+static size_t heapInUse()
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    struct mallinfo info = mallinfo();
+    return size_t(unsigned(info.uordblks)) + size_t(unsigned(info.hblkhd));
+#endif
+}
+
+// Remote ids are of about the same length as those tdlib gives out
+static object_ptr<file> makeAvatarFile(int32_t fileId)
+{
+    return make_object<file>(
+        fileId, 10000, 10000,
+        make_object<localFile>("", true, true, false, false, 0, 0, 0),
+        make_object<remoteFile>(std::string(80, 'A') + std::to_string(fileId),
+                                "AQADAgATWX" + std::to_string(fileId), false, true, 10000)
+    );
+}
+
+static object_ptr<minithumbnail> makeMinithumbnail()
+{
+    auto thumbnail = make_object<minithumbnail>();
+    thumbnail->width_  = 40;
+    thumbnail->height_ = 40;
+    thumbnail->data_   = std::string(700, 'x');
+    return thumbnail;
+}
+
+static object_ptr<user> makeFullUser(int32_t userId)
+{
+    std::string number = std::to_string(userId);
+    object_ptr<user> result = makeUser(userId, "User", number, "7" + number,
+                                       make_object<userStatusOffline>());
+    result->username_      = "user_" + number;
+    result->language_code_ = "en";
+    result->profile_photo_ = make_object<profilePhoto>();
+    result->profile_photo_->id_            = userId;
+    result->profile_photo_->small_         = makeAvatarFile(2*userId);
+    result->profile_photo_->big_           = makeAvatarFile(2*userId+1);
+    result->profile_photo_->minithumbnail_ = makeMinithumbnail();
+    return result;
+}
+
+static object_ptr<chat> makeFullChat(int64_t chatId)
+{
+    int32_t userId = chatId;
+    object_ptr<chat> result = makeChat(chatId, make_object<chatTypePrivate>(userId),
+                                       "User " + std::to_string(userId),
+                                       makeMessage(1, userId, chatId, false, 1500000000,
+                                                   makeTextMessage(std::string(100, 'm'))),
+                                       1, 0, 0);
+    result->photo_ = make_object<chatPhotoInfo>();
+    result->photo_->small_         = makeAvatarFile(2*userId);
+    result->photo_->big_           = makeAvatarFile(2*userId+1);
+    result->photo_->minithumbnail_ = makeMinithumbnail();
+    return result;
+}
+
+// Heap taken by users and chats as tdlib sends them, compared with what TdAccountData keeps of
+// them after compactUser and compactChat. Totals for an account are the per-object figures times
+// number of known users and chats.
+BENCH(account_data_memory)
+{
+    std::vector<object_ptr<user>> users;
+    users.reserve(MEMORY_USERS);
+    size_t usersStart = heapInUse();
+    for (unsigned i = 0; i < MEMORY_USERS; i++)
+        users.push_back(makeFullUser(1000 + i));
+    size_t usersFull = heapInUse() - usersStart;
+    for (object_ptr<user> &user: users)
+        compactUser(*user);
+    size_t usersCompact = heapInUse() - usersStart;
+
+    std::vector<object_ptr<chat>> chats;
+    chats.reserve(MEMORY_CHATS);
+    size_t chatsStart = heapInUse();
+    for (unsigned i = 0; i < MEMORY_CHATS; i++)
+        chats.push_back(makeFullChat(1000 + i));
+    size_t chatsFull = heapInUse() - chatsStart;
+    for (object_ptr<chat> &chat: chats)
+        compactChat(*chat);
+    size_t chatsCompact = heapInUse() - chatsStart;
+
+    reportBenchResult("user_bytes_full", double(usersFull) / MEMORY_USERS, "B");
+    reportBenchResult("user_bytes_compact", double(usersCompact) / MEMORY_USERS, "B");
+    reportBenchResult("chat_bytes_full", double(chatsFull) / MEMORY_CHATS, "B");
+    reportBenchResult("chat_bytes_compact", double(chatsCompact) / MEMORY_CHATS, "B");
+}
@@ -0,0 +1,45 @@
+#include "bench.h"
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+struct BenchInfo {
+    const char    *name;
+    BenchFunction  function;
+};
+
+static std::vector<BenchInfo> &benchmarks()
+{
+    static std::vector<BenchInfo> list;
+    return list;
+}
+
+static const char *g_currentBench = "";
+
+BenchRegistration::BenchRegistration(const char *name, BenchFunction function)
+{
+    benchmarks().push_back({name, function});
+}
+
+void reportBenchResult(const char *metric, double value, const char *unit)
+{
+    printf("%s %s %.6g %s\n", g_currentBench, metric, value, unit);
+    fflush(stdout);
+}
+
+// Runs all benchmarks, or only those named on command line
+int main(int argc, char *argv[])
+{
+    for (const BenchInfo &bench: benchmarks()) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++)
+            if (!strcmp(argv[i], bench.name))
+                selected = true;
+        if (selected) {
+            g_currentBench = bench.name;
+            bench.function();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <chrono>
+#include <string>
+
+// Minimal benchmark registry for the "bench" target. Each benchmark prints its results as
+// "<benchmark> <metric> <value> <unit>" lines, one per metric.
+
+using BenchFunction = void (*)();
+
+struct BenchRegistration {
+    BenchRegistration(const char *name, BenchFunction function);
+};
+
+#define BENCH(name) \
+    static void bench_##name(); \
+    static BenchRegistration benchRegistration_##name(#name, bench_##name); \
+    static void bench_##name()
+
+void reportBenchResult(const char *metric, double value, const char *unit);
+
+class Stopwatch {
+public:
+    Stopwatch() : m_start(std::chrono::steady_clock::now()) {}
+    double elapsedSeconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "tdlib-purple.h"
 #include "libpurple-mock.h"
 #include "printout.h"
+#include <stdio.h>
 
 CommTest::CommTest()
 {
@@ -21,6 +22,7 @@ void CommTest::SetUp()
     account->gc = connection;
     prpl.discardEvents();
     setUiName("Pidgin");
+    remove(lastMessagesPath().c_str());
 }
 
 void CommTest::TearDown()
@@ -36,6 +38,13 @@ void CommTest::TearDown()
     purple_account_destroy(account);
     account = NULL;
     clearFakeFiles();
+    remove(lastMessagesPath().c_str());
+}
+
+std::string CommTest::lastMessagesPath()
+{
+    return std::string(purple_user_dir()) + G_DIR_SEPARATOR_S + "tdlib" + G_DIR_SEPARATOR_S +
+           "+" + selfPhoneNumber + ".last-messages";
 }
 
 static bool isFunction(const td::TlObject &object)
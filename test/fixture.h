@@ -43,6 +43,7 @@ protected:
                std::initializer_list<std::unique_ptr<PurpleEvent>> postChatListEvents = {nullptr});
     void loginWithOneContact();
     void runTimeouts() { tgl.runTimeouts(); }
+    std::string lastMessagesPath();
 
     object_ptr<updateUser>     standardUpdateUser(unsigned index);
     object_ptr<updateUser>     standardUpdateUserNoPhone(unsigned index);
@@ -126,6 +126,38 @@ TEST_F(GroupChatTest, BasicGroupReceiveTextAndReply)
     tgl.verifyRequest(viewMessages(groupChatId, {messageId[1]}, true));
 }
 
+TEST_F(GroupChatTest, ReadReceiptsCollectedOverDelay)
+{
+    constexpr int32_t date[]       = {12345, 12346};
+    constexpr int64_t messageId[]  = {10000, 10001};
+    constexpr int     purpleChatId = 1;
+    purple_account_set_string(account, "read-receipts-delay-ms", "500");
+    loginWithBasicGroup();
+
+    tgl.update(standardUpdateUserNoPhone(0));
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(messageId[0], userIds[0], groupChatId, false, date[0], makeTextMessage("Hello"))
+    ));
+    prpl.verifyEvents(
+        ServGotJoinedChatEvent(connection, purpleChatId, groupChatPurpleName, groupChatTitle),
+        ServGotChatEvent(connection, purpleChatId, userFirstNames[0] + " " + userLastNames[0],
+                         "Hello", PURPLE_MESSAGE_RECV, date[0])
+    );
+    tgl.verifyNoRequests();
+
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(messageId[1], userIds[0], groupChatId, false, date[1], makeTextMessage("Again"))
+    ));
+    prpl.verifyEvents(
+        ServGotChatEvent(connection, purpleChatId, userFirstNames[0] + " " + userLastNames[0],
+                         "Again", PURPLE_MESSAGE_RECV, date[1])
+    );
+    tgl.verifyNoRequests();
+
+    runTimeouts();
+    tgl.verifyRequest(viewMessages(groupChatId, {messageId[0], messageId[1]}, true));
+}
+
 TEST_F(GroupChatTest, BasicGroupReceivePhoto)
 {
     const int32_t date         = 12345;
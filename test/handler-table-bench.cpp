@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "transceiver.h"
+#include <map>
+
+using TdObjectPtr = td::td_api::object_ptr<td::td_api::Object>;
+
+enum {
+    OUTSTANDING_QUERIES = 100000,
+    OPERATIONS          = 2000000
+};
+
+// Same shape as typical response handler lambdas: a couple of references and an id or two
+struct Context {
+    uint64_t sum = 0;
+};
+
+template<typename Container, typename Insert, typename Extract>
+static double runSteadyState(Container &handlers, Insert insert, Extract extract)
+{
+    Context  context;
+    int64_t  chatId = 1000;
+    uint64_t nextId = 1;
+
+    for (; nextId <= OUTSTANDING_QUERIES; nextId++)
+        insert(handlers, nextId, [&context, chatId, nextId](uint64_t requestId, TdObjectPtr) {
+            context.sum += requestId + chatId + nextId;
+        });
+
+    // Responses arrive mostly in order: answer the oldest query and send a new one, keeping
+    // the number of outstanding queries constant
+    Stopwatch timer;
+    for (unsigned i = 0; i < OPERATIONS; i++, nextId++) {
+        extract(handlers, nextId - OUTSTANDING_QUERIES);
+        insert(handlers, nextId, [&context, chatId, nextId](uint64_t requestId, TdObjectPtr) {
+            context.sum += requestId + chatId + nextId;
+        });
+    }
+    double seconds = timer.elapsedSeconds();
+
+    if (context.sum == 0)
+        reportBenchResult("checksum_error", 0, "");
+    return seconds * 1e9 / OPERATIONS;
+}
+
+BENCH(handler_table)
+{
+    using StdHandler = std::function<void(uint64_t, TdObjectPtr)>;
+    std::map<uint64_t, StdHandler> map;
+    double mapNs = runSteadyState(map,
+        [](std::map<uint64_t, StdHandler> &handlers, uint64_t id, StdHandler handler) {
+            handlers.emplace(id, std::move(handler));
+        },
+        [](std::map<uint64_t, StdHandler> &handlers, uint64_t id) {
+            auto it = handlers.find(id);
+            if (it != handlers.end()) {
+                StdHandler handler = std::move(it->second);
+                handlers.erase(it);
+                handler(id, nullptr);
+            }
+        });
+    reportBenchResult("std_map_ns_per_query", mapNs, "ns");
+
+    ResponseHandlerTable table;
+    double tableNs = runSteadyState(table,
+        [](ResponseHandlerTable &handlers, uint64_t id, ResponseHandler handler) {
+            handlers.insert(id, std::move(handler));
+        },
+        [](ResponseHandlerTable &handlers, uint64_t id) {
+            ResponseHandler handler;
+            if (handlers.extract(id, handler))
+                handler(id, nullptr);
+        });
+    reportBenchResult("handler_table_ns_per_query", tableNs, "ns");
+    reportBenchResult("speedup", mapNs / tableNs, "x");
+}
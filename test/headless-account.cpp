@@ -0,0 +1,43 @@
+#include "headless-account.h"
+#include "tdlib-purple.h"
+#include "libpurple-mock.h"
+#include "purple-events.h"
+
+HeadlessAccount::HeadlessAccount(ITransceiverBackend &backend, const std::string &username)
+{
+    tgprpl_set_test_backend(&backend);
+    tgprpl_set_single_thread();
+    purple_init_plugin(&m_plugin);
+    m_plugin.info->load(&m_plugin);
+
+    m_account = purple_account_new(username.c_str(), NULL);
+    m_connection = new PurpleConnection;
+    m_connection->state = PURPLE_DISCONNECTED;
+    m_connection->account = m_account;
+    purple_connection_set_protocol_data(m_connection, NULL);
+    m_account->gc = m_connection;
+    setUiName("Pidgin");
+}
+
+HeadlessAccount::~HeadlessAccount()
+{
+    if (purple_connection_get_protocol_data(m_connection))
+        pluginInfo().close(m_connection);
+    g_purpleEvents.discardEvents();
+
+    delete m_connection;
+    m_account->gc = NULL;
+    purple_account_destroy(m_account);
+    clearFakeFiles();
+}
+
+void HeadlessAccount::login()
+{
+    pluginInfo().login(m_account);
+    g_purpleEvents.discardEvents();
+}
+
+PurplePluginProtocolInfo &HeadlessAccount::pluginInfo()
+{
+    return *(PurplePluginProtocolInfo *)m_plugin.info->extra_info;
+}
@@ -0,0 +1,27 @@
+#ifndef _HEADLESS_ACCOUNT_H
+#define _HEADLESS_ACCOUNT_H
+
+#include "transceiver.h"
+#include <purple.h>
+#include <string>
+
+// The plugin with one account on top of libpurple mock, for driving it through an
+// ITransceiverBackend outside of gtest test cases (benchmarks)
+class HeadlessAccount {
+public:
+    HeadlessAccount(ITransceiverBackend &backend, const std::string &username);
+    ~HeadlessAccount();
+    HeadlessAccount(const HeadlessAccount &) = delete;
+    HeadlessAccount &operator=(const HeadlessAccount &) = delete;
+
+    void                      login();
+    PurpleAccount            *account() { return m_account; }
+    PurpleConnection         *connection() { return m_connection; }
+    PurplePluginProtocolInfo &pluginInfo();
+private:
+    PurplePlugin      m_plugin;
+    PurpleAccount    *m_account;
+    PurpleConnection *m_connection;
+};
+
+#endif
@@ -15,6 +15,7 @@ struct AccountInfo {
 
 std::vector<AccountInfo>  g_accounts;
 PurplePlugin             *g_plugin;
+static bool               g_debugOutput = true;
 
 extern "C" {
 
@@ -22,6 +23,7 @@ extern "C" {
 
 void purple_debug_misc(const char *category, const char *format, ...)
 {
+    if (!g_debugOutput) return;
     va_list va;
     va_start(va, format);
     printf("%s: ", category);
@@ -31,6 +33,7 @@ void purple_debug_misc(const char *category, const char *format, ...)
 
 void purple_debug_info(const char *category, const char *format, ...)
 {
+    if (!g_debugOutput) return;
     va_list va;
     va_start(va, format);
     printf("Info: %s: ", category);
@@ -40,6 +43,7 @@ void purple_debug_info(const char *category, const char *format, ...)
 
 void purple_debug_warning(const char *category, const char *format, ...)
 {
+    if (!g_debugOutput) return;
     va_list va;
     va_start(va, format);
     printf("Warning: %s: ", category);
@@ -1150,6 +1154,11 @@ void purple_conv_chat_clear_users(PurpleConvChat *chat)
     EVENT(ChatClearUsersEvent, chat->conv->name);
 }
 
+void purple_conv_chat_remove_user(PurpleConvChat *chat, const char *user, const char *reason)
+{
+    EVENT(ChatRemoveUserEvent, chat->conv->name, user);
+}
+
 PurpleBlistNode *purple_blist_get_root(void)
 {
     return &root;
@@ -1517,6 +1526,11 @@ void setUiName(const char *name)
 
 }
 
+void setDebugOutput(bool enabled)
+{
+    g_debugOutput = enabled;
+}
+
 void *purple_conversations_get_handle()
 {
     return NULL;
@@ -13,6 +13,8 @@ void clearFakeFiles();
 int  getLastImgstoreId();
 guint8 *arrayDup(gpointer data, size_t size);
 void setUiName(const char *name);
+// Debug log goes to stdout unless disabled (benchmarks)
+void setDebugOutput(bool enabled);
 
 };
 
@@ -0,0 +1,62 @@
+#include "bench.h"
+#include "load-generator.h"
+#include "headless-account.h"
+#include "libpurple-mock.h"
+#include "purple-events.h"
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Synthetic load: users, groups and incoming message mix as given by TDLIB_PURPLE_LOAD environment
+// variable (see LoadProfile::parse), or defaults
+BENCH(load)
+{
+    LoadProfile profile;
+    const char *spec = getenv("TDLIB_PURPLE_LOAD");
+    if (spec && !profile.parse(spec)) {
+        printf("load: invalid TDLIB_PURPLE_LOAD: %s\n", spec);
+        return;
+    }
+
+    setDebugOutput(false);
+    g_purpleEvents.setQuiet(true);
+
+    LoadGenerator generator(profile);
+    g_purpleEvents.setObserver([&generator](const PurpleEvent &event) {
+        if (event.type == PurpleEventType::ServGotIm)
+            generator.messageShown(static_cast<const ServGotImEvent &>(event).mtime);
+        else if (event.type == PurpleEventType::ServGotChat)
+            generator.messageShown(static_cast<const ServGotChatEvent &>(event).mtime);
+    });
+
+    {
+        HeadlessAccount account(generator, "+1234567");
+        Stopwatch loginTimer;
+        account.login();
+        generator.login();
+        g_purpleEvents.discardEvents();
+        reportBenchResult("login_seconds", loginTimer.elapsedSeconds(), "s");
+
+        Stopwatch timer;
+        while (generator.sendNextMessage())
+            g_purpleEvents.discardEvents();
+        double seconds = timer.elapsedSeconds();
+
+        reportBenchResult("messages", generator.messagesSent, "");
+        reportBenchResult("shown", generator.messagesShown, "");
+        reportBenchResult("throughput", generator.messagesSent / seconds, "msgs/s");
+        reportBenchResult("latency_p50", generator.latencyPercentile(50), "us");
+        reportBenchResult("latency_p99", generator.latencyPercentile(99), "us");
+        reportBenchResult("requests_answered", generator.requestsAnswered, "");
+        reportBenchResult("requests_failed", generator.requestsFailed, "");
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        // Kilobytes on Linux
+        reportBenchResult("peak_rss", usage.ru_maxrss / 1024.0, "MB");
+
+    g_purpleEvents.setObserver(nullptr);
+    g_purpleEvents.setQuiet(false);
+    setDebugOutput(true);
+}
@@ -0,0 +1,323 @@
+#include "load-generator.h"
+#include "test-transceiver.h"
+#include <algorithm>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace td::td_api;
+
+enum {
+    // Message dates are BASE_DATE plus message number, so that displayed messages can be matched
+    // with sent ones by timestamp
+    BASE_DATE       = 1500000000,
+    SELF_USER_ID    = 1,
+    FIRST_USER_ID   = 1000000,
+    FILE_SIZE       = 10000,
+};
+
+static const int64_t FIRST_SUPERGROUP_CHAT_ID = -1000000000000;
+
+enum class MessageKind {
+    Text,
+    Photo,
+    Sticker,
+    Reply
+};
+
+static bool parseNumber(const char *value, unsigned &result)
+{
+    char *end;
+    unsigned long number = strtoul(value, &end, 10);
+    if ((end == value) || *end)
+        return false;
+    result = number;
+    return true;
+}
+
+bool LoadProfile::parse(const char *spec)
+{
+    gchar **items = g_strsplit(spec, ",", 0);
+    bool    ok    = true;
+
+    for (gchar **item = items; *item && ok; item++) {
+        const char *separator = strchr(*item, '=');
+        if (!separator) {
+            ok = false;
+            break;
+        }
+        std::string key(*item, separator - *item);
+        const char *value = separator + 1;
+
+        if (key == "users")
+            ok = parseNumber(value, users);
+        else if (key == "basic-groups")
+            ok = parseNumber(value, basicGroups);
+        else if (key == "supergroups")
+            ok = parseNumber(value, supergroups);
+        else if (key == "messages")
+            ok = parseNumber(value, messages);
+        else if (key == "rate") {
+            unsigned number;
+            ok = parseNumber(value, number);
+            rate = number;
+        } else if (key == "text")
+            ok = parseNumber(value, textWeight);
+        else if (key == "photo")
+            ok = parseNumber(value, photoWeight);
+        else if (key == "sticker")
+            ok = parseNumber(value, stickerWeight);
+        else if (key == "reply")
+            ok = parseNumber(value, replyWeight);
+        else
+            ok = false;
+    }
+
+    g_strfreev(items);
+    return ok && (users > 0) && (textWeight + photoWeight + stickerWeight + replyWeight > 0);
+}
+
+LoadGenerator::LoadGenerator(const LoadProfile &profile)
+: m_profile(profile),
+  m_random(1) // Same sequence of messages on every run
+{
+    for (unsigned i = 0; i < m_profile.users; i++) {
+        int32_t userId = FIRST_USER_ID + i;
+        m_userIds.push_back(userId);
+        // Private chat id is the same as user id
+        m_chats.push_back({userId, userId, 0});
+    }
+    for (unsigned i = 1; i <= m_profile.basicGroups; i++)
+        m_chats.push_back({-int64_t(i), 0, 0});
+    for (unsigned i = 1; i <= m_profile.supergroups; i++)
+        m_chats.push_back({FIRST_SUPERGROUP_CHAT_ID - i, 0, 0});
+
+    m_scheduledTime.resize(m_profile.messages);
+    m_shown.resize(m_profile.messages, false);
+    m_latencies.reserve(m_profile.messages);
+}
+
+void LoadGenerator::send(td::Client::Request &&request)
+{
+    m_requests.push_back(std::move(request));
+}
+
+guint LoadGenerator::addTimeout(guint interval, GSourceFunc function, gpointer data)
+{
+    // Nothing the plugin does on timeout matters for throughput
+    return m_nextTimerId++;
+}
+
+void LoadGenerator::cancelTimer(guint id)
+{
+}
+
+void LoadGenerator::deliver(object_ptr<Object> update)
+{
+    receive({0, std::move(update)});
+    answerRequests();
+}
+
+void LoadGenerator::answerRequests()
+{
+    // Answering a request may well cause the plugin to send another one
+    while (!m_requests.empty()) {
+        td::Client::Request request = std::move(m_requests.front());
+        m_requests.pop_front();
+
+        object_ptr<Object> response = answer(*request.function);
+        if (response) {
+            if (response->get_id() == error::ID)
+                requestsFailed++;
+            else
+                requestsAnswered++;
+            receive({request.id, std::move(response)});
+        } else if (request.function->get_id() == getContacts::ID)
+            m_contactsRequestId = request.id;
+    }
+}
+
+object_ptr<Object> LoadGenerator::answer(const Function &function)
+{
+    switch (function.get_id()) {
+    case disableProxy::ID:
+    case setTdlibParameters::ID:
+    case checkDatabaseEncryptionKey::ID:
+    case viewMessages::ID:
+        return make_object<ok>();
+    case getProxies::ID:
+        return make_object<proxies>();
+    case getContacts::ID:
+        // Answered in login, after users are known
+        return nullptr;
+    case loadChats::ID:
+        return getChatsNoChatsResponse();
+    case getMessage::ID: {
+        // Reply source
+        const getMessage &request = static_cast<const getMessage &>(function);
+        int32_t senderId = (request.chat_id_ > 0) ? int32_t(request.chat_id_) : m_userIds.front();
+        return td::td_api::makeMessage(request.message_id_, senderId, request.chat_id_, false,
+                                       BASE_DATE - 1, makeTextMessage("reply source"));
+    }
+    case downloadFile::ID: {
+        const downloadFile &request = static_cast<const downloadFile &>(function);
+        return make_object<file>(
+            request.file_id_, FILE_SIZE, FILE_SIZE,
+            make_object<localFile>("/load-generator", true, true, false, true, 0, FILE_SIZE, FILE_SIZE),
+            make_object<remoteFile>("beh", "bleh", false, true, FILE_SIZE)
+        );
+    }
+    default:
+        return make_object<error>(400, "Not supported by load generator");
+    }
+}
+
+void LoadGenerator::login()
+{
+    deliver(make_object<updateAuthorizationState>(make_object<authorizationStateWaitTdlibParameters>()));
+    deliver(make_object<updateAuthorizationState>(make_object<authorizationStateWaitEncryptionKey>(true)));
+    deliver(make_object<updateAuthorizationState>(make_object<authorizationStateReady>()));
+    deliver(make_object<updateConnectionState>(make_object<connectionStateUpdating>()));
+
+    deliver(make_object<updateUser>(makeUser(SELF_USER_ID, "Load", "Generator", "1234567",
+                                             make_object<userStatusOffline>())));
+    for (int32_t userId: m_userIds) {
+        std::string number = std::to_string(userId);
+        deliver(make_object<updateUser>(makeUser(userId, "User", number, number,
+                                                 make_object<userStatusOffline>())));
+    }
+
+    for (const ChatInfo &chat: m_chats) {
+        object_ptr<ChatType> type;
+        std::string          title;
+        if (chat.userId) {
+            type  = make_object<chatTypePrivate>(chat.userId);
+            title = "User " + std::to_string(chat.userId);
+        } else if (chat.chatId > FIRST_SUPERGROUP_CHAT_ID) {
+            int32_t groupId = -chat.chatId;
+            deliver(make_object<updateBasicGroup>(make_object<basicGroup>(
+                groupId, m_profile.users, make_object<chatMemberStatusMember>(), true, 0
+            )));
+            type  = make_object<chatTypeBasicGroup>(groupId);
+            title = "Group " + std::to_string(groupId);
+        } else {
+            int32_t groupId = FIRST_SUPERGROUP_CHAT_ID - chat.chatId;
+            deliver(make_object<updateSupergroup>(make_object<supergroup>(
+                groupId, "", 0, make_object<chatMemberStatusMember>(), m_profile.users,
+                false, false, false, false, false, false, "", false
+            )));
+            type  = make_object<chatTypeSupergroup>(groupId, false);
+            title = "Supergroup " + std::to_string(groupId);
+        }
+        deliver(make_object<updateNewChat>(makeChat(chat.chatId, std::move(type), title, nullptr, 0, 0, 0)));
+        deliver(makeUpdateChatListMain(chat.chatId));
+    }
+
+    deliver(make_object<updateConnectionState>(make_object<connectionStateReady>()));
+    if (m_contactsRequestId) {
+        receive({m_contactsRequestId, make_object<users>(m_userIds.size(), m_userIds)});
+        m_contactsRequestId = 0;
+        answerRequests();
+    }
+}
+
+object_ptr<message> LoadGenerator::makeIncomingMessage(ChatInfo &chat, int32_t date)
+{
+    unsigned weights[] = {m_profile.textWeight, m_profile.photoWeight, m_profile.stickerWeight,
+                          m_profile.replyWeight};
+    unsigned pick = std::uniform_int_distribution<unsigned>(
+        0, weights[0] + weights[1] + weights[2] + weights[3] - 1)(m_random);
+    unsigned kind = 0;
+    while (pick >= weights[kind])
+        pick -= weights[kind++];
+
+    int32_t senderId = chat.userId;
+    if (!senderId)
+        senderId = m_userIds[std::uniform_int_distribution<size_t>(0, m_userIds.size() - 1)(m_random)];
+
+    object_ptr<MessageContent> content;
+    int64_t replyToMessageId = 0;
+    switch (MessageKind(kind)) {
+    case MessageKind::Photo:
+        content = make_object<messagePhoto>(
+            makePhotoRemote(m_nextFileId++, FILE_SIZE, 640, 480),
+            make_object<formattedText>("", std::vector<object_ptr<textEntity>>()),
+            false
+        );
+        break;
+    case MessageKind::Sticker:
+        content = make_object<messageSticker>(make_object<sticker>(
+            0, 320, 200, "", false, false, nullptr,
+            nullptr,
+            make_object<file>(
+                m_nextFileId++, FILE_SIZE, FILE_SIZE,
+                make_object<localFile>("", true, true, false, false, 0, 0, 0),
+                make_object<remoteFile>("beh", "bleh", false, true, FILE_SIZE)
+            )
+        ));
+        break;
+    case MessageKind::Reply:
+        replyToMessageId = chat.lastMessageId;
+        content = makeTextMessage("reply");
+        break;
+    case MessageKind::Text:
+        content = makeTextMessage("message");
+        break;
+    }
+
+    object_ptr<message> message = td::td_api::makeMessage(++chat.lastMessageId, senderId, chat.chatId,
+                                                          false, date, std::move(content));
+    message->reply_to_message_id_ = replyToMessageId;
+    return message;
+}
+
+bool LoadGenerator::sendNextMessage()
+{
+    if (messagesSent >= m_profile.messages)
+        return false;
+
+    unsigned          number = messagesSent++;
+    Clock::time_point now    = Clock::now();
+    if (number == 0)
+        m_startTime = now;
+
+    // Latency is measured from scheduled time rather than actual send time, so that falling
+    // behind schedule counts towards it
+    if (m_profile.rate > 0) {
+        m_scheduledTime[number] = m_startTime + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(number / m_profile.rate));
+        if (now < m_scheduledTime[number])
+            std::this_thread::sleep_until(m_scheduledTime[number]);
+    } else
+        m_scheduledTime[number] = now;
+
+    ChatInfo &chat = m_chats[std::uniform_int_distribution<size_t>(0, m_chats.size() - 1)(m_random)];
+    deliver(make_object<updateNewMessage>(makeIncomingMessage(chat, BASE_DATE + number)));
+    return true;
+}
+
+void LoadGenerator::messageShown(time_t date)
+{
+    if ((date < BASE_DATE) || (date - BASE_DATE >= messagesSent))
+        return;
+
+    unsigned number = date - BASE_DATE;
+    if (m_shown[number])
+        return;
+    m_shown[number] = true;
+    messagesShown++;
+    m_latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - m_scheduledTime[number]).count());
+    m_latenciesSorted = false;
+}
+
+double LoadGenerator::latencyPercentile(double percentile)
+{
+    if (m_latencies.empty())
+        return 0;
+    if (!m_latenciesSorted) {
+        std::sort(m_latencies.begin(), m_latencies.end());
+        m_latenciesSorted = true;
+    }
+    size_t index = percentile / 100 * (m_latencies.size() - 1) + 0.5;
+    return m_latencies[std::min(index, m_latencies.size() - 1)];
+}
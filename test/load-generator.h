@@ -0,0 +1,85 @@
+#ifndef _LOAD_GENERATOR_H
+#define _LOAD_GENERATOR_H
+
+#include "transceiver.h"
+#include <chrono>
+#include <deque>
+#include <random>
+#include <vector>
+
+struct LoadProfile {
+    unsigned users        = 200;
+    unsigned basicGroups  = 20;
+    unsigned supergroups  = 20;
+    unsigned messages     = 20000;
+    // Incoming messages per second, 0 means as fast as the plugin takes them
+    double   rate         = 0;
+    // Relative weights of message kinds
+    unsigned textWeight    = 70;
+    unsigned photoWeight   = 10;
+    unsigned stickerWeight = 10;
+    unsigned replyWeight   = 10;
+
+    // Overrides defaults from comma-separated key=value list, e.g. "users=1000,rate=500"
+    bool parse(const char *spec);
+};
+
+// Synthetic tdlib: logs in, announces users, basic groups and supergroups as configured by
+// LoadProfile, then produces incoming messages across all chats at given rate. Requests the
+// plugin sends in reaction (viewMessages, getMessage for reply sources, downloadFile for photos
+// and stickers etc.) are answered right after each delivered update, the rest get an error.
+class LoadGenerator: public ITransceiverBackend {
+public:
+    explicit LoadGenerator(const LoadProfile &profile);
+
+    void  send(td::Client::Request &&request) override;
+    guint addTimeout(guint interval, GSourceFunc function, gpointer data) override;
+    void  cancelTimer(guint id) override;
+
+    // To be called after HeadlessAccount::login
+    void  login();
+    // Delivers next message, waiting for its scheduled time if rate is limited. Returns false
+    // when all messages have been sent.
+    bool  sendNextMessage();
+    // To be called when the plugin shows a message (serv_got_im or serv_got_chat_in) with
+    // given timestamp
+    void  messageShown(time_t date);
+    // Latency between scheduled delivery of message update and its display, microseconds
+    double latencyPercentile(double percentile);
+
+    unsigned messagesSent     = 0;
+    unsigned messagesShown    = 0;
+    unsigned requestsAnswered = 0;
+    // Requests the generator doesn't know how to answer
+    unsigned requestsFailed   = 0;
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct ChatInfo {
+        int64_t chatId;
+        int32_t userId;        // for private chats, 0 for groups
+        int64_t lastMessageId;
+    };
+
+    LoadProfile                       m_profile;
+    std::vector<int32_t>              m_userIds;
+    std::vector<ChatInfo>             m_chats;
+    std::deque<td::Client::Request>   m_requests;
+    uint64_t                          m_contactsRequestId = 0;
+    std::mt19937                      m_random;
+    int32_t                           m_nextFileId = 1;
+    guint                             m_nextTimerId = 1;
+    Clock::time_point                 m_startTime;
+    // Indexed by message number, which is also message date relative to BASE_DATE
+    std::vector<Clock::time_point>    m_scheduledTime;
+    std::vector<bool>                 m_shown;
+    std::vector<double>               m_latencies;
+    bool                              m_latenciesSorted = false;
+
+    void deliver(td::td_api::object_ptr<td::td_api::Object> update);
+    void answerRequests();
+    td::td_api::object_ptr<td::td_api::Object> answer(const td::td_api::Function &function);
+    td::td_api::object_ptr<td::td_api::message> makeIncomingMessage(ChatInfo &chat, int32_t date);
+};
+
+#endif
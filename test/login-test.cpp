@@ -1,4 +1,5 @@
 #include "fixture.h"
+#include <stdio.h>
 
 class LoginTest: public CommTest {};
 
@@ -708,3 +709,89 @@ TEST_F(LoginTest, IncomingGroupChatMessageAtLoginWhileChatListStillNull)
         }
     );
 }
+
+class WarmStartTest: public CommTest {
+protected:
+    std::string snapshotPath()
+    {
+        return std::string(purple_user_dir()) + G_DIR_SEPARATOR_S + "tdlib" + G_DIR_SEPARATOR_S +
+               "+" + selfPhoneNumber + ".snapshot";
+    }
+
+    void SetUp() override
+    {
+        CommTest::SetUp();
+        remove(snapshotPath().c_str());
+        purple_account_set_bool(account, "warm-start", TRUE);
+    }
+
+    void TearDown() override
+    {
+        CommTest::TearDown();
+        remove(snapshotPath().c_str());
+    }
+};
+
+TEST_F(WarmStartTest, ContactKnownBeforeTdlibCatchesUp)
+{
+    loginWithOneContact();
+    pluginInfo().close(connection);
+    connection->state = PURPLE_DISCONNECTED;
+
+    pluginInfo().login(account);
+    prpl.verifyEvents(
+        ConnectionSetStateEvent(connection, PURPLE_CONNECTING),
+        ConnectionUpdateProgressEvent(connection, 1, 2)
+    );
+
+    tgl.update(make_object<updateAuthorizationState>(make_object<authorizationStateWaitTdlibParameters>()));
+    tgl.verifyRequests({
+        make_object<disableProxy>(),
+        make_object<getProxies>(),
+        make_object<setTdlibParameters>(make_object<tdlibParameters>(
+            false,
+            std::string(purple_user_dir()) + G_DIR_SEPARATOR_S +
+            "tdlib" + G_DIR_SEPARATOR_S + "+" + selfPhoneNumber,
+            "",
+            false,
+            false,
+            false,
+            true, // use secret chats
+            0,
+            "",
+            "",
+            "",
+            "",
+            "",
+            true,
+            false
+        ))
+    });
+    tgl.reply(make_object<ok>());
+
+    tgl.update(make_object<updateAuthorizationState>(make_object<authorizationStateWaitEncryptionKey>(true)));
+    tgl.verifyRequest(checkDatabaseEncryptionKey(""));
+    tgl.reply(make_object<ok>());
+
+    // Contact status from previous session is shown as soon as account is connected
+    tgl.update(make_object<updateAuthorizationState>(make_object<authorizationStateReady>()));
+    prpl.verifyEvents(
+        ConnectionSetStateEvent(connection, PURPLE_CONNECTED),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AWAY),
+        ShowAccountEvent(account)
+    );
+    tgl.verifyRequest(getContacts());
+
+    // Private chat is known without waiting for getContacts and loadChats
+    ASSERT_EQ(0, pluginInfo().send_im(connection, purpleUserName(0).c_str(), "message", PURPLE_MESSAGE_SEND));
+    tgl.verifyRequest(sendMessage(
+        chatIds[0],
+        0,
+        nullptr,
+        nullptr,
+        make_object<inputMessageText>(
+            make_object<formattedText>("message", std::vector<object_ptr<textEntity>>()),
+            false, false
+        )
+    ));
+}
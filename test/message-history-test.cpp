@@ -1,4 +1,5 @@
 #include "supergroup-test.h"
+#include "last-message-store.h"
 
 class MessageHistoryTest: public SupergroupTest {
 protected:
@@ -85,8 +86,13 @@ TEST_F(MessageHistoryTest, TdlibSkipMessages)
     );
     tgl.verifyRequest(viewMessages(groupChatId, {8}, true));
 
-    ASSERT_EQ(std::string("8"), std::string(purple_account_get_string(
-        account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), "")));
+    // Setting was migrated to last message journal, which is flushed at logout
+    ASSERT_EQ(nullptr, purple_account_get_string(
+        account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), NULL));
+    pluginInfo().close(connection);
+    LastMessageStore lastMessages;
+    ASSERT_TRUE(lastMessages.open(lastMessagesPath()));
+    ASSERT_EQ(8, lastMessages.get(ChatId::fromString(std::to_string(groupChatId).c_str())).value());
 }
 
 TEST_F(MessageHistoryTest, TdlibSkipMessages_FlushAtLogout)
@@ -138,6 +144,128 @@ TEST_F(MessageHistoryTest, TdlibSkipMessages_FlushAtLogout)
     );
     tgl.verifyRequest(viewMessages(groupChatId, {6, 5, 4, 3, 2}, true));
 
-    ASSERT_EQ(std::string("6"), std::string(purple_account_get_string(
-        account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), "")));
+    // Setting was migrated to last message journal, which is flushed at logout
+    ASSERT_EQ(nullptr, purple_account_get_string(
+        account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), NULL));
+    pluginInfo().close(connection);
+    LastMessageStore lastMessages;
+    ASSERT_TRUE(lastMessages.open(lastMessagesPath()));
+    ASSERT_EQ(6, lastMessages.get(ChatId::fromString(std::to_string(groupChatId).c_str())).value());
+}
+
+TEST_F(MessageHistoryTest, LastMessageFlushedOnTimer)
+{
+    const ChatId chatId = ChatId::fromString(std::to_string(groupChatId).c_str());
+    loginWithSupergroup();
+
+    tgl.update(make_object<updateChatLastMessage>(
+        groupChatId,
+        makeMessage(6, userIds[0], groupChatId, false, 6, makeTextMessage("6")),
+        0
+    ));
+    {
+        LastMessageStore lastMessages;
+        ASSERT_TRUE(lastMessages.open(lastMessagesPath()));
+        ASSERT_FALSE(lastMessages.contains(chatId));
+    }
+
+    // Written to the journal without waiting for more changes or logout
+    tgl.runTimeouts();
+    LastMessageStore lastMessages;
+    ASSERT_TRUE(lastMessages.open(lastMessagesPath()));
+    ASSERT_EQ(6, lastMessages.get(chatId).value());
+}
+
+TEST_F(MessageHistoryTest, TdlibSkipMessages_LocalFirst)
+{
+    const int purpleChatId = 1;
+    purple_account_set_string(account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), "1");
+    purple_account_set_bool(account, "local-first-history", TRUE);
+    loginWithSupergroup();
+
+    tgl.update(make_object<updateChatLastMessage>(
+        groupChatId, nullptr, 0
+    ));
+
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(6, userIds[0], groupChatId, false, 6, makeTextMessage("6"))
+    ));
+    // Database first, as much as it has
+    tgl.verifyRequest(getChatHistory(groupChatId, 6, 0, 100, true));
+    prpl.verifyNoEvents();
+    tgl.verifyNoRequests();
+
+    std::vector<object_ptr<message>> history;
+    history.push_back(makeMessage(5, userIds[0], groupChatId, false, 5, makeTextMessage("5")));
+    history.push_back(makeMessage(4, userIds[0], groupChatId, false, 4, makeTextMessage("4")));
+    tgl.reply(make_object<messages>(history.size(), std::move(history)));
+    prpl.verifyNoEvents();
+    // Rest from server, in a page sized for the gap
+    tgl.verifyRequest(getChatHistory(groupChatId, 4, 0, 20, false));
+
+    history.clear();
+    history.push_back(makeMessage(3, userIds[0], groupChatId, false, 3, makeTextMessage("3")));
+    history.push_back(makeMessage(2, userIds[0], groupChatId, false, 2, makeTextMessage("2")));
+    history.push_back(makeMessage(1, userIds[0], groupChatId, false, 1, makeTextMessage("1")));
+    tgl.reply(make_object<messages>(history.size(), std::move(history)));
+
+    prpl.verifyEvents(
+        ServGotJoinedChatEvent(connection, purpleChatId, groupChatPurpleName, groupChatTitle),
+        ChatSetTopicEvent(groupChatPurpleName, "", ""),
+        ChatClearUsersEvent(groupChatPurpleName),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "2", PURPLE_MESSAGE_RECV, 2),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "3", PURPLE_MESSAGE_RECV, 3),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "4", PURPLE_MESSAGE_RECV, 4),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "5", PURPLE_MESSAGE_RECV, 5),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "6", PURPLE_MESSAGE_RECV, 6)
+    );
+    tgl.verifyRequest(viewMessages(groupChatId, {6, 5, 4, 3, 2}, true));
+}
+
+TEST_F(MessageHistoryTest, CatchUpOneChatAtATime)
+{
+    const int purpleChatId = 1;
+    purple_account_set_string(account, ("last-message-chat" + std::to_string(groupChatId)).c_str(), "1");
+    purple_account_set_string(account, ("last-message-chat" + std::to_string(chatIds[0])).c_str(), "1");
+    purple_account_set_string(account, "history-fetch-concurrency", "1");
+    loginWithSupergroup();
+    tgl.update(standardPrivateChat(0));
+    prpl.discardEvents();
+
+    tgl.update(make_object<updateChatLastMessage>(groupChatId, nullptr, 0));
+    tgl.update(make_object<updateChatLastMessage>(chatIds[0], nullptr, 0));
+
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(6, userIds[0], groupChatId, false, 6, makeTextMessage("6"))
+    ));
+    tgl.verifyRequest(getChatHistory(groupChatId, 6, 0, 30, false));
+
+    // Waits until group chat is done
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(3, userIds[0], chatIds[0], false, 3, makeTextMessage("3"))
+    ));
+    tgl.verifyNoRequests();
+    prpl.verifyNoEvents();
+
+    std::vector<object_ptr<message>> history;
+    history.push_back(makeMessage(2, userIds[0], groupChatId, false, 2, makeTextMessage("2")));
+    history.push_back(makeMessage(1, userIds[0], groupChatId, false, 1, makeTextMessage("1")));
+    tgl.reply(make_object<messages>(history.size(), std::move(history)));
+    prpl.verifyEvents(
+        ServGotJoinedChatEvent(connection, purpleChatId, groupChatPurpleName, groupChatTitle),
+        ChatSetTopicEvent(groupChatPurpleName, "", ""),
+        ChatClearUsersEvent(groupChatPurpleName),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "2", PURPLE_MESSAGE_RECV, 2),
+        ServGotChatEvent(connection, purpleChatId, userNameInChat, "6", PURPLE_MESSAGE_RECV, 6)
+    );
+    tgl.verifyRequest(viewMessages(groupChatId, {6, 2}, true));
+    tgl.verifyRequest(getChatHistory(chatIds[0], 3, 0, 30, false));
+
+    history.clear();
+    history.push_back(makeMessage(1, userIds[0], chatIds[0], false, 1, makeTextMessage("1")));
+    tgl.reply(make_object<messages>(history.size(), std::move(history)));
+    prpl.verifyEvents(
+        ServGotImEvent(connection, purpleUserName(0), "3", PURPLE_MESSAGE_RECV, 3)
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {3}, true));
 }
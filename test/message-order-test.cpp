@@ -293,3 +293,109 @@ TEST_F(MessageOrderTest, DownloadOrdering)
         )
     );
 }
+
+TEST_F(MessageOrderTest, ReorderWindow)
+{
+    const int32_t dates[2]  = {10002, 10003};
+    const int64_t msgIds[2] = {2, 3};
+    const int32_t srcDate   = 10001;
+    const int64_t srcMsgId  = 1;
+    purple_account_set_string(account, "message-order", "reorder-window");
+    purple_account_set_string(account, "reorder-window-ms", "0");
+    // So that reply source isn't fetched before the window is over
+    purple_account_set_string(account, "reply-source-batch-ms", "100");
+    loginWithOneContact();
+
+    object_ptr<message> message = makeMessage(
+        msgIds[0], userIds[0], chatIds[0], false, dates[0], makeTextMessage("reply")
+    );
+    message->reply_to_message_id_ = srcMsgId;
+    tgl.update(make_object<updateNewMessage>(std::move(message)));
+
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        msgIds[1], userIds[0], chatIds[0], false, dates[1], makeTextMessage("followUp")
+    )));
+    tgl.verifyNoRequests();
+    prpl.verifyNoEvents();
+
+    // Follow-up doesn't wait for the reply source any more
+    runTimeouts();
+    uint64_t getMessagesReqId = tgl.verifyRequest(getMessages(chatIds[0], {srcMsgId}));
+    prpl.verifyEvents(
+        ServGotImEvent(connection, purpleUserName(0), "followUp", PURPLE_MESSAGE_RECV, dates[1])
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {msgIds[0], msgIds[1]}, true));
+
+    std::vector<object_ptr<td::td_api::message>> sources;
+    sources.push_back(makeMessage(srcMsgId, userIds[0], chatIds[0], false, srcDate,
+                                  makeTextMessage("original")));
+    tgl.reply(getMessagesReqId, make_object<messages>(1, std::move(sources)));
+    prpl.verifyEvents(
+        ServGotImEvent(
+            connection, purpleUserName(0),
+            fmt::format(replyPattern, userFirstNames[0] + " " + userLastNames[0], "original", "reply"),
+            PURPLE_MESSAGE_RECV, dates[0]
+        )
+    );
+    tgl.verifyNoRequests();
+}
+
+TEST_F(MessageOrderTest, Photo_Placeholder)
+{
+    const int64_t messageId[2] = {1, 2};
+    const int32_t date[2]      = {10001, 10002};
+    const int32_t fileId       = 1234;
+    purple_account_set_string(account, "message-order", "placeholder");
+    purple_account_set_string(account, "download-behaviour", "file-transfer");
+    loginWithOneContact();
+
+    std::vector<object_ptr<photoSize>> sizes;
+    sizes.push_back(make_object<photoSize>(
+        "whatever",
+        make_object<file>(
+            fileId, 10000, 10000,
+            make_object<localFile>("", true, true, false, false, 0, 0, 0),
+            make_object<remoteFile>("beh", "bleh", false, true, 10000)
+        ),
+        640, 480
+    ));
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        messageId[0], userIds[0], chatIds[0], false, date[0],
+        make_object<messagePhoto>(
+            make_object<photo>(false, nullptr, std::move(sizes)),
+            make_object<formattedText>("photo", std::vector<object_ptr<textEntity>>()),
+            false
+        )
+    )));
+    uint64_t downloadReqId = tgl.verifyRequest(downloadFile(fileId, 1, 0, 0, true));
+    prpl.verifyEvents(
+        ServGotImEvent(connection, purpleUserName(0), "photo", PURPLE_MESSAGE_RECV, date[0]),
+        ConversationWriteEvent(
+            purpleUserName(0), purpleUserName(0),
+            userFirstNames[0] + " " + userLastNames[0] + ": Downloading photo",
+            PURPLE_MESSAGE_SYSTEM, date[0]
+        )
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {messageId[0]}, true));
+
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        messageId[1], userIds[0], chatIds[0], false, date[1], makeTextMessage("followUp")
+    )));
+    prpl.verifyEvents(
+        ServGotImEvent(connection, purpleUserName(0), "followUp", PURPLE_MESSAGE_RECV, date[1])
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {messageId[1]}, true));
+
+    tgl.reply(downloadReqId, make_object<file>(
+        fileId, 10000, 10000,
+        make_object<localFile>("/path", true, true, false, true, 0, 10000, 10000),
+        make_object<remoteFile>("beh", "bleh", false, true, 10000)
+    ));
+    prpl.verifyEvents(ServGotImEvent(
+        connection,
+        purpleUserName(0),
+        "<img src=\"file:///path\">",
+        (PurpleMessageFlags)(PURPLE_MESSAGE_RECV | PURPLE_MESSAGE_IMAGES),
+        date[0]
+    ));
+}
@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "account-data.h"
+#include "test-transceiver.h"
+#include "libpurple-mock.h"
+#include <algorithm>
+#include <random>
+
+enum {
+    CATCH_UP_CHATS    = 200,
+    CATCH_UP_MESSAGES = 100
+};
+
+// History catch-up after reconnect: all chats are fetching history at once, messages are prepended
+// as history pages arrive, then become ready one by one (downloads, reply sources) in random
+// order, then each chat is released
+BENCH(pending_message_queue)
+{
+    using namespace td::td_api;
+    setDebugOutput(false);
+
+    std::vector<std::vector<IncomingMessage>> messages(CATCH_UP_CHATS);
+    std::vector<ChatId>                       chatIds;
+    std::vector<std::pair<ChatId, MessageId>> completions;
+    for (unsigned chat = 0; chat < CATCH_UP_CHATS; chat++) {
+        int64_t chatId = 1000 + chat;
+        for (unsigned i = 0; i < CATCH_UP_MESSAGES; i++) {
+            // Newest first, like getChatHistory returns them
+            IncomingMessage message;
+            message.message = makeMessage(CATCH_UP_MESSAGES - i, chatId, chatId, false, 10000 + i,
+                                          makeTextMessage("message"));
+            completions.emplace_back(getChatId(*message.message), getId(*message.message));
+            messages[chat].push_back(std::move(message));
+        }
+        chatIds.push_back(getChatId(*messages[chat][0].message));
+    }
+    std::shuffle(completions.begin(), completions.end(), std::mt19937(1));
+
+    PendingMessageQueue queue;
+    std::vector<IncomingMessage> readyMessages;
+    unsigned shown = 0;
+
+    Stopwatch timer;
+    for (ChatId chatId: chatIds)
+        queue.setChatNotReady(chatId);
+    for (unsigned i = 0; i < CATCH_UP_MESSAGES; i++)
+        for (unsigned chat = 0; chat < CATCH_UP_CHATS; chat++)
+            queue.addPendingMessage(std::move(messages[chat][i]), PendingMessageQueue::Prepend);
+    double addSeconds = timer.elapsedSeconds();
+    MemoryUsage usage;
+    queue.getMemoryUsage(usage);
+
+    Stopwatch readyTimer;
+    for (const auto &completion: completions) {
+        if (queue.findPendingMessage(completion.first, completion.second))
+            queue.setMessageReady(completion.first, completion.second, readyMessages);
+        shown += readyMessages.size();
+    }
+    for (ChatId chatId: chatIds) {
+        queue.setChatReady(chatId, readyMessages);
+        shown += readyMessages.size();
+    }
+    double readySeconds = readyTimer.elapsedSeconds();
+    double seconds      = timer.elapsedSeconds();
+
+    setDebugOutput(true);
+
+    const unsigned total = CATCH_UP_CHATS * CATCH_UP_MESSAGES;
+    reportBenchResult("messages", total, "");
+    reportBenchResult("shown", shown, "");
+    reportBenchResult("add_ns_per_message", addSeconds * 1e9 / total, "ns");
+    reportBenchResult("ready_ns_per_message", readySeconds * 1e9 / total, "ns");
+    reportBenchResult("estimated_bytes_per_message", double(usage.totalBytes()) / total, "B");
+    reportBenchResult("seconds", seconds, "s");
+}
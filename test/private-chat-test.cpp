@@ -1,6 +1,10 @@
 #include "fixture.h"
 #include "libpurple-mock.h"
+#include "session-recording.h"
+#include "td-client.h"
+#include "purple-info.h"
 #include <fmt/format.h>
+#include <glib/gstdio.h>
 
 class PrivateChatTest: public CommTest {
 protected:
@@ -868,6 +872,336 @@ TEST_F(PrivateChatTest, ReplyToOldMessage_FetchTimeout)
     prpl.verifyNoEvents();
 }
 
+TEST_F(PrivateChatTest, ReplyToRecentMessage)
+{
+    const int32_t date     = 10002;
+    const int64_t msgId    = 2;
+    const int32_t srcDate  = 10001;
+    const int64_t srcMsgId = 1;
+    purple_account_set_string(account, "recent-messages-cache-size", "10");
+    loginWithOneContact();
+
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        srcMsgId, userIds[0], chatIds[0], false, srcDate,
+        makeTextMessage("1<2")
+    )));
+    prpl.verifyEvents(ServGotImEvent(connection, purpleUserName(0), "1&lt;2", PURPLE_MESSAGE_RECV, srcDate));
+    tgl.verifyRequest(viewMessages(chatIds[0], {srcMsgId}, true));
+
+    object_ptr<message> message = makeMessage(
+        msgId,
+        userIds[0],
+        chatIds[0],
+        false,
+        date,
+        makeTextMessage("reply")
+    );
+    message->reply_to_message_id_ = srcMsgId;
+
+    // Reply source is quoted without fetching it
+    tgl.update(make_object<updateNewMessage>(std::move(message)));
+    prpl.verifyEvents(
+        ServGotImEvent(
+            connection,
+            purpleUserName(0),
+            fmt::format(replyPattern, userFirstNames[0] + " " + userLastNames[0], "1&lt;2", "reply"),
+            PURPLE_MESSAGE_RECV,
+            date
+        )
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {msgId}, true));
+}
+
+TEST_F(PrivateChatTest, ReplyToRecentMessage_Edited)
+{
+    const int32_t date     = 10002;
+    const int64_t msgId    = 2;
+    const int32_t srcDate  = 10001;
+    const int64_t srcMsgId = 1;
+    purple_account_set_string(account, "recent-messages-cache-size", "10");
+    loginWithOneContact();
+
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        srcMsgId, userIds[0], chatIds[0], false, srcDate,
+        makeTextMessage("before")
+    )));
+    prpl.verifyEvents(ServGotImEvent(connection, purpleUserName(0), "before", PURPLE_MESSAGE_RECV, srcDate));
+    tgl.verifyRequest(viewMessages(chatIds[0], {srcMsgId}, true));
+
+    tgl.update(make_object<updateMessageContent>(chatIds[0], srcMsgId, makeTextMessage("after")));
+    prpl.verifyNoEvents();
+
+    object_ptr<message> message = makeMessage(msgId, userIds[0], chatIds[0], false, date,
+                                              makeTextMessage("reply"));
+    message->reply_to_message_id_ = srcMsgId;
+    tgl.update(make_object<updateNewMessage>(std::move(message)));
+    prpl.verifyEvents(
+        ServGotImEvent(
+            connection,
+            purpleUserName(0),
+            fmt::format(replyPattern, userFirstNames[0] + " " + userLastNames[0], "after", "reply"),
+            PURPLE_MESSAGE_RECV,
+            date
+        )
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {msgId}, true));
+}
+
+TEST_F(PrivateChatTest, ReplyToRecentMessage_Photo)
+{
+    const int32_t date     = 10002;
+    const int64_t msgId    = 2;
+    const int32_t srcDate  = 10001;
+    const int64_t srcMsgId = 1;
+    const int32_t fileId   = 1234;
+    purple_account_set_string(account, "recent-messages-cache-size", "10");
+    loginWithOneContact();
+
+    tgl.update(make_object<updateNewMessage>(makeMessage(
+        srcMsgId, userIds[0], chatIds[0], false, srcDate,
+        makeTextMessage("source")
+    )));
+    prpl.verifyEvents(ServGotImEvent(connection, purpleUserName(0), "source", PURPLE_MESSAGE_RECV, srcDate));
+    tgl.verifyRequest(viewMessages(chatIds[0], {srcMsgId}, true));
+
+    std::vector<object_ptr<photoSize>> sizes;
+    sizes.push_back(make_object<photoSize>(
+        "whatever",
+        make_object<file>(
+            fileId, 10000, 10000,
+            make_object<localFile>("", true, true, false, false, 0, 0, 0),
+            make_object<remoteFile>("beh", "bleh", false, true, 10000)
+        ),
+        640, 480
+    ));
+    object_ptr<message> message = makeMessage(
+        msgId, userIds[0], chatIds[0], false, date,
+        make_object<messagePhoto>(
+            make_object<photo>(false, nullptr, std::move(sizes)),
+            make_object<formattedText>("photo", std::vector<object_ptr<textEntity>>()),
+            false
+        )
+    );
+    message->reply_to_message_id_ = srcMsgId;
+
+    // Message waits for the download, but reply source is already known
+    tgl.update(make_object<updateNewMessage>(std::move(message)));
+    tgl.verifyRequest(downloadFile(fileId, 1, 0, 0, true));
+    prpl.verifyNoEvents();
+}
+
+TEST_F(PrivateChatTest, ReplySourcesFetchedTogether)
+{
+    const int32_t date[]     = {10003, 10004};
+    const int64_t msgId[]    = {3, 4};
+    const int32_t srcDate[]  = {10001, 10002};
+    const int64_t srcMsgId[] = {1, 2};
+    purple_account_set_string(account, "reply-source-batch-ms", "100");
+    loginWithOneContact();
+
+    for (unsigned i = 0; i < 2; i++) {
+        object_ptr<message> message = makeMessage(msgId[i], userIds[0], chatIds[0], false, date[i],
+                                                  makeTextMessage("reply" + std::to_string(i)));
+        message->reply_to_message_id_ = srcMsgId[i];
+        tgl.update(make_object<updateNewMessage>(std::move(message)));
+    }
+    tgl.verifyNoRequests();
+    prpl.verifyNoEvents();
+
+    runTimeouts();
+    tgl.verifyRequest(getMessages(chatIds[0], {srcMsgId[0], srcMsgId[1]}));
+
+    std::vector<object_ptr<message>> sources;
+    sources.push_back(makeMessage(srcMsgId[0], userIds[0], chatIds[0], false, srcDate[0],
+                                  makeTextMessage("source0")));
+    // Second one not found
+    sources.push_back(nullptr);
+    tgl.reply(make_object<messages>(1, std::move(sources)));
+    prpl.verifyEvents(
+        ServGotImEvent(
+            connection,
+            purpleUserName(0),
+            fmt::format(replyPattern, userFirstNames[0] + " " + userLastNames[0], "source0", "reply0"),
+            PURPLE_MESSAGE_RECV,
+            date[0]
+        ),
+        ServGotImEvent(
+            connection,
+            purpleUserName(0),
+            fmt::format(replyPattern, "Unknown user", "[message unavailable]", "reply1"),
+            PURPLE_MESSAGE_RECV,
+            date[1]
+        )
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {msgId[0], msgId[1]}, true));
+}
+
+TEST_F(PrivateChatTest, CoalescedUserUpdates_StatusInBetween)
+{
+    purple_account_set_bool(account, "coalesce-updates", TRUE);
+    loginWithOneContact();
+
+    // Status in the middle is older than the one in the last updateUser, so must not win
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(standardUpdateUser(0));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    updates.push_back(standardUpdateUser(0));
+    tgl.updates(std::move(updates));
+    prpl.verifyNoEvents();
+
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    prpl.verifyEvents(UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE));
+}
+
+TEST_F(PrivateChatTest, CoalescedUserUpdates_RecordedAsReceived)
+{
+    const std::string recordingPath = "coalesced-updates-recording.bin";
+    purple_account_set_bool(account, "coalesce-updates", TRUE);
+    purple_account_set_string(account, "record-session-file", recordingPath.c_str());
+    loginWithOneContact();
+
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(standardUpdateUser(0));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    updates.push_back(standardUpdateUser(0));
+    tgl.updates(std::move(updates));
+    prpl.verifyNoEvents();
+    pluginInfo().close(connection);
+
+    // Recording has all three updates, although only one got dispatched
+    std::vector<int32_t> responses;
+    SessionReader reader;
+    SessionRecord record;
+    ASSERT_TRUE(reader.open(recordingPath.c_str()));
+    while (reader.next(record))
+        if (record.kind == SessionRecord::Kind::Response)
+            responses.push_back(record.constructorId);
+    ASSERT_FALSE(reader.failed());
+    g_unlink(recordingPath.c_str());
+
+    ASSERT_LE(3u, responses.size());
+    ASSERT_EQ(updateUser::ID, responses[responses.size()-3]);
+    ASSERT_EQ(updateUserStatus::ID, responses[responses.size()-2]);
+    ASSERT_EQ(updateUser::ID, responses[responses.size()-1]);
+}
+
+TEST_F(PrivateChatTest, PrioritizeMessages_MessageBeforeStatus)
+{
+    constexpr int64_t messageId = 1;
+    constexpr int32_t date      = 10001;
+    purple_account_set_bool(account, "prioritize-messages", TRUE);
+    loginWithOneContact();
+
+    // Nothing to give way to
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    prpl.verifyEvents(UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE));
+
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOffline>()));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOffline>()));
+    updates.push_back(make_object<updateNewMessage>(
+        makeMessage(messageId, userIds[0], chatIds[0], false, date, makeTextMessage("text"))
+    ));
+    tgl.updates(std::move(updates));
+
+    // Status updates keep their relative order
+    prpl.verifyEvents(
+        ServGotImEvent(connection, purpleUserName(0), "text", PURPLE_MESSAGE_RECV, date),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AWAY),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AWAY)
+    );
+    tgl.verifyRequest(viewMessages(chatIds[0], {messageId}, true));
+}
+
+TEST_F(PrivateChatTest, PrioritizeMessages_StatusOlderThanUpdateUser)
+{
+    purple_account_set_bool(account, "prioritize-messages", TRUE);
+    loginWithOneContact();
+
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    prpl.verifyEvents(UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE));
+
+    // Postponed status arrived before updateUser, whose status is the newer one
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    updates.push_back(standardUpdateUser(0));
+    tgl.updates(std::move(updates));
+    prpl.verifyNoEvents();
+
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    prpl.verifyEvents(UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE));
+}
+
+TEST_F(PrivateChatTest, PrioritizeMessages_StatusNotStarved)
+{
+    constexpr unsigned messageCount = 16;
+    constexpr int32_t  date         = 10001;
+    purple_account_set_bool(account, "prioritize-messages", TRUE);
+    loginWithOneContact();
+
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    prpl.verifyEvents(UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE));
+
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOffline>()));
+    for (unsigned i = 1; i <= messageCount; i++)
+        updates.push_back(make_object<updateNewMessage>(
+            makeMessage(i, userIds[0], chatIds[0], false, date, makeTextMessage(std::to_string(i)))
+        ));
+    tgl.updates(std::move(updates));
+
+    // Postponed status goes through after 8 other updates, not after all of them
+    std::vector<std::unique_ptr<PurpleEvent>> events;
+    std::vector<object_ptr<viewMessages>>     viewRequests;
+    for (unsigned i = 1; i <= messageCount; i++) {
+        events.push_back(std::make_unique<ServGotImEvent>(connection, purpleUserName(0), std::to_string(i),
+                                                          PURPLE_MESSAGE_RECV, date));
+        if (i == 8)
+            events.push_back(std::make_unique<UserStatusEvent>(account, purpleUserName(0), PURPLE_STATUS_AWAY));
+        viewRequests.push_back(make_object<viewMessages>(chatIds[0], std::vector<int64_t>(1, i), true));
+    }
+    prpl.verifyEvents(events);
+
+    std::vector<const Function *> requests;
+    for (const object_ptr<viewMessages> &request: viewRequests)
+        requests.push_back(request.get());
+    tgl.verifyRequests(requests);
+}
+
+TEST_F(PrivateChatTest, DispatchItemBudget)
+{
+    purple_account_set_string(account, "dispatch-item-budget", "2");
+    loginWithOneContact();
+
+    std::vector<object_ptr<Object>> updates;
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOffline>()));
+    updates.push_back(make_object<updateUserStatus>(userIds[0], make_object<userStatusOnline>(0)));
+    tgl.updates(std::move(updates));
+    prpl.verifyEvents(
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AWAY)
+    );
+
+    // Waits behind what is left over rather than being dispatched right away
+    tgl.update(make_object<updateUserStatus>(userIds[0], make_object<userStatusOffline>()));
+    prpl.verifyNoEvents();
+
+    tgl.runTimeouts();
+    prpl.verifyEvents(
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AVAILABLE),
+        UserStatusEvent(account, purpleUserName(0), PURPLE_STATUS_AWAY)
+    );
+
+    PurpleTdClient *tdClient = getTdClient(account);
+    ASSERT_NE(nullptr, tdClient);
+    std::string statistics = tdClient->getTransceiverStatistics();
+    ASSERT_NE(std::string::npos, statistics.find("\"dispatch_budget\":{\"yields\":1,\"max_backlog\":1,"))
+        << statistics;
+}
+
 TEST_F(PrivateChatTest, TypingNotification)
 {
     loginWithOneContact();
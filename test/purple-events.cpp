@@ -6,7 +6,10 @@ PurpleEventReceiver g_purpleEvents;
 
 void PurpleEventReceiver::addEvent(std::unique_ptr<PurpleEvent> event)
 {
-    std::cout << "Libpurple event: " << event->toString() << "\n";
+    if (!m_quiet)
+        std::cout << "Libpurple event: " << event->toString() << "\n";
+    if (m_observer)
+        m_observer(*event);
     m_events.push(std::move(event));
 }
 
@@ -211,6 +214,12 @@ static void compare(const ChatClearUsersEvent &actual, const ChatClearUsersEvent
     COMPARE(chatName);
 }
 
+static void compare(const ChatRemoveUserEvent &actual, const ChatRemoveUserEvent &expected)
+{
+    COMPARE(chatName);
+    COMPARE(user);
+}
+
 static void compare(const ChatSetTopicEvent &actual, const ChatSetTopicEvent &expected)
 {
     COMPARE(chatName);
@@ -345,6 +354,7 @@ static void compareEvents(const PurpleEvent &actual, const PurpleEvent &expected
         C(PresentConversation)
         C(ChatAddUser)
         C(ChatClearUsers)
+        C(ChatRemoveUser)
         C(ChatSetTopic)
         C(XferAccepted)
         C(XferStart)
@@ -399,6 +409,13 @@ void PurpleEventReceiver::verifyEvents2(std::initializer_list<std::unique_ptr<Pu
     verifyNoEvents();
 }
 
+void PurpleEventReceiver::verifyEvents(const std::vector<std::unique_ptr<PurpleEvent>> &events)
+{
+    for (auto &pEvent: events)
+        verifyEvent(*pEvent);
+    verifyNoEvents();
+}
+
 void PurpleEventReceiver::verifyNoEvents()
 {
     ASSERT_TRUE(m_events.empty()) << "Unexpected libpurple event: " << m_events.front()->toString();
@@ -492,6 +509,7 @@ std::string PurpleEvent::toString() const
     C(PresentConversation)
     C(ChatAddUser)
     C(ChatClearUsers)
+    C(ChatRemoveUser)
     C(ChatSetTopic)
     C(XferAccepted)
     C(XferStart)
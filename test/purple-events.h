@@ -8,6 +8,7 @@
 #include <queue>
 #include <iostream>
 #include <map>
+#include <functional>
 
 struct PurpleEvent;
 
@@ -17,7 +18,13 @@ extern "C" {
 
 class PurpleEventReceiver {
 public:
+    using Observer = std::function<void(const PurpleEvent &event)>;
+
     void addEvent(std::unique_ptr<PurpleEvent> event);
+    // Don't print events as they come (benchmarks)
+    void setQuiet(bool quiet) { m_quiet = quiet; }
+    // Called for every event before it is queued
+    void setObserver(Observer observer) { m_observer = std::move(observer); }
 
     // Check that given events in that order, and no others, are in the queue, and clear the queue
     template<typename... EventTypes>
@@ -28,6 +35,7 @@ public:
     }
 
     void verifyEvents2(std::initializer_list<std::unique_ptr<PurpleEvent>> events);
+    void verifyEvents(const std::vector<std::unique_ptr<PurpleEvent>> &events);
     void verifyNoEvents();
     void discardEvents();
 
@@ -54,6 +62,8 @@ private:
     }
 
     std::queue<std::unique_ptr<PurpleEvent>> m_events;
+    bool       m_quiet       = false;
+    Observer   m_observer;
     void      *inputUserData = NULL;
     GCallback  inputOkCb     = NULL;
     GCallback  inputCancelCb = NULL;
@@ -97,6 +107,7 @@ enum class PurpleEventType: uint8_t {
     PresentConversation,
     ChatAddUser,
     ChatClearUsers,
+    ChatRemoveUser,
     ChatSetTopic,
     XferAccepted,
     XferStart,
@@ -434,6 +445,14 @@ struct ChatClearUsersEvent: PurpleEvent {
     : PurpleEvent(PurpleEventType::ChatClearUsers), chatName(chatName) {}
 };
 
+struct ChatRemoveUserEvent: PurpleEvent {
+    std::string chatName;
+    std::string user;
+
+    ChatRemoveUserEvent(const std::string &chatName, const std::string &user)
+    : PurpleEvent(PurpleEventType::ChatRemoveUser), chatName(chatName), user(user) {}
+};
+
 struct ChatSetTopicEvent: PurpleEvent {
     std::string chatName;
     std::string newTopic;
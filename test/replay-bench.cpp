@@ -0,0 +1,46 @@
+#include "bench.h"
+#include "replay-transceiver.h"
+#include "headless-account.h"
+#include "libpurple-mock.h"
+#include "purple-events.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// Replays session recorded with record-session-file account option, given by
+// TDLIB_PURPLE_REPLAY environment variable, and measures plugin-side throughput
+BENCH(replay)
+{
+    const char *path = getenv("TDLIB_PURPLE_REPLAY");
+    if (!path) {
+        printf("replay: skipped, set TDLIB_PURPLE_REPLAY to a session recording\n");
+        return;
+    }
+
+    ReplayTransceiver replay;
+    if (!replay.load(path)) {
+        printf("replay: failed to load %s\n", path);
+        return;
+    }
+
+    setDebugOutput(false);
+    g_purpleEvents.setQuiet(true);
+
+    HeadlessAccount account(replay, "+1234567");
+    account.login();
+
+    Stopwatch timer;
+    while (replay.replayNext())
+        g_purpleEvents.discardEvents();
+    double seconds = timer.elapsedSeconds();
+
+    g_purpleEvents.setQuiet(false);
+    setDebugOutput(true);
+
+    reportBenchResult("seconds", seconds, "s");
+    reportBenchResult("updates", replay.updatesDelivered, "");
+    reportBenchResult("responses", replay.responsesDelivered, "");
+    reportBenchResult("throughput", (replay.updatesDelivered + replay.responsesDelivered) / seconds, "items/s");
+    reportBenchResult("skipped_updates", replay.updatesSkipped, "");
+    reportBenchResult("unmatched_responses", replay.responsesUnmatched, "");
+    reportBenchResult("mismatched_requests", replay.requestsMismatched, "");
+}
@@ -0,0 +1,73 @@
+#include "replay-transceiver.h"
+
+bool ReplayTransceiver::load(const char *path)
+{
+    SessionReader reader;
+    if (!reader.open(path))
+        return false;
+
+    SessionRecord record;
+    while (reader.next(record)) {
+        if (record.kind == SessionRecord::Kind::Request)
+            m_requests.push_back({record.requestId, record.constructorId});
+        else
+            m_responses.push_back(std::move(record));
+    }
+
+    return !reader.failed();
+}
+
+void ReplayTransceiver::send(td::Client::Request &&request)
+{
+    if (m_nextRequest >= m_requests.size()) {
+        requestsMismatched++;
+        return;
+    }
+
+    const RecordedRequest &recorded = m_requests[m_nextRequest++];
+    if (request.function && (request.function->get_id() == recorded.constructorId))
+        m_requestIds[recorded.requestId] = request.id;
+    else
+        requestsMismatched++;
+}
+
+guint ReplayTransceiver::addTimeout(guint interval, GSourceFunc function, gpointer data)
+{
+    // Replay runs as fast as possible, there is no waiting for timeouts
+    return m_nextTimerId++;
+}
+
+void ReplayTransceiver::cancelTimer(guint id)
+{
+}
+
+bool ReplayTransceiver::replayNext()
+{
+    if (m_nextResponse >= m_responses.size())
+        return false;
+
+    SessionRecord &record = m_responses[m_nextResponse++];
+    if (record.requestId == 0) {
+        if (record.object) {
+            updatesDelivered++;
+            receive({0, std::move(record.object)});
+        } else
+            updatesSkipped++;
+    } else {
+        auto it = m_requestIds.find(record.requestId);
+        if (it == m_requestIds.end())
+            responsesUnmatched++;
+        else {
+            uint64_t requestId = it->second;
+            m_requestIds.erase(it);
+            responsesDelivered++;
+            if (record.object)
+                receive({requestId, std::move(record.object)});
+            else
+                // Plugin still needs some response to move on
+                receive({requestId, td::td_api::make_object<td::td_api::error>(500, "Response not recorded")});
+        }
+    }
+
+    return true;
+}
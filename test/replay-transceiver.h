@@ -0,0 +1,47 @@
+#ifndef _REPLAY_TRANSCEIVER_H
+#define _REPLAY_TRANSCEIVER_H
+
+#include "transceiver.h"
+#include "session-recording.h"
+#include <vector>
+#include <unordered_map>
+
+// Feeds a session recorded with SessionRecorder back into the plugin, as fast as it can take it.
+// Requests sent by the plugin are matched with recorded ones by order, so that recorded responses
+// can be delivered with request ids the plugin expects.
+class ReplayTransceiver: public ITransceiverBackend {
+public:
+    bool  load(const char *path);
+
+    void  send(td::Client::Request &&request) override;
+    guint addTimeout(guint interval, GSourceFunc function, gpointer data) override;
+    void  cancelTimer(guint id) override;
+
+    // Delivers next recorded response or update. Returns false when there is nothing left.
+    bool  replayNext();
+    size_t remaining() const { return m_responses.size() - m_nextResponse; }
+
+    unsigned updatesDelivered    = 0;
+    unsigned responsesDelivered  = 0;
+    // Recorded without content, see isRecordedWithContent
+    unsigned updatesSkipped      = 0;
+    // Responses to requests which the plugin didn't send (yet) during replay
+    unsigned responsesUnmatched  = 0;
+    // Plugin sent different request than recorded at that point
+    unsigned requestsMismatched  = 0;
+private:
+    struct RecordedRequest {
+        uint64_t requestId;
+        int32_t  constructorId;
+    };
+
+    std::vector<RecordedRequest>           m_requests;
+    size_t                                 m_nextRequest = 0;
+    std::vector<SessionRecord>             m_responses;
+    size_t                                 m_nextResponse = 0;
+    // Recorded request id to replayed request id
+    std::unordered_map<uint64_t, uint64_t> m_requestIds;
+    guint                                  m_nextTimerId = 1;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "session-recording.h"
+#include <gtest/gtest.h>
+#include <glib/gstdio.h>
+
+using namespace td::td_api;
+
+class SessionRecordingTest: public testing::Test {
+protected:
+    const std::string path = "session-recording-test.bin";
+
+    void TearDown() override
+    {
+        g_unlink(path.c_str());
+    }
+};
+
+TEST_F(SessionRecordingTest, RoundTrip)
+{
+    {
+        SessionRecorder recorder;
+        ASSERT_TRUE(recorder.open(path.c_str()));
+
+        recorder.recordRequest(1, getMessage(1000, 5));
+
+        auto user = make_object<updateUser>();
+        user->user_ = make_object<td::td_api::user>();
+        user->user_->id_          = 100;
+        user->user_->first_name_  = "Gottfried";
+        user->user_->last_name_   = "Leibniz";
+        user->user_->status_      = make_object<userStatusOnline>(1234);
+        user->user_->type_        = make_object<userTypeRegular>();
+        user->user_->have_access_ = true;
+        recorder.recordResponse(0, *user);
+
+        auto message = make_object<updateNewMessage>();
+        message->message_ = make_object<td::td_api::message>();
+        message->message_->id_      = 5;
+        message->message_->chat_id_ = 1000;
+        message->message_->sender_  = make_object<messageSenderUser>(100);
+        message->message_->date_    = 12345;
+        message->message_->content_ = make_object<messageText>(
+            make_object<formattedText>("text", std::vector<object_ptr<textEntity>>()),
+            nullptr
+        );
+        recorder.recordResponse(0, *message);
+
+        auto photoMessage = make_object<td::td_api::message>();
+        photoMessage->id_      = 6;
+        photoMessage->content_ = make_object<messagePhoto>();
+        recorder.recordResponse(1, *photoMessage);
+
+        recorder.recordResponse(2, error(404, "Not found"));
+        // Stored as constructor id only
+        recorder.recordResponse(0, updateFile());
+    }
+
+    SessionReader reader;
+    SessionRecord record;
+    ASSERT_TRUE(reader.open(path.c_str()));
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(SessionRecord::Kind::Request, record.kind);
+    ASSERT_EQ(1u, record.requestId);
+    ASSERT_EQ(getMessage::ID, record.constructorId);
+    ASSERT_EQ(nullptr, record.object);
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(SessionRecord::Kind::Response, record.kind);
+    ASSERT_EQ(0u, record.requestId);
+    ASSERT_EQ(updateUser::ID, record.constructorId);
+    ASSERT_NE(nullptr, record.object);
+    {
+        const user &user = *static_cast<const updateUser &>(*record.object).user_;
+        ASSERT_EQ(100, user.id_);
+        ASSERT_EQ("Gottfried", user.first_name_);
+        ASSERT_EQ("Leibniz", user.last_name_);
+        ASSERT_EQ(userStatusOnline::ID, user.status_->get_id());
+        ASSERT_EQ(1234, static_cast<const userStatusOnline &>(*user.status_).expires_);
+        ASSERT_EQ(userTypeRegular::ID, user.type_->get_id());
+        ASSERT_TRUE(user.have_access_);
+    }
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(updateNewMessage::ID, record.constructorId);
+    ASSERT_NE(nullptr, record.object);
+    {
+        const message &message = *static_cast<const updateNewMessage &>(*record.object).message_;
+        ASSERT_EQ(5, message.id_);
+        ASSERT_EQ(1000, message.chat_id_);
+        ASSERT_EQ(12345, message.date_);
+        ASSERT_EQ(messageSenderUser::ID, message.sender_->get_id());
+        ASSERT_EQ(100, static_cast<const messageSenderUser &>(*message.sender_).user_id_);
+        ASSERT_EQ(messageText::ID, message.content_->get_id());
+        ASSERT_EQ("text", static_cast<const messageText &>(*message.content_).text_->text_);
+    }
+
+    // Content which is not recorded is replaced with messageUnsupported
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(1u, record.requestId);
+    ASSERT_EQ(message::ID, record.constructorId);
+    ASSERT_NE(nullptr, record.object);
+    ASSERT_EQ(messageUnsupported::ID, static_cast<const message &>(*record.object).content_->get_id());
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(2u, record.requestId);
+    ASSERT_EQ(error::ID, record.constructorId);
+    ASSERT_NE(nullptr, record.object);
+    ASSERT_EQ(404, static_cast<const error &>(*record.object).code_);
+    ASSERT_EQ("Not found", static_cast<const error &>(*record.object).message_);
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(updateFile::ID, record.constructorId);
+    ASSERT_EQ(nullptr, record.object);
+
+    ASSERT_FALSE(reader.next(record));
+    ASSERT_FALSE(reader.failed());
+}
+
+TEST_F(SessionRecordingTest, Truncated)
+{
+    {
+        SessionRecorder recorder;
+        ASSERT_TRUE(recorder.open(path.c_str()));
+        recorder.recordResponse(0, updateChatTitle(1000, "Title"));
+    }
+
+    gchar *contents;
+    gsize  length;
+    ASSERT_TRUE(g_file_get_contents(path.c_str(), &contents, &length, NULL));
+    ASSERT_TRUE(g_file_set_contents(path.c_str(), contents, length-1, NULL));
+    g_free(contents);
+
+    SessionReader reader;
+    SessionRecord record;
+    ASSERT_TRUE(reader.open(path.c_str()));
+    ASSERT_FALSE(reader.next(record));
+    ASSERT_TRUE(reader.failed());
+}
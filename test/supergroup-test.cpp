@@ -635,4 +635,147 @@ TEST_F(SupergroupTest, ReceiveChannelPost)
 
 }
 
+TEST_F(SupergroupTest, MemberListPagedAndUpdatedFromMessages)
+{
+    constexpr int     purpleChatId = 1;
+    constexpr int64_t messageId    = 10001;
+    constexpr int32_t date         = 12345;
+
+    auto fullInfo = make_object<supergroupFullInfo>();
+    fullInfo->description_ = "Description";
+
+    auto firstPage = make_object<chatMembers>();
+    firstPage->total_count_ = 3;
+    firstPage->members_.push_back(makeChatMember(
+        userIds[1], userIds[1], 0, make_object<chatMemberStatusCreator>("", true), nullptr
+    ));
+
+    auto secondPage = make_object<chatMembers>();
+    secondPage->total_count_ = 3;
+    secondPage->members_.push_back(makeChatMember(
+        selfId, userIds[1], 0, make_object<chatMemberStatusMember>(), nullptr
+    ));
+    secondPage->members_.push_back(makeChatMember(
+        userIds[0], userIds[1], 0, make_object<chatMemberStatusMember>(), nullptr
+    ));
+
+    login(
+        {
+            make_object<updateUser>(makeUser(userIds[0], userFirstNames[0], userLastNames[0], "",
+                                             make_object<userStatusOffline>())),
+            make_object<updateUser>(makeUser(userIds[1], userFirstNames[1], userLastNames[1], "",
+                                             make_object<userStatusOffline>())),
+            make_object<updateSupergroup>(make_object<supergroup>(
+                groupId, "", 0, make_object<chatMemberStatusMember>(), 3,
+                false, false, false, false, false, false, "", false
+            )),
+            make_object<updateNewChat>(makeChat(
+                groupChatId, make_object<chatTypeSupergroup>(groupId, false), groupChatTitle,
+                nullptr, 0, 0, 0
+            )),
+            makeUpdateChatListMain(groupChatId)
+        },
+        make_object<users>(),
+        make_object<chats>(std::vector<int64_t>(1, groupChatId)),
+        {
+            std::make_unique<AddChatEvent>(
+                groupChatPurpleName, groupChatTitle, account, nullptr, nullptr
+            ),
+        },
+        {
+            make_object<getSupergroupFullInfo>(groupId),
+            make_object<getSupergroupMembers>(groupId, make_object<supergroupMembersFilterRecent>(), 0, 200),
+            std::move(fullInfo),
+            std::move(firstPage),
+            make_object<getSupergroupMembers>(groupId, make_object<supergroupMembersFilterAdministrators>(), 0, 200),
+            make_object<chatMembers>()
+            // Rest of the members are not fetched until the conversation is open
+        }
+    );
+
+    GHashTable *components = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    g_hash_table_insert(components, (char *)"id", g_strdup((groupChatPurpleName).c_str()));
+    pluginInfo().join_chat(connection, components);
+    g_hash_table_destroy(components);
+
+    prpl.verifyEvents(
+        ServGotJoinedChatEvent(connection, purpleChatId, groupChatPurpleName, groupChatTitle),
+        ChatSetTopicEvent(groupChatPurpleName, "Description", ""),
+        ChatClearUsersEvent(groupChatPurpleName),
+        ChatAddUserEvent(groupChatPurpleName, userFirstNames[1] + " " + userLastNames[1],
+                         "", PURPLE_CBFLAGS_FOUNDER, false),
+        PresentConversationEvent(groupChatPurpleName)
+    );
+    tgl.verifyRequest(getSupergroupMembers(groupId, make_object<supergroupMembersFilterRecent>(), 1, 200));
+
+    tgl.reply(std::move(secondPage));
+    prpl.verifyEvents(
+        ChatAddUserEvent(groupChatPurpleName, "+" + selfPhoneNumber, "", PURPLE_CBFLAGS_NONE, false),
+        ChatAddUserEvent(groupChatPurpleName, userFirstNames[0] + " " + userLastNames[0],
+                         "", PURPLE_CBFLAGS_NONE, false)
+    );
+    tgl.verifyNoRequests();
+
+    // Member list is updated without fetching it again
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(messageId, userIds[1], groupChatId, false, date,
+                    make_object<messageChatDeleteMember>(userIds[0]))
+    ));
+    tgl.verifyRequest(viewMessages(groupChatId, {messageId}, true));
+    prpl.verifyEvents(
+        ChatRemoveUserEvent(groupChatPurpleName, userFirstNames[0] + " " + userLastNames[0]),
+        ConversationWriteEvent(groupChatPurpleName, NotificationWho,
+                               userFirstNames[1] + " " + userLastNames[1] +
+                               ": Unsupported message type messageChatDeleteMember",
+                               PURPLE_MESSAGE_SYSTEM, date)
+    );
+
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(messageId+1, userIds[1], groupChatId, false, date,
+                    make_object<messageChatAddMembers>(std::vector<int64_t>(1, userIds[0])))
+    ));
+    tgl.verifyRequest(viewMessages(groupChatId, {messageId+1}, true));
+    prpl.verifyEvents(
+        ChatAddUserEvent(groupChatPurpleName, userFirstNames[0] + " " + userLastNames[0],
+                         "", PURPLE_CBFLAGS_NONE, false),
+        ConversationWriteEvent(groupChatPurpleName, NotificationWho,
+                               userFirstNames[1] + " " + userLastNames[1] +
+                               ": Unsupported message type messageChatAddMembers",
+                               PURPLE_MESSAGE_SYSTEM, date)
+    );
+
+    // Join message doesn't downgrade a known creator to ordinary member
+    tgl.update(make_object<updateNewMessage>(
+        makeMessage(messageId+2, userIds[1], groupChatId, false, date,
+                    make_object<messageChatJoinByLink>())
+    ));
+    tgl.verifyRequest(viewMessages(groupChatId, {messageId+2}, true));
+    prpl.verifyEvents(
+        ConversationWriteEvent(groupChatPurpleName, NotificationWho,
+                               userFirstNames[1] + " " + userLastNames[1] +
+                               ": Unsupported message type messageChatJoinByLink",
+                               PURPLE_MESSAGE_SYSTEM, date)
+    );
+
+    // Member list is shown again from what is cached
+    purple_conv_chat_left(purple_conversation_get_chat_data(purple_find_chat(connection, purpleChatId)));
+    components = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    g_hash_table_insert(components, (char *)"id", g_strdup((groupChatPurpleName).c_str()));
+    pluginInfo().join_chat(connection, components);
+    g_hash_table_destroy(components);
+
+    prpl.verifyEvents(
+        ServGotJoinedChatEvent(connection, purpleChatId, groupChatPurpleName, groupChatTitle),
+        ChatSetTopicEvent(groupChatPurpleName, "Description", ""),
+        ChatClearUsersEvent(groupChatPurpleName),
+        ChatAddUserEvent(groupChatPurpleName, userFirstNames[1] + " " + userLastNames[1],
+                         "", PURPLE_CBFLAGS_FOUNDER, false),
+        ChatAddUserEvent(groupChatPurpleName, "+" + selfPhoneNumber, "", PURPLE_CBFLAGS_NONE, false),
+        ChatAddUserEvent(groupChatPurpleName, userFirstNames[0] + " " + userLastNames[0],
+                         "", PURPLE_CBFLAGS_NONE, false),
+        PresentConversationEvent(groupChatPurpleName)
+    );
+    tgl.verifyNoRequests();
+}
+
 Test non-user member
@@ -74,10 +74,11 @@ void TestTransceiver::cancelTimer(guint id)
 void TestTransceiver::runTimeouts()
 {
     std::cout << "Waiting for all timeouts\n";
-    for (const TimerInfo &timer: m_timers)
+    // Timers started by timer functions are left for next time
+    std::vector<TimerInfo> timers;
+    timers.swap(m_timers);
+    for (const TimerInfo &timer: timers)
         while (timer.function(timer.data)) ;
-
-    m_timers.clear();
 }
 
 #define COMPARE(param) ASSERT_EQ(expected.param, actual.param)
@@ -304,6 +305,12 @@ static void compare(const getMessage &actual, const getMessage &expected)
     COMPARE(message_id_);
 }
 
+static void compare(const getMessages &actual, const getMessages &expected)
+{
+    COMPARE(chat_id_);
+    COMPARE(message_ids_);
+}
+
 static void compare(const sendChatAction &actual, const sendChatAction &expected)
 {
     COMPARE(chat_id_);
@@ -510,6 +517,7 @@ static void compareRequests(const Function &actual, const Function &expected,
         C(checkAuthenticationCode)
         C(registerUser)
         C(getMessage)
+        C(getMessages)
         C(sendChatAction)
         C(addProxy)
         case disableProxy::ID: break; // no data fields
@@ -555,6 +563,16 @@ void TestTransceiver::update(object_ptr<Object> object)
     receive({0, std::move(object)});
 }
 
+void TestTransceiver::updates(std::vector<object_ptr<Object>> objects)
+{
+    std::vector<td::Client::Response> responses;
+    for (object_ptr<Object> &object: objects) {
+        std::cout << "Sending update: " << responseToString(*object) << "\n";
+        responses.push_back({0, std::move(object)});
+    }
+    receive(std::move(responses));
+}
+
 void TestTransceiver::reply(object_ptr<Object> object)
 {
     ASSERT_FALSE(m_lastRequestIds.empty()) << "No requests to reply to";
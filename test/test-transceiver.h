@@ -19,6 +19,8 @@ public:
     void verifyNoRequests();
 
     void update(td::td_api::object_ptr<td::td_api::Object> object);
+    // All queued before any of them is dispatched
+    void updates(std::vector<td::td_api::object_ptr<td::td_api::Object>> objects);
 
     // Replies to the first non-replied request from the last verifyRequest(s) batch, or fails the
     // test case if there is no such request
@@ -0,0 +1,171 @@
+#include "transceiver-stats.h"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram()
+:   m_count(0),
+    m_sum(0),
+    m_max(0)
+{
+    for (uint64_t &bucket: m_buckets)
+        bucket = 0;
+}
+
+void LatencyHistogram::add(gint64 microseconds)
+{
+    if (microseconds < 0)
+        microseconds = 0;
+
+    unsigned bucket = 0;
+    for (guint64 value = microseconds; (value != 0) && (bucket < BUCKETS-1); value >>= 1)
+        bucket++;
+
+    m_buckets[bucket]++;
+    m_count++;
+    m_sum += microseconds;
+    if (microseconds > m_max)
+        m_max = microseconds;
+}
+
+gint64 LatencyHistogram::percentile(unsigned percent) const
+{
+    if (m_count == 0)
+        return 0;
+
+    uint64_t threshold = (m_count * percent + 99) / 100;
+    uint64_t total     = 0;
+    for (unsigned bucket = 0; bucket < BUCKETS-1; bucket++) {
+        total += m_buckets[bucket];
+        if (total >= threshold)
+            return std::min(gint64(1) << bucket, m_max);
+    }
+    return m_max;
+}
+
+void LatencyHistogram::appendJson(std::string &out) const
+{
+    out += "{\"count\":" + std::to_string(m_count);
+    out += ",\"sum_us\":" + std::to_string(m_sum);
+    out += ",\"max_us\":" + std::to_string(m_max);
+    out += ",\"p50_us\":" + std::to_string(percentile(50));
+    out += ",\"p99_us\":" + std::to_string(percentile(99));
+    out += ",\"buckets\":[";
+
+    // Trailing empty buckets are omitted
+    unsigned used = BUCKETS;
+    while ((used > 0) && (m_buckets[used-1] == 0))
+        used--;
+    for (unsigned bucket = 0; bucket < used; bucket++) {
+        if (bucket != 0)
+            out += ',';
+        out += std::to_string(m_buckets[bucket]);
+    }
+    out += "]}";
+}
+
+TransceiverStats::TransceiverStats()
+:   m_startTime(g_get_monotonic_time()),
+    m_sentQueries(SENT_QUERY_SLOTS, SentQuery{0, 0, 0}),
+    m_maxQueueDepth(0),
+    m_dispatchYields(0),
+    m_maxBacklog(0),
+    m_maxBacklogWait(0)
+{
+}
+
+TransceiverStats::NamedHistogram &
+TransceiverStats::getHistogram(std::unordered_map<int32_t, NamedHistogram> &map,
+                               const td::td_api::Object &object)
+{
+    auto it = map.find(object.get_id());
+    if (it == map.end()) {
+        it = map.emplace(object.get_id(), NamedHistogram()).first;
+        // There is no other way to get class name. Only done once per type.
+        std::string description = td::td_api::to_string(object);
+        it->second.name = description.substr(0, description.find_first_of(" \n"));
+    }
+    return it->second;
+}
+
+void TransceiverStats::querySent(uint64_t queryId, const td::td_api::Function &function, gint64 now)
+{
+    getHistogram(m_functionLatency, function);
+    SentQuery &slot = m_sentQueries[queryId & (SENT_QUERY_SLOTS-1)];
+    slot.queryId    = queryId;
+    slot.functionId = function.get_id();
+    slot.sentAt     = now;
+}
+
+void TransceiverStats::responseDispatched(uint64_t queryId, gint64 now)
+{
+    SentQuery &slot = m_sentQueries[queryId & (SENT_QUERY_SLOTS-1)];
+    if (slot.queryId != queryId)
+        return;
+
+    auto it = m_functionLatency.find(slot.functionId);
+    if (it != m_functionLatency.end())
+        it->second.histogram.add(now - slot.sentAt);
+    slot.queryId = 0;
+}
+
+void TransceiverStats::responseDequeued(gint64 queuedAt, gint64 now)
+{
+    m_handoffLag.add(now - queuedAt);
+}
+
+void TransceiverStats::queueDepth(size_t depth)
+{
+    // Only one thread ever updates this, so no need for compare-exchange
+    if (depth > m_maxQueueDepth.load(std::memory_order_relaxed))
+        m_maxQueueDepth.store(depth, std::memory_order_relaxed);
+}
+
+void TransceiverStats::updateHandled(const td::td_api::Object &update, gint64 duration)
+{
+    getHistogram(m_updateHandlerTime, update).histogram.add(duration);
+}
+
+void TransceiverStats::dispatchYielded(size_t backlog, gint64 oldestQueuedAt, gint64 now)
+{
+    m_dispatchYields++;
+    m_maxBacklog     = std::max(m_maxBacklog, backlog);
+    m_maxBacklogWait = std::max(m_maxBacklogWait, now - oldestQueuedAt);
+}
+
+std::string TransceiverStats::toJson(size_t currentQueueDepth, size_t queueCapacity) const
+{
+    std::string out;
+    out += "{\"uptime_ms\":" + std::to_string((g_get_monotonic_time() - m_startTime) / 1000);
+    out += ",\"queue\":{\"depth\":" + std::to_string(currentQueueDepth);
+    out += ",\"max_depth\":" + std::to_string(m_maxQueueDepth.load(std::memory_order_relaxed));
+    out += ",\"capacity\":" + std::to_string(queueCapacity);
+    out += "},\"dispatch_budget\":{\"yields\":" + std::to_string(m_dispatchYields);
+    out += ",\"max_backlog\":" + std::to_string(m_maxBacklog);
+    out += ",\"max_backlog_wait_us\":" + std::to_string(m_maxBacklogWait);
+    out += "},\"handoff_lag\":";
+    m_handoffLag.appendJson(out);
+
+    const std::pair<const char *, const std::unordered_map<int32_t, NamedHistogram> *> sections[] = {
+        {"function_latency", &m_functionLatency},
+        {"update_handler_time", &m_updateHandlerTime}
+    };
+    for (const auto &section: sections) {
+        out += ",\"";
+        out += section.first;
+        out += "\":{";
+        bool first = true;
+        for (const auto &entry: *section.second) {
+            if (entry.second.histogram.count() == 0)
+                continue;
+            if (!first)
+                out += ',';
+            first = false;
+            // Class names need no escaping
+            out += '"' + entry.second.name + "\":";
+            entry.second.histogram.appendJson(out);
+        }
+        out += '}';
+    }
+    out += '}';
+
+    return out;
+}
@@ -0,0 +1,82 @@
+#ifndef _TRANSCEIVER_STATS_H
+#define _TRANSCEIVER_STATS_H
+
+#include <td/telegram/td_api.h>
+#include <purple.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Histogram of durations in microseconds, with power-of-two buckets: bucket 0 counts durations
+// below 1us, bucket n counts [2^(n-1), 2^n) and the last one counts everything longer
+class LatencyHistogram {
+public:
+    enum {
+        BUCKETS = 28 // last bucket starts at ~67 seconds
+    };
+
+    LatencyHistogram();
+    void     add(gint64 microseconds);
+    uint64_t count() const { return m_count; }
+    // Upper bound of the bucket containing given percentile
+    gint64   percentile(unsigned percent) const;
+    void     appendJson(std::string &out) const;
+private:
+    uint64_t m_buckets[BUCKETS];
+    uint64_t m_count;
+    gint64   m_sum;
+    gint64   m_max;
+};
+
+// Timing statistics collected by TdTransceiver. Everything except queue depth is only touched
+// from main thread.
+class TransceiverStats {
+public:
+    TransceiverStats();
+
+    void        querySent(uint64_t queryId, const td::td_api::Function &function, gint64 now);
+    void        responseDispatched(uint64_t queryId, gint64 now);
+    // Time from poll thread receiving a response to main thread picking it up
+    void        responseDequeued(gint64 queuedAt, gint64 now);
+    // Called from poll thread
+    void        queueDepth(size_t depth);
+    void        updateHandled(const td::td_api::Object &update, gint64 duration);
+    // Dispatch budget ran out with backlog responses still queued, the oldest since oldestQueuedAt
+    void        dispatchYielded(size_t backlog, gint64 oldestQueuedAt, gint64 now);
+
+    // Single-line JSON object
+    std::string toJson(size_t currentQueueDepth, size_t queueCapacity) const;
+private:
+    enum {
+        // Queries still outstanding after this many newer ones are sent don't get their latency counted
+        SENT_QUERY_SLOTS = 4096
+    };
+
+    struct SentQuery {
+        uint64_t queryId;
+        int32_t  functionId;
+        gint64   sentAt;
+    };
+
+    struct NamedHistogram {
+        std::string      name;
+        LatencyHistogram histogram;
+    };
+
+    gint64                                     m_startTime;
+    std::vector<SentQuery>                     m_sentQueries;
+    std::unordered_map<int32_t, NamedHistogram> m_functionLatency;
+    std::unordered_map<int32_t, NamedHistogram> m_updateHandlerTime;
+    LatencyHistogram                           m_handoffLag;
+    std::atomic<size_t>                        m_maxQueueDepth;
+    uint64_t                                   m_dispatchYields;
+    size_t                                     m_maxBacklog;
+    gint64                                     m_maxBacklogWait;
+
+    static NamedHistogram &getHistogram(std::unordered_map<int32_t, NamedHistogram> &map,
+                                        const td::td_api::Object &object);
+};
+
+#endif
@@ -1,82 +1,759 @@
 #include "transceiver.h"
+#include "transceiver-stats.h"
+#include "session-recording.h"
 #include "config.h"
 #include "purple-info.h"
 #include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <condition_variable>
+#include <stdlib.h>
 #include <assert.h>
 
-struct TimerCallbackData {
-    TdTransceiver             *m_transceiver;
-    uint64_t                   requestId;
+ResponseHandler::ResponseHandler(const ResponseHandler &other)
+:   m_ops(other.m_ops)
+{
+    if (m_ops)
+        m_ops->copy(other.m_storage, m_storage);
+}
+
+ResponseHandler::ResponseHandler(ResponseHandler &&other) noexcept
+:   m_ops(other.m_ops)
+{
+    if (m_ops) {
+        m_ops->move(other.m_storage, m_storage);
+        other.m_ops = nullptr;
+    }
+}
+
+ResponseHandler &ResponseHandler::operator=(const ResponseHandler &other)
+{
+    if (this != &other) {
+        ResponseHandler copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+ResponseHandler &ResponseHandler::operator=(ResponseHandler &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        if (other.m_ops) {
+            other.m_ops->move(other.m_storage, m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+    return *this;
+}
+
+void ResponseHandler::operator()(uint64_t requestId, TdObjectPtr object) const
+{
+    if (!m_ops)
+        throw std::bad_function_call();
+    m_ops->invoke(m_storage, requestId, std::move(object));
+}
+
+void ResponseHandler::reset()
+{
+    if (m_ops) {
+        m_ops->destroy(m_storage);
+        m_ops = nullptr;
+    }
+}
+
+enum {
+    // Power of 2
+    HANDLER_TABLE_INITIAL_SIZE = 64
+};
+
+ResponseHandlerTable::ResponseHandlerTable()
+:   m_slots(HANDLER_TABLE_INITIAL_SIZE),
+    m_count(0)
+{
+    for (Slot &slot: m_slots)
+        slot.requestId = 0;
+}
+
+void ResponseHandlerTable::insert(uint64_t requestId, ResponseHandler &&handler)
+{
+    if (requestId == 0)
+        return;
+    erase(requestId);
+
+    // Keeps collisions rare as long as outstanding requests span less than half the table
+    if (2 * (m_count + 1) > m_slots.size())
+        grow();
+
+    Slot &slot = m_slots[requestId & (m_slots.size() - 1)];
+    if (slot.requestId == 0) {
+        slot.requestId = requestId;
+        slot.handler   = std::move(handler);
+    } else
+        m_overflow.emplace(requestId, std::move(handler));
+    m_count++;
+}
+
+bool ResponseHandlerTable::extract(uint64_t requestId, ResponseHandler &handler)
+{
+    Slot &slot = m_slots[requestId & (m_slots.size() - 1)];
+    if ((slot.requestId == requestId) && (requestId != 0)) {
+        handler = std::move(slot.handler);
+        slot.requestId = 0;
+        m_count--;
+        return true;
+    }
+
+    if (m_overflow.empty())
+        return false;
+    auto it = m_overflow.find(requestId);
+    if (it == m_overflow.end())
+        return false;
+    handler = std::move(it->second);
+    m_overflow.erase(it);
+    m_count--;
+    return true;
+}
+
+bool ResponseHandlerTable::erase(uint64_t requestId)
+{
+    ResponseHandler handler;
+    return extract(requestId, handler);
+}
+
+void ResponseHandlerTable::grow()
+{
+    std::vector<Slot> oldSlots(m_slots.size() * 2);
+    oldSlots.swap(m_slots);
+    std::unordered_map<uint64_t, ResponseHandler> oldOverflow;
+    oldOverflow.swap(m_overflow);
+
+    for (Slot &slot: m_slots)
+        slot.requestId = 0;
+    m_count = 0;
+
+    for (Slot &slot: oldSlots)
+        if (slot.requestId != 0)
+            insert(slot.requestId, std::move(slot.handler));
+    for (auto &entry: oldOverflow)
+        insert(entry.first, std::move(entry.second));
+}
+
+enum {
+    TIMER_TICK_MS     = 250,
+    // Power of 2. Timers further away than this many ticks just stay in their slot for extra rounds
+    TIMER_WHEEL_SLOTS = 256
+};
+
+struct TimerInfo {
+    uint64_t                   expiryTick;
     TdTransceiver::ResponseCb2 callback;
     bool                       cancelResponse;
 };
 
-struct TimerInfo {
-    guint                              timerId;
-    std::unique_ptr<TimerCallbackData> data;
+struct QueuedResponse {
+    td::Client::Response response;
+    gint64               queuedAt; // monotonic time, microseconds
+    uint64_t             sequence; // arrival order
+};
+
+// Bounded single-producer single-consumer queue between poll thread (producer) and glib main
+// thread (consumer). Slots are allocated once, so passing a response through it does not allocate.
+class ResponseRing {
+public:
+    enum {
+        CAPACITY = 8192 // Must be a power of 2
+    };
+
+    ResponseRing() : m_slots(CAPACITY), m_head(0), m_tail(0) {}
+    bool   push(td::Client::Response &response, gint64 queuedAt);
+    bool   pop(QueuedResponse &entry);
+    bool   empty() const;
+    size_t size() const;
+    gint64 frontQueuedAt() const;
+private:
+    std::vector<QueuedResponse>       m_slots;
+    // Free-running counters, slot index is counter modulo CAPACITY.
+    // m_head is only written by consumer, m_tail only by producer.
+    std::atomic<size_t>               m_head;
+    std::atomic<size_t>               m_tail;
+};
+
+// Returns false without touching the response if the ring is full
+bool ResponseRing::push(td::Client::Response &response, gint64 queuedAt)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == CAPACITY)
+        return false;
+    QueuedResponse &slot = m_slots[tail & (CAPACITY-1)];
+    slot.response = std::move(response);
+    slot.queuedAt = queuedAt;
+    slot.sequence = tail;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool ResponseRing::pop(QueuedResponse &entry)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+        return false;
+    QueuedResponse &slot = m_slots[head & (CAPACITY-1)];
+    entry.response = std::move(slot.response);
+    entry.queuedAt = slot.queuedAt;
+    entry.sequence = slot.sequence;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool ResponseRing::empty() const
+{
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+}
+
+size_t ResponseRing::size() const
+{
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+// Consumer only. Returns 0 if the ring is empty
+gint64 ResponseRing::frontQueuedAt() const
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+        return 0;
+    return m_slots[head & (CAPACITY-1)].queuedAt;
+}
+
+// Updates which replace some state as a whole, so that only the last one of several for the
+// same object matters
+enum CoalescedUpdate {
+    COALESCED_USER,
+    COALESCED_USER_STATUS,
+    COALESCED_CHAT_POSITION,
+    COALESCED_CHAT_TITLE,
+    COALESCED_FILE,
+    COALESCED_UPDATE_TYPES
+};
+
+static const char *const coalescedUpdateNames[COALESCED_UPDATE_TYPES] = {
+    "user", "user status", "chat position", "chat title", "file"
 };
 
+struct CoalesceKey {
+    int     type;  // CoalescedUpdate
+    int64_t id;
+    int64_t subId;
+    size_t  index; // position in the batch
+
+    bool operator<(const CoalesceKey &other) const
+    {
+        if (type != other.type) return (type < other.type);
+        if (id != other.id) return (id < other.id);
+        if (subId != other.subId) return (subId < other.subId);
+        return (index < other.index);
+    }
+    bool sameObject(const CoalesceKey &other) const
+    {
+        return (type == other.type) && (id == other.id) && (subId == other.subId);
+    }
+};
+
+static bool getCoalesceKey(const td::td_api::Object &update, CoalesceKey &key)
+{
+    key.subId = 0;
+    switch (update.get_id()) {
+    case td::td_api::updateUser::ID: {
+        auto &userUpdate = static_cast<const td::td_api::updateUser &>(update);
+        if (!userUpdate.user_) return false;
+        key.type = COALESCED_USER;
+        key.id   = userUpdate.user_->id_;
+        return true;
+    }
+    case td::td_api::updateUserStatus::ID:
+        key.type = COALESCED_USER_STATUS;
+        key.id   = static_cast<const td::td_api::updateUserStatus &>(update).user_id_;
+        return true;
+    case td::td_api::updateChatPosition::ID: {
+        auto &positionUpdate = static_cast<const td::td_api::updateChatPosition &>(update);
+        if (!positionUpdate.position_ || !positionUpdate.position_->list_) return false;
+        // Positions in different chat lists are independent
+        const td::td_api::ChatList &list = *positionUpdate.position_->list_;
+        key.type  = COALESCED_CHAT_POSITION;
+        key.id    = positionUpdate.chat_id_;
+        key.subId = list.get_id();
+        if (list.get_id() == td::td_api::chatListFilter::ID)
+            key.subId ^= (int64_t)static_cast<const td::td_api::chatListFilter &>(list).chat_filter_id_ << 32;
+        return true;
+    }
+    case td::td_api::updateChatTitle::ID:
+        key.type = COALESCED_CHAT_TITLE;
+        key.id   = static_cast<const td::td_api::updateChatTitle &>(update).chat_id_;
+        return true;
+    case td::td_api::updateFile::ID: {
+        auto &fileUpdate = static_cast<const td::td_api::updateFile &>(update);
+        if (!fileUpdate.file_) return false;
+        key.type = COALESCED_FILE;
+        key.id   = fileUpdate.file_->id_;
+        return true;
+    }
+    }
+    return false;
+}
+
+// Dispatch priority classes. Responses, new messages and other state updates can depend on each
+// other (e.g. updateNewChat or updateUser must be processed before anything referring to that
+// chat or user), so those keep their relative order. Presence and file progress updates only
+// refresh state of existing objects and can be postponed while there is more important work.
+enum ResponseLane {
+    LANE_INTERACTIVE,
+    LANE_MESSAGES,
+    LANE_STATE,
+    LANE_PRESENCE,
+    LANE_COUNT
+};
+
+enum {
+    // When priority lanes are enabled, at least one postponed update is dispatched for every
+    // PRESENCE_LANE_SHARE other responses, and none waits longer than PRESENCE_LANE_MAX_WAIT_MS
+    PRESENCE_LANE_SHARE       = 8,
+    PRESENCE_LANE_MAX_WAIT_MS = 2000
+};
+
+static const char *const laneNames[LANE_COUNT] = {
+    "interactive", "messages", "state", "presence"
+};
+
+static ResponseLane getResponseLane(const td::Client::Response &response)
+{
+    if (response.id != 0)
+        return LANE_INTERACTIVE;
+    if (!response.object)
+        return LANE_STATE;
+
+    switch (response.object->get_id()) {
+    case td::td_api::updateNewMessage::ID:
+    case td::td_api::updateMessageSendSucceeded::ID:
+    case td::td_api::updateMessageSendFailed::ID:
+        return LANE_MESSAGES;
+    case td::td_api::updateUserStatus::ID:
+    case td::td_api::updateUserChatAction::ID:
+    case td::td_api::updateFile::ID:
+        return LANE_PRESENCE;
+    default:
+        return LANE_STATE;
+    }
+}
+
 // This class is used to share ownership of its instances between TdTransceiver and glib idle
 // function queue. This way, those idle functions can be called safely after TdTransceiver is
 // destroyed.
-class TdTransceiverImpl {
+class TdTransceiverImpl: public std::enable_shared_from_this<TdTransceiverImpl> {
 public:
     TdTransceiverImpl(PurpleTdClient *owner, TdTransceiver::UpdateCb updateCb, ITransceiverBackend *testBackend);
     ~TdTransceiverImpl();
-    static int rxCallback(void *user_data);
-    void       cancelTimer(uint64_t requestId);
+    static int   rxCallback(void *user_data);
+    static void *scheduleDispatch(const std::shared_ptr<TdTransceiverImpl> &self);
+    bool         queueResponse(td::Client::Response &response);
+    static void  deliverResponse(const std::shared_ptr<TdTransceiverImpl> &self,
+                                 td::Client::Response &response, const std::atomic_bool &stop);
+    static bool  tryDeliverResponse(const std::shared_ptr<TdTransceiverImpl> &self,
+                                    td::Client::Response &response);
+    bool         dispatchResponses();
+    bool         nextLanedResponse(QueuedResponse &entry);
+    bool         nextResponse(QueuedResponse &entry);
+    bool         isStalePresenceUpdate(const QueuedResponse &entry) const;
+    bool         hasQueuedResponses() const;
+    gint64       oldestQueuedAt() const;
+    void         fillBatch();
+    void         recordArrival(const QueuedResponse &entry);
+    void         dispatchResponse(td::Client::Response &response, gint64 now);
+    void         setTimer(uint64_t requestId, TdTransceiver::ResponseCb2 callback, unsigned timeoutSeconds,
+                          bool cancelResponse);
+    void         cancelTimer(uint64_t requestId);
+    void         cancelAllTimers();
+    static int   timerTick(void *user_data);
 
     PurpleTdClient                     *m_owner;
+    // Either m_client with a dedicated poll thread, or a client created by SharedReceiver
     std::unique_ptr<td::Client>         m_client;
+    td::ClientManager                  *m_clientManager;
+    td::ClientManager::ClientId         m_clientId;
+    // Set when TdTransceiver is being destroyed with SharedReceiver
+    std::atomic_bool                    m_closing;
     ITransceiverBackend                *m_testBackend;
 
-    // The mutex protects m_rxQueue and reference counters of all shared pointers to this object.
+    // Shared between poll thread and glib main thread. At most one idle callback is pending at any
+    // time: whoever sets m_dispatchPending from false to true also stores a reference to this object
+    // in m_dispatchRef, and rxCallback moves it out before clearing m_dispatchPending.
     // All other members are only used from the glib main thread
-    std::mutex                          m_rxMutex;
-    std::vector<td::Client::Response>   m_rxQueue;
+    ResponseRing                        m_rxQueue;
+    std::atomic_bool                    m_dispatchPending;
+    std::shared_ptr<TdTransceiverImpl>  m_dispatchRef;
 
     TdTransceiver::UpdateCb             m_updateCb;
+    // 0 means unlimited
+    unsigned                            m_dispatchTimeBudgetMs;
+    unsigned                            m_dispatchItemBudget;
+
+    // When coalescing is enabled, responses are taken from the ring in batches of whatever has
+    // accumulated, and superseded updates are dropped from each batch before dispatching it
+    bool                                m_coalesceUpdates;
+    std::vector<QueuedResponse>         m_batch;
+    size_t                              m_batchPos;
+    std::vector<CoalesceKey>            m_coalesceKeys;
+    // User id and original batch position of the last updateUser, for users whose updateUser
+    // contents got moved ahead in the batch
+    std::vector<std::pair<int64_t, size_t>> m_movedUsers;
+    uint64_t                            m_coalescedCount[COALESCED_UPDATE_TYPES];
+
+    // Priority lanes: presence and progress updates are set aside in m_presenceLane and
+    // dispatched when nothing else is queued, or when they've waited long enough
+    bool                                m_priorityLanes;
+    std::deque<QueuedResponse>          m_presenceLane;
+    unsigned                            m_dispatchedSincePresence;
+    // Arrival sequence of the last dispatched updateUser for every user, for dropping status updates
+    // that got older than that while postponed. Only maintained while m_presenceLane is not empty.
+    std::unordered_map<int64_t, uint64_t> m_userUpdateSequence;
+    uint64_t                            m_laneDispatched[LANE_COUNT];
+    gint64                              m_laneMaxWait[LANE_COUNT];
+
+    TransceiverStats                    m_stats;
+    std::unique_ptr<SessionRecorder>    m_recorder;
+
     uint64_t                                            m_lastQueryId;
-    std::map<std::uint64_t, TdTransceiver::ResponseCb2> m_responseHandlers;
-    std::vector<TimerInfo>                              m_timers;
+    ResponseHandlerTable                                m_responseHandlers;
+
+    // Query timeouts: one glib timer source ticking while there are any timeouts pending, and a
+    // timer wheel with slot = expiry tick modulo TIMER_WHEEL_SLOTS. Cancelled timers are only
+    // removed from m_timers, their ids are skipped when the slot comes up.
+    std::unordered_map<uint64_t, TimerInfo>             m_timers;
+    std::vector<std::vector<uint64_t>>                  m_timerWheel;
+    uint64_t                                            m_currentTick;
+    guint                                               m_tickSourceId;
 };
 
 TdTransceiverImpl::TdTransceiverImpl(PurpleTdClient *owner, TdTransceiver::UpdateCb updateCb,
                                      ITransceiverBackend *testBackend
 )
 :   m_owner(owner),
+    m_clientManager(nullptr),
+    m_clientId(0),
+    m_closing(false),
     m_testBackend(testBackend),
+    m_dispatchPending(false),
     m_updateCb(updateCb),
-    m_lastQueryId(0)
+    m_dispatchTimeBudgetMs(0),
+    m_dispatchItemBudget(0),
+    m_coalesceUpdates(false),
+    m_batchPos(0),
+    m_priorityLanes(false),
+    m_dispatchedSincePresence(0),
+    m_lastQueryId(0),
+    m_timerWheel(TIMER_WHEEL_SLOTS),
+    m_currentTick(0),
+    m_tickSourceId(0)
 {
-    if (!testBackend)
-        m_client = std::make_unique<td::Client>();
+    for (uint64_t &count: m_coalescedCount)
+        count = 0;
+    for (unsigned lane = 0; lane < LANE_COUNT; lane++) {
+        m_laneDispatched[lane] = 0;
+        m_laneMaxWait[lane]    = 0;
+    }
 }
 
 TdTransceiverImpl::~TdTransceiverImpl()
 {
+    if (m_coalesceUpdates)
+        for (unsigned i = 0; i < COALESCED_UPDATE_TYPES; i++)
+            purple_debug_misc(config::pluginId, "Dropped %" G_GUINT64_FORMAT " superseded %s updates\n",
+                              m_coalescedCount[i], coalescedUpdateNames[i]);
+    if (m_priorityLanes)
+        for (unsigned lane = 0; lane < LANE_COUNT; lane++)
+            purple_debug_misc(config::pluginId, "Lane %s: dispatched %" G_GUINT64_FORMAT
+                              ", longest wait %" G_GINT64_FORMAT " ms\n", laneNames[lane],
+                              m_laneDispatched[lane], m_laneMaxWait[lane] / 1000);
     purple_debug_misc(config::pluginId, "Destroyed TdTransceiverImpl\n");
 }
 
+void TdTransceiverImpl::setTimer(uint64_t requestId, TdTransceiver::ResponseCb2 callback,
+                                 unsigned timeoutSeconds, bool cancelResponse)
+{
+    // Timer started between two ticks must not expire early, hence + 1
+    uint64_t expiryTick = m_currentTick + timeoutSeconds * (1000 / TIMER_TICK_MS) + 1;
+
+    TimerInfo &timer     = m_timers[requestId];
+    timer.expiryTick     = expiryTick;
+    timer.callback       = std::move(callback);
+    timer.cancelResponse = cancelResponse;
+    m_timerWheel[expiryTick % TIMER_WHEEL_SLOTS].push_back(requestId);
+
+    if (m_tickSourceId == 0) {
+        if (!m_testBackend)
+            m_tickSourceId = g_timeout_add(TIMER_TICK_MS, timerTick, this);
+        else
+            m_tickSourceId = m_testBackend->addTimeout(TIMER_TICK_MS, timerTick, this);
+    }
+}
+
 void TdTransceiverImpl::cancelTimer(uint64_t requestId)
 {
-    auto pTimer = std::find_if(m_timers.begin(), m_timers.end(),
-                               [requestId](const TimerInfo &timer) { return (timer.data->requestId == requestId); });
-    if (pTimer != m_timers.end()) {
+    m_timers.erase(requestId);
+}
+
+void TdTransceiverImpl::cancelAllTimers()
+{
+    if (m_tickSourceId != 0) {
         if (!m_testBackend)
-            g_source_remove(pTimer->timerId);
+            g_source_remove(m_tickSourceId);
         else
-            m_testBackend->cancelTimer(pTimer->timerId);
-        m_timers.erase(pTimer);
+            m_testBackend->cancelTimer(m_tickSourceId);
+        m_tickSourceId = 0;
+    }
+    m_timers.clear();
+    for (std::vector<uint64_t> &slot: m_timerWheel)
+        slot.clear();
+}
+
+int TdTransceiverImpl::timerTick(gpointer user_data)
+{
+    // Timeout callbacks may destroy TdTransceiver
+    std::shared_ptr<TdTransceiverImpl> self = static_cast<TdTransceiverImpl *>(user_data)->shared_from_this();
+    uint64_t              tick = ++self->m_currentTick;
+    std::vector<uint64_t> slot;
+    slot.swap(self->m_timerWheel[tick % TIMER_WHEEL_SLOTS]);
+
+    for (uint64_t requestId: slot) {
+        auto it = self->m_timers.find(requestId);
+        if ((it == self->m_timers.end()) || (it->second.expiryTick % TIMER_WHEEL_SLOTS != tick % TIMER_WHEEL_SLOTS))
+            continue; // cancelled, or re-armed into a different slot
+        if (it->second.expiryTick > tick) {
+            // Not this round yet
+            self->m_timerWheel[tick % TIMER_WHEEL_SLOTS].push_back(requestId);
+            continue;
+        }
+
+        TimerInfo timer = std::move(it->second);
+        self->m_timers.erase(it);
+        timer.callback(requestId, nullptr);
+        if (timer.cancelResponse)
+            self->m_responseHandlers.erase(requestId);
+    }
+
+    if (self->m_timers.empty()) {
+        // Also drops any leftover cancelled entries
+        for (std::vector<uint64_t> &wheelSlot: self->m_timerWheel)
+            wheelSlot.clear();
+        self->m_tickSourceId = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static bool isClosedUpdate(const td::td_api::Object &object)
+{
+    if (object.get_id() == td::td_api::updateAuthorizationState::ID) {
+        auto &authState = static_cast<const td::td_api::updateAuthorizationState &>(object);
+        return authState.authorization_state_ && (authState.authorization_state_->get_id() ==
+                                                  td::td_api::authorizationStateClosed::ID);
+    }
+    return false;
+}
+
+// Alternative to a poll thread per account, for processes hosting many accounts: clients are
+// created through a few td::ClientManager instances ("shards"), each polled by a single thread
+// which routes responses to TdTransceiverImpl by client id.
+// The instance is never destroyed, since poll threads keep running until process exit.
+class SharedReceiver {
+public:
+    static SharedReceiver &instance();
+    void addClient(const std::shared_ptr<TdTransceiverImpl> &impl);
+    // Sends close request and waits until the client is closed, after which no more responses
+    // will be delivered to impl
+    void closeClient(TdTransceiverImpl &impl);
+private:
+    enum {
+        MAX_SHARDS = 64
+    };
+
+    // Responses for a client whose queue was full. Main thread of one client being behind must
+    // not hold up the others, and it may even be waiting in closeClient for another client.
+    struct ParkedResponses {
+        std::shared_ptr<TdTransceiverImpl> impl;
+        std::deque<td::Client::Response>   responses;
+    };
+
+    struct Shard {
+        td::ClientManager                                      manager;
+        std::thread                                            thread;
+        std::mutex                                             mutex;
+        std::condition_variable                                clientClosed;
+        std::unordered_map<td::ClientManager::ClientId,
+                           std::shared_ptr<TdTransceiverImpl>> clients;
+        // Only used by poll thread
+        std::unordered_map<td::ClientManager::ClientId, ParkedResponses> parked;
+    };
+
+    std::mutex                          m_mutex;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+
+    SharedReceiver();
+    Shard &findShard(const td::ClientManager *manager);
+    void pollLoop(Shard &shard);
+    void deliverParked(Shard &shard);
+};
+
+SharedReceiver::SharedReceiver()
+{
+    // Number of poll threads is process-wide, so it can't be an account option
+    unsigned    threadCount = 1;
+    const char *setting     = getenv("TDLIB_PURPLE_POLL_THREADS");
+    if (setting && (atoi(setting) > 0))
+        threadCount = std::min(atoi(setting), (int)MAX_SHARDS);
+
+    for (unsigned i = 0; i < threadCount; i++)
+        m_shards.push_back(std::make_unique<Shard>());
+}
+
+SharedReceiver &SharedReceiver::instance()
+{
+    static SharedReceiver *receiver = new SharedReceiver;
+    return *receiver;
+}
+
+SharedReceiver::Shard &SharedReceiver::findShard(const td::ClientManager *manager)
+{
+    for (std::unique_ptr<Shard> &shard: m_shards)
+        if (&shard->manager == manager)
+            return *shard;
+    assert(0);
+    return *m_shards.front();
+}
+
+void SharedReceiver::addClient(const std::shared_ptr<TdTransceiverImpl> &impl)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Least busy shard
+    Shard  *shard       = nullptr;
+    size_t  clientCount = 0;
+    for (std::unique_ptr<Shard> &candidate: m_shards) {
+        std::unique_lock<std::mutex> shardLock(candidate->mutex);
+        if (!shard || (candidate->clients.size() < clientCount)) {
+            shard       = candidate.get();
+            clientCount = candidate->clients.size();
+        }
+    }
+
+    {
+        // Holding the lock so that poll thread doesn't see responses for the new client before it
+        // gets registered
+        std::unique_lock<std::mutex> shardLock(shard->mutex);
+        impl->m_clientManager = &shard->manager;
+        impl->m_clientId      = shard->manager.create_client();
+        shard->clients[impl->m_clientId] = impl;
+    }
+
+    if (!shard->thread.joinable())
+        shard->thread = std::thread([this, shard]() { pollLoop(*shard); });
+}
+
+void SharedReceiver::closeClient(TdTransceiverImpl &impl)
+{
+    Shard &shard = findShard(impl.m_clientManager);
+    impl.m_closing = true;
+    shard.manager.send(impl.m_clientId, UINT64_MAX, td::td_api::make_object<td::td_api::close>());
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.clientClosed.wait(lock, [&shard, &impl]() {
+        return (shard.clients.find(impl.m_clientId) == shard.clients.end());
+    });
+}
+
+void SharedReceiver::deliverParked(Shard &shard)
+{
+    for (auto it = shard.parked.begin(); it != shard.parked.end();) {
+        ParkedResponses &parked = it->second;
+        // If closing, main thread doesn't care about the rest
+        while (!parked.responses.empty() && !parked.impl->m_closing &&
+               TdTransceiverImpl::tryDeliverResponse(parked.impl, parked.responses.front()))
+        {
+            parked.responses.pop_front();
+        }
+
+        if (parked.responses.empty() || parked.impl->m_closing)
+            it = shard.parked.erase(it);
+        else
+            ++it;
+    }
+}
+
+void SharedReceiver::pollLoop(Shard &shard)
+{
+    while (1) {
+        // Don't wait long for new responses while some are waiting for room in a queue
+        td::ClientManager::Response managerResponse = shard.manager.receive(shard.parked.empty() ? 1 : 0.001);
+        deliverParked(shard);
+        if (!managerResponse.object)
+            continue;
+
+        if (isClosedUpdate(*managerResponse.object)) {
+            // Last response for this client
+            shard.parked.erase(managerResponse.client_id);
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.clients.erase(managerResponse.client_id);
+            shard.clientClosed.notify_all();
+            continue;
+        }
+
+        std::shared_ptr<TdTransceiverImpl> impl;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.clients.find(managerResponse.client_id);
+            if (it != shard.clients.end())
+                impl = it->second;
+        }
+        if (!impl || impl->m_closing)
+            continue;
+
+        td::Client::Response response{managerResponse.request_id, std::move(managerResponse.object)};
+        // Responses already parked for the client go first
+        auto parked = shard.parked.find(managerResponse.client_id);
+        if (parked != shard.parked.end())
+            parked->second.responses.push_back(std::move(response));
+        else if (!TdTransceiverImpl::tryDeliverResponse(impl, response)) {
+            ParkedResponses &newParked = shard.parked[managerResponse.client_id];
+            newParked.impl = impl;
+            newParked.responses.push_back(std::move(response));
+        }
     }
 }
 
 TdTransceiver::TdTransceiver(PurpleTdClient *owner, PurpleAccount *account, UpdateCb updateCb,
                              ITransceiverBackend *testBackend)
 :   m_account(account),
-    m_stopThread(false)
+    m_stopThread(false),
+    m_statsTimer(0)
 {
     m_impl = std::make_shared<TdTransceiverImpl>(owner, updateCb, testBackend);
+    m_impl->m_dispatchTimeBudgetMs = getDispatchTimeBudgetMs(account);
+    m_impl->m_dispatchItemBudget   = getDispatchItemBudget(account);
+    m_impl->m_coalesceUpdates      = purple_account_get_bool(account, AccountOptions::CoalesceUpdates,
+                                                             AccountOptions::CoalesceUpdatesDefault);
+    m_impl->m_priorityLanes        = purple_account_get_bool(account, AccountOptions::PrioritizeMessages,
+                                                             AccountOptions::PrioritizeMessagesDefault);
+
+    unsigned statsInterval = getStatisticsInterval(account);
+
+    const char *recordingPath = purple_account_get_string(account, AccountOptions::RecordSessionFile,
+                                                          AccountOptions::RecordSessionFileDefault);
+    if (recordingPath && *recordingPath) {
+        m_impl->m_recorder = std::make_unique<SessionRecorder>();
+        if (!m_impl->m_recorder->open(recordingPath))
+            m_impl->m_recorder.reset();
+    }
 
     if (testBackend) {
         m_testBackend = testBackend;
@@ -92,22 +769,38 @@ TdTransceiver::TdTransceiver(PurpleTdClient *owner, PurpleAccount *account, Upda
             g_thread_init(NULL);
 #endif
 
-        m_pollThread = std::thread([this]() { pollThreadLoop(); });
+        if (purple_account_get_bool(account, AccountOptions::SharedPollThread,
+                                    AccountOptions::SharedPollThreadDefault))
+        {
+            SharedReceiver::instance().addClient(m_impl);
+        } else {
+            m_impl->m_client = std::make_unique<td::Client>();
+            m_pollThread = std::thread([this]() { pollThreadLoop(); });
+        }
+    }
+
+    if (statsInterval != 0) {
+        if (m_testBackend)
+            m_statsTimer = m_testBackend->addTimeout(statsInterval*1000, logStatistics, this);
+        else
+            m_statsTimer = g_timeout_add_seconds(statsInterval, logStatistics, this);
     }
 }
 
 TdTransceiver::~TdTransceiver()
 {
-    for (const TimerInfo &timer: m_impl->m_timers) {
-        if (!m_testBackend)
-            g_source_remove(timer.timerId);
+    m_impl->cancelAllTimers();
+    if (m_statsTimer != 0) {
+        if (m_testBackend)
+            m_testBackend->cancelTimer(m_statsTimer);
         else
-            m_testBackend->cancelTimer(timer.timerId);
+            g_source_remove(m_statsTimer);
     }
-    m_impl->m_timers.clear();
 
     m_stopThread = true;
-    if (!m_testBackend) {
+    if (m_impl->m_clientManager)
+        SharedReceiver::instance().closeClient(*m_impl);
+    else if (!m_testBackend) {
         m_impl->m_client->send({UINT64_MAX, td::td_api::make_object<td::td_api::close>()});
         m_pollThread.join();
     }
@@ -117,16 +810,93 @@ TdTransceiver::~TdTransceiver()
     // m_impl->m_owner gets set to NULL), and only then with TdTransceiverImpl instance be destroyed
     m_impl->m_owner = nullptr;
 
-    // Since poll thread is no longer running, there is no need to lock the mutex before decrementing
-    // shared pointer reference count
+    // Since poll thread is no longer running (or, with SharedReceiver, has dropped its reference),
+    // there is no need to lock the mutex before decrementing shared pointer reference count
     m_impl.reset();
     purple_debug_misc(config::pluginId, "Destroyed TdTransceiver\n");
 }
 
-void *TdTransceiver::queueResponse(td::Client::Response &&response)
+bool TdTransceiver::queueResponse(td::Client::Response &response)
+{
+    return m_impl->queueResponse(response);
+}
+
+bool TdTransceiverImpl::queueResponse(td::Client::Response &response)
+{
+    if (!m_rxQueue.push(response, g_get_monotonic_time()))
+        return false;
+    m_stats.queueDepth(m_rxQueue.size());
+    return true;
+}
+
+// Called from poll thread
+void TdTransceiverImpl::deliverResponse(const std::shared_ptr<TdTransceiverImpl> &self,
+                                        td::Client::Response &response, const std::atomic_bool &stop)
+{
+    while (!tryDeliverResponse(self, response)) {
+        // Main thread is behind. Idle callback is necessarily pending since the queue is
+        // not empty, so just wait for it to make room. If we're shutting down, main thread
+        // is waiting for us instead, and the response would be ignored anyway.
+        if (stop)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// Called from poll thread. Returns false without touching the response if the queue is full.
+bool TdTransceiverImpl::tryDeliverResponse(const std::shared_ptr<TdTransceiverImpl> &self,
+                                           td::Client::Response &response)
+{
+    if (!self->queueResponse(response))
+        return false;
+
+    void *implRef = scheduleDispatch(self);
+    if (implRef)
+        g_idle_add(rxCallback, implRef);
+    return true;
+}
+
+std::string TdTransceiver::getStatistics() const
+{
+    return m_impl->m_stats.toJson(m_impl->m_rxQueue.size(), ResponseRing::CAPACITY);
+}
+
+guint TdTransceiver::addTimeout(guint interval, GSourceFunc function, gpointer data)
+{
+    if (m_testBackend)
+        return m_testBackend->addTimeout(interval, function, data);
+    else
+        return g_timeout_add(interval, function, data);
+}
+
+void TdTransceiver::cancelTimeout(guint id)
+{
+    if (m_testBackend)
+        m_testBackend->cancelTimer(id);
+    else
+        g_source_remove(id);
+}
+
+int TdTransceiver::logStatistics(gpointer user_data)
+{
+    TdTransceiver *self = static_cast<TdTransceiver *>(user_data);
+    purple_debug_info(config::pluginId, "Transceiver statistics for %s: %s\n",
+                      purple_account_get_username(self->m_account), self->getStatistics().c_str());
+    return TRUE; // keep the timer running
+}
+
+void *TdTransceiver::scheduleDispatch()
 {
-    m_impl->m_rxQueue.push_back(std::move(response));
-    return new std::shared_ptr<TdTransceiverImpl>(m_impl);
+    return TdTransceiverImpl::scheduleDispatch(m_impl);
+}
+
+// Returns user data for a new rxCallback invocation, or NULL if one is already pending
+void *TdTransceiverImpl::scheduleDispatch(const std::shared_ptr<TdTransceiverImpl> &self)
+{
+    if (self->m_dispatchPending.exchange(true))
+        return nullptr;
+    self->m_dispatchRef = self;
+    return self.get();
 }
 
 void TdTransceiver::pollThreadLoop()
@@ -135,77 +905,280 @@ void TdTransceiver::pollThreadLoop()
         td::Client::Response response = m_impl->m_client->receive(1);
 
         if (response.object) {
-            if (response.object->get_id() == td::td_api::updateAuthorizationState::ID) {
-                auto &authState = static_cast<const td::td_api::updateAuthorizationState &>(*response.object);
-                if (authState.authorization_state_ && (authState.authorization_state_->get_id() ==
-                    td::td_api::authorizationStateClosed::ID))
-                {
-                    break;
-                }
-            }
-            // Passing shared pointer through glib event queue using pointer to pointer seems funky,
-            // but it works
-            void *implRef;
+            if (isClosedUpdate(*response.object))
+                break;
+            TdTransceiverImpl::deliverResponse(m_impl, response, m_stopThread);
+        }
+    }
+}
+
+int TdTransceiverImpl::rxCallback(gpointer user_data)
+{
+    // Keeps this object alive until we return, even if TdTransceiver gets destroyed meanwhile.
+    // Anything queued after m_dispatchPending is cleared will either be picked up by
+    // dispatchResponses or schedule another callback.
+    std::shared_ptr<TdTransceiverImpl> self = std::move(static_cast<TdTransceiverImpl *>(user_data)->m_dispatchRef);
+    self->m_dispatchPending = false;
+
+    if (!self->dispatchResponses()) {
+        // Out of budget - let the main loop handle other events before continuing. Tests have no
+        // main loop and continue from runTimeouts instead.
+        void *implRef = scheduleDispatch(self);
+        if (implRef) {
+            if (self->m_testBackend)
+                self->m_testBackend->addTimeout(0, rxCallback, implRef);
+            else
+                g_idle_add(rxCallback, implRef);
+        }
+    }
+
+    return FALSE; // This idle handler will not be called again
+}
+
+// Returns false if there are responses left in the queue because dispatch budget ran out
+bool TdTransceiverImpl::dispatchResponses()
+{
+    bool     limited   = (m_dispatchTimeBudgetMs != 0) || (m_dispatchItemBudget != 0);
+    gint64   startTime = limited ? g_get_monotonic_time() : 0;
+    unsigned count     = 0;
+    QueuedResponse entry;
+
+    while (1) {
+        if (limited && hasQueuedResponses()) {
+            gint64 now = g_get_monotonic_time();
+            if (((m_dispatchItemBudget != 0) && (count >= m_dispatchItemBudget)) ||
+                ((m_dispatchTimeBudgetMs != 0) && (now - startTime >= (gint64)m_dispatchTimeBudgetMs*1000)))
             {
-                std::unique_lock<std::mutex> lock(m_impl->m_rxMutex);
-                implRef = queueResponse(std::move(response));
+                m_stats.dispatchYielded(m_rxQueue.size() + (m_batch.size() - m_batchPos) + m_presenceLane.size(),
+                                        oldestQueuedAt(), now);
+                return false;
             }
-            g_idle_add(TdTransceiverImpl::rxCallback, implRef);
         }
+
+        if (!nextLanedResponse(entry))
+            break;
+        count++;
+        gint64 now = g_get_monotonic_time();
+        m_stats.responseDequeued(entry.queuedAt, now);
+        dispatchResponse(entry.response, now);
     }
+
+    return true;
 }
 
-int TdTransceiverImpl::rxCallback(gpointer user_data)
+bool TdTransceiverImpl::hasQueuedResponses() const
+{
+    return (m_batchPos < m_batch.size()) || !m_rxQueue.empty() || !m_presenceLane.empty();
+}
+
+gint64 TdTransceiverImpl::oldestQueuedAt() const
+{
+    gint64 result;
+    if (m_batchPos < m_batch.size())
+        result = m_batch[m_batchPos].queuedAt;
+    else
+        result = m_rxQueue.frontQueuedAt();
+
+    if (!m_presenceLane.empty() && ((result == 0) || (m_presenceLane.front().queuedAt < result)))
+        result = m_presenceLane.front().queuedAt;
+    return result;
+}
+
+bool TdTransceiverImpl::isStalePresenceUpdate(const QueuedResponse &entry) const
+{
+    if (entry.response.object && (entry.response.object->get_id() == td::td_api::updateUserStatus::ID)) {
+        auto &statusUpdate = static_cast<const td::td_api::updateUserStatus &>(*entry.response.object);
+        auto  it           = m_userUpdateSequence.find(statusUpdate.user_id_);
+        return (it != m_userUpdateSequence.end()) && (it->second > entry.sequence);
+    }
+    return false;
+}
+
+// Like nextResponse, but takes priority lanes into account
+bool TdTransceiverImpl::nextLanedResponse(QueuedResponse &entry)
 {
-    std::shared_ptr<TdTransceiverImpl> *ppSelf =
-        static_cast<std::shared_ptr<TdTransceiverImpl> *>(user_data);
-    std::shared_ptr<TdTransceiverImpl> &self = *ppSelf;
+    if (!m_priorityLanes) {
+        if (!nextResponse(entry))
+            return false;
+        m_laneDispatched[getResponseLane(entry.response)]++;
+        return true;
+    }
 
     while (1) {
-        td::Client::Response response;
+        bool takePresence = false;
+        if (!m_presenceLane.empty())
+            takePresence = (m_dispatchedSincePresence >= PRESENCE_LANE_SHARE) ||
+                           (g_get_monotonic_time() - m_presenceLane.front().queuedAt >= PRESENCE_LANE_MAX_WAIT_MS*1000);
+
+        if (!takePresence) {
+            if (nextResponse(entry)) {
+                ResponseLane lane = getResponseLane(entry.response);
+                if (lane == LANE_PRESENCE) {
+                    m_presenceLane.push_back(std::move(entry));
+                    continue;
+                }
+
+                if (!m_presenceLane.empty() && entry.response.object &&
+                    (entry.response.object->get_id() == td::td_api::updateUser::ID))
+                {
+                    auto &userUpdate = static_cast<const td::td_api::updateUser &>(*entry.response.object);
+                    if (userUpdate.user_)
+                        m_userUpdateSequence[userUpdate.user_->id_] = entry.sequence;
+                }
+
+                m_dispatchedSincePresence++;
+                m_laneDispatched[lane]++;
+                m_laneMaxWait[lane] = std::max(m_laneMaxWait[lane], g_get_monotonic_time() - entry.queuedAt);
+                return true;
+            }
+            if (m_presenceLane.empty())
+                return false;
+        }
+
+        entry = std::move(m_presenceLane.front());
+        m_presenceLane.pop_front();
+        m_dispatchedSincePresence = 0;
+        if (m_presenceLane.empty())
+            m_userUpdateSequence.clear();
+
+        if (isStalePresenceUpdate(entry))
+            continue;
+        m_laneDispatched[LANE_PRESENCE]++;
+        m_laneMaxWait[LANE_PRESENCE] = std::max(m_laneMaxWait[LANE_PRESENCE],
+                                                g_get_monotonic_time() - entry.queuedAt);
+        return true;
+    }
+}
+
+bool TdTransceiverImpl::nextResponse(QueuedResponse &entry)
+{
+    if (!m_coalesceUpdates) {
+        if (!m_rxQueue.pop(entry))
+            return false;
+        recordArrival(entry);
+        return true;
+    }
+
+    if (m_batchPos == m_batch.size()) {
+        fillBatch();
+        if (m_batch.empty())
+            return false;
+    }
+
+    entry = std::move(m_batch[m_batchPos++]);
+    return true;
+}
+
+void TdTransceiverImpl::fillBatch()
+{
+    m_batch.clear();
+    m_batchPos = 0;
+    // Only take what is queued now - otherwise a steady stream of updates would keep the batch
+    // from ever being dispatched
+    for (size_t available = m_rxQueue.size(); available != 0; available--) {
+        m_batch.emplace_back();
+        if (!m_rxQueue.pop(m_batch.back())) {
+            m_batch.pop_back();
+            break;
+        }
+        recordArrival(m_batch.back());
+    }
+
+    m_coalesceKeys.clear();
+    for (size_t i = 0; i < m_batch.size(); i++) {
+        CoalesceKey key;
+        if ((m_batch[i].response.id == 0) && m_batch[i].response.object &&
+            getCoalesceKey(*m_batch[i].response.object, key))
         {
-            std::unique_lock<std::mutex> lock(self->m_rxMutex);
-            if (self->m_rxQueue.empty())
-                break;
-            response = std::move(self->m_rxQueue.front());
-            self->m_rxQueue.erase(self->m_rxQueue.begin());
+            key.index = i;
+            m_coalesceKeys.push_back(key);
         }
+    }
+    std::sort(m_coalesceKeys.begin(), m_coalesceKeys.end());
+
+    unsigned dropped = 0;
+    m_movedUsers.clear();
+    for (size_t i = 0; i + 1 < m_coalesceKeys.size(); i++) {
+        const CoalesceKey &key  = m_coalesceKeys[i];
+        const CoalesceKey &next = m_coalesceKeys[i+1];
+        if (!key.sameObject(next))
+            continue;
 
-        self->cancelTimer(response.id);
-
-        if (!response.object)
-            ; // impossible
-        else if (!self->m_owner)
-            // m_owner will be NULL if this callback is invoked after TdTransceiver destructor
-            purple_debug_misc(config::pluginId,
-                              "Ignoring response (object id %d) as transceiver is already destroyed\n",
-                              (int)response.object->get_id());
-        else if (response.id == 0)
-            ((self->m_owner)->*(self->m_updateCb))(*response.object);
-        else {
-            TdTransceiver::ResponseCb2 callback = nullptr;
-            auto it = self->m_responseHandlers.find(response.id);
-            if (it != self->m_responseHandlers.end()) {
-                callback = it->second;
-                self->m_responseHandlers.erase(it);
-            } else
-                purple_debug_misc(config::pluginId, "Ignoring response to request %" G_GUINT64_FORMAT "\n",
-                                  response.id);
-            if (callback)
-                callback(response.id, std::move(response.object));
+        if (key.type == COALESCED_USER) {
+            // updateUser is what makes the user known in the first place, and updates in between
+            // may rely on that. So keep the first position with the last contents, and arrival
+            // sequence to go with them.
+            if (!m_movedUsers.empty() && (m_movedUsers.back().first == key.id))
+                m_movedUsers.back().second = next.index;
+            else
+                m_movedUsers.emplace_back(key.id, next.index);
+            m_batch[key.index].response.object = std::move(m_batch[next.index].response.object);
+            m_batch[key.index].sequence        = m_batch[next.index].sequence;
+            m_coalesceKeys[i+1].index = key.index;
+        } else
+            // Others only change state of an existing object, keep the last one where it is
+            m_batch[key.index].response.object = nullptr;
+        dropped++;
+        m_coalescedCount[key.type]++;
+    }
+
+    // Status updates that arrived before the moved updateUser are older than its status, and
+    // would otherwise be applied after it
+    for (const CoalesceKey &key: m_coalesceKeys) {
+        if ((key.type != COALESCED_USER_STATUS) || !m_batch[key.index].response.object)
+            continue;
+        auto moved = std::lower_bound(m_movedUsers.begin(), m_movedUsers.end(),
+                                      std::make_pair(key.id, size_t(0)));
+        if ((moved != m_movedUsers.end()) && (moved->first == key.id) && (key.index < moved->second)) {
+            m_batch[key.index].response.object = nullptr;
+            dropped++;
+            m_coalescedCount[key.type]++;
         }
     }
 
-    std::unique_lock<std::mutex> lock(self->m_rxMutex, std::defer_lock);
-    // owner=NULL means TdTransceiver has been destroyed, so the poll thread is no longer running
-    // and no mutex lock is needed - in fact, it must be avoided because otherwise unlocking the
-    // mutex after clearing the pointer will be use after free.
-    if (self->m_owner)
-        lock.lock();
-    self.reset();
-    delete ppSelf;
+    if (dropped != 0) {
+        m_batch.erase(std::remove_if(m_batch.begin(), m_batch.end(),
+                                     [](const QueuedResponse &entry) { return !entry.response.object; }),
+                      m_batch.end());
+        purple_debug_misc(config::pluginId, "Dropped %u superseded updates out of %zu\n", dropped,
+                          m_batch.size() + dropped);
+    }
+}
+
+// Session recording gets responses as they come off the ring, before coalescing and priority
+// lanes drop or reorder any of them, so that replaying it goes through those stages too
+void TdTransceiverImpl::recordArrival(const QueuedResponse &entry)
+{
+    if (m_recorder && entry.response.object)
+        m_recorder->recordResponse(entry.response.id, *entry.response.object);
+}
 
-    return FALSE; // This idle handler will not be called again
+void TdTransceiverImpl::dispatchResponse(td::Client::Response &response, gint64 now)
+{
+    if (response.id != 0) {
+        cancelTimer(response.id);
+        m_stats.responseDispatched(response.id, now);
+    }
+
+    if (!response.object)
+        ; // impossible
+    else if (!m_owner)
+        // m_owner will be NULL if this callback is invoked after TdTransceiver destructor
+        purple_debug_misc(config::pluginId,
+                          "Ignoring response (object id %d) as transceiver is already destroyed\n",
+                          (int)response.object->get_id());
+    else if (response.id == 0) {
+        (m_owner->*m_updateCb)(*response.object);
+        m_stats.updateHandled(*response.object, g_get_monotonic_time() - now);
+    }
+    else {
+        TdTransceiver::ResponseCb2 callback;
+        if (!m_responseHandlers.extract(response.id, callback))
+            purple_debug_misc(config::pluginId, "Ignoring response to request %" G_GUINT64_FORMAT "\n",
+                              response.id);
+        if (callback)
+            callback(response.id, std::move(response.object));
+    }
 }
 
 uint64_t TdTransceiver::sendQuery(td::td_api::object_ptr<td::td_api::Function> f, ResponseCb2 handler)
@@ -213,9 +1186,14 @@ uint64_t TdTransceiver::sendQuery(td::td_api::object_ptr<td::td_api::Function> f
     uint64_t queryId = ++m_impl->m_lastQueryId;
     purple_debug_misc(config::pluginId, "Sending query id %lu\n", (unsigned long)queryId);
     if (handler)
-        m_impl->m_responseHandlers.emplace(queryId, std::move(handler));
+        m_impl->m_responseHandlers.insert(queryId, std::move(handler));
+    m_impl->m_stats.querySent(queryId, *f, g_get_monotonic_time());
+    if (m_impl->m_recorder)
+        m_impl->m_recorder->recordRequest(queryId, *f);
     if (m_testBackend)
         m_testBackend->send({queryId, std::move(f)});
+    else if (m_impl->m_clientManager)
+        m_impl->m_clientManager->send(m_impl->m_clientId, queryId, std::move(f));
     else
         m_impl->m_client->send({queryId, std::move(f)});
     return queryId;
@@ -236,30 +1214,14 @@ uint64_t TdTransceiver::sendQueryWithTimeout(td::td_api::object_ptr<td::td_api::
                                              ResponseCb2 handler, unsigned timeoutSeconds)
 {
     uint64_t queryId = sendQuery(std::move(f), handler);
-    setQueryTimer(queryId, handler, timeoutSeconds, true);
+    setQueryTimer(queryId, std::move(handler), timeoutSeconds, true);
     return queryId;
 }
 
 void TdTransceiver::setQueryTimer(uint64_t queryId, ResponseCb2 handler, unsigned timeoutSeconds,
                                   bool cancelNormalResponse)
 {
-    TimerInfo timer;
-    timer.data = std::make_unique<TimerCallbackData>();
-    TimerCallbackData *data = timer.data.get();
-
-    data->m_transceiver   = this;
-    data->requestId       = queryId;
-    data->callback        = handler;
-    data->cancelResponse  = cancelNormalResponse;
-
-    guint timerId;
-    if (!m_testBackend)
-        timerId = g_timeout_add_seconds(timeoutSeconds, timerCallback, data);
-    else
-        timerId = m_testBackend->addTimeout(timeoutSeconds, timerCallback, data);
-
-    timer.timerId = timerId;
-    m_impl->m_timers.push_back(std::move(timer));
+    m_impl->setTimer(queryId, std::move(handler), timeoutSeconds, cancelNormalResponse);
 }
 
 void TdTransceiver::setQueryTimer(uint64_t queryId, ResponseCb handler, unsigned timeoutSeconds,
@@ -271,21 +1233,23 @@ void TdTransceiver::setQueryTimer(uint64_t queryId, ResponseCb handler, unsigned
                   }, timeoutSeconds, cancelNormalResponse);
 }
 
-gboolean TdTransceiver::timerCallback(gpointer userdata)
+void ITransceiverBackend::receive(td::Client::Response response)
 {
-    TimerCallbackData *data        = static_cast<TimerCallbackData *>(userdata);
-    TdTransceiver     *transceiver = data->m_transceiver;
-
-    data->callback(data->requestId, nullptr);
-
-    if (data->cancelResponse)
-        transceiver->m_impl->m_responseHandlers.erase(data->requestId);
-    transceiver->m_impl->cancelTimer(data->requestId);
-
-    return FALSE; // one-time callback
+    if (!m_owner->queueResponse(response)) {
+        purple_debug_warning(config::pluginId, "Response queue full, dropping response\n");
+        return;
+    }
+    void *implRef = m_owner->scheduleDispatch();
+    if (implRef)
+        TdTransceiverImpl::rxCallback(implRef);
 }
 
-void ITransceiverBackend::receive(td::Client::Response response)
+void ITransceiverBackend::receive(std::vector<td::Client::Response> responses)
 {
-    TdTransceiverImpl::rxCallback(m_owner->queueResponse(std::move(response)));
+    for (td::Client::Response &response: responses)
+        if (!m_owner->queueResponse(response))
+            purple_debug_warning(config::pluginId, "Response queue full, dropping response\n");
+    void *implRef = m_owner->scheduleDispatch();
+    if (implRef)
+        TdTransceiverImpl::rxCallback(implRef);
 }
@@ -5,24 +5,170 @@
 #include <td/telegram/td_api.hpp>
 #include <thread>
 #include <mutex>
+#include <chrono>
 #include <map>
 #include <atomic>
 #include <purple.h>
 #include <functional>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
 
 class PurpleTdClient;
 class TdTransceiverImpl;
 class TdTransceiver;
 
+// Type-erased response callback, like std::function but keeps callables up to INLINE_SIZE bytes
+// (member function pointer plus object, lambdas capturing a few references and ids) inline
+// instead of allocating them on the heap
+class ResponseHandler {
+public:
+    using TdObjectPtr = td::td_api::object_ptr<td::td_api::Object>;
+    enum {
+        INLINE_SIZE = 48
+    };
+
+    ResponseHandler() noexcept : m_ops(nullptr) {}
+    ResponseHandler(std::nullptr_t) noexcept : m_ops(nullptr) {}
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, ResponseHandler>::value &&
+        std::is_same<decltype(std::declval<typename std::decay<F>::type &>()(uint64_t(), TdObjectPtr())), void>::value
+    >::type>
+    ResponseHandler(F &&f);
+    ResponseHandler(const ResponseHandler &other);
+    ResponseHandler(ResponseHandler &&other) noexcept;
+    ResponseHandler &operator=(const ResponseHandler &other);
+    ResponseHandler &operator=(ResponseHandler &&other) noexcept;
+    ~ResponseHandler() { reset(); }
+
+    explicit operator bool() const { return (m_ops != nullptr); }
+    void     operator()(uint64_t requestId, TdObjectPtr object) const;
+    void     reset();
+private:
+    struct Ops {
+        void (*invoke)(void *storage, uint64_t requestId, TdObjectPtr object);
+        void (*copy)(const void *from, void *to);
+        // Move-constructs into destination and destroys the source
+        void (*move)(void *from, void *to);
+        void (*destroy)(void *storage);
+    };
+
+    template<typename F>
+    using FitsInline = std::integral_constant<bool,
+        (sizeof(F) <= INLINE_SIZE) && (alignof(F) <= alignof(std::max_align_t)) &&
+        std::is_nothrow_move_constructible<F>::value>;
+
+    // Dispatched at compile time so that oversized callables never get placement-new'ed into
+    // m_storage, not even in a branch that is never taken
+    template<typename Callable, typename F>
+    void construct(F &&f, std::true_type /* fits inline */);
+    template<typename Callable, typename F>
+    void construct(F &&f, std::false_type /* fits inline */);
+
+    template<typename F>
+    struct InlineOps {
+        static void invoke(void *storage, uint64_t requestId, TdObjectPtr object)
+        {
+            (*static_cast<F *>(storage))(requestId, std::move(object));
+        }
+        static void copy(const void *from, void *to) { new (to) F(*static_cast<const F *>(from)); }
+        static void move(void *from, void *to)
+        {
+            new (to) F(std::move(*static_cast<F *>(from)));
+            static_cast<F *>(from)->~F();
+        }
+        static void destroy(void *storage) { static_cast<F *>(storage)->~F(); }
+        static const Ops ops;
+    };
+
+    template<typename F>
+    struct HeapOps {
+        static F *&ptr(void *storage) { return *static_cast<F **>(storage); }
+        static void invoke(void *storage, uint64_t requestId, TdObjectPtr object)
+        {
+            (*ptr(storage))(requestId, std::move(object));
+        }
+        static void copy(const void *from, void *to)
+        {
+            new (to) F*(new F(**static_cast<F * const *>(from)));
+        }
+        static void move(void *from, void *to) { new (to) F*(ptr(from)); }
+        static void destroy(void *storage) { delete ptr(storage); }
+        static const Ops ops;
+    };
+
+    alignas(std::max_align_t) mutable unsigned char m_storage[INLINE_SIZE];
+    const Ops *m_ops;
+};
+
+template<typename F>
+const ResponseHandler::Ops ResponseHandler::InlineOps<F>::ops = {
+    &InlineOps<F>::invoke, &InlineOps<F>::copy, &InlineOps<F>::move, &InlineOps<F>::destroy
+};
+
+template<typename F>
+const ResponseHandler::Ops ResponseHandler::HeapOps<F>::ops = {
+    &HeapOps<F>::invoke, &HeapOps<F>::copy, &HeapOps<F>::move, &HeapOps<F>::destroy
+};
+
+template<typename Callable, typename F>
+void ResponseHandler::construct(F &&f, std::true_type)
+{
+    new (m_storage) Callable(std::forward<F>(f));
+    m_ops = &InlineOps<Callable>::ops;
+}
+
+template<typename Callable, typename F>
+void ResponseHandler::construct(F &&f, std::false_type)
+{
+    new (m_storage) Callable*(new Callable(std::forward<F>(f)));
+    m_ops = &HeapOps<Callable>::ops;
+}
+
+template<typename F, typename>
+ResponseHandler::ResponseHandler(F &&f)
+{
+    using Callable = typename std::decay<F>::type;
+    construct<Callable>(std::forward<F>(f), FitsInline<Callable>());
+}
+
+// Response handlers keyed by request id. Request ids are sequential, so a table indexed by
+// request id modulo table size has no collisions as long as outstanding requests are not too far
+// apart. The odd request that stays unanswered for a long time goes to the overflow map.
+class ResponseHandlerTable {
+public:
+    ResponseHandlerTable();
+    void   insert(uint64_t requestId, ResponseHandler &&handler);
+    // Moves the handler out and removes it from the table
+    bool   extract(uint64_t requestId, ResponseHandler &handler);
+    bool   erase(uint64_t requestId);
+    size_t size() const { return m_count; }
+private:
+    struct Slot {
+        uint64_t        requestId; // 0 means empty slot
+        ResponseHandler handler;
+    };
+    std::vector<Slot>                             m_slots;
+    std::unordered_map<uint64_t, ResponseHandler> m_overflow;
+    size_t                                        m_count;
+
+    void grow();
+};
+
 class ITransceiverBackend {
 public:
     virtual ~ITransceiverBackend() {}
 
     void          setOwner(TdTransceiver *owner) { m_owner = owner; }
     virtual void  send(td::Client::Request &&request) = 0;
+    // Interval is in milliseconds
     virtual guint addTimeout(guint interval, GSourceFunc function, gpointer data) = 0;
     virtual void  cancelTimer(guint id) = 0;
     void          receive(td::Client::Response response);
+    // Several responses that arrive before main thread gets to dispatch any of them
+    void          receive(std::vector<td::Client::Response> responses);
 private:
     TdTransceiver *m_owner = nullptr;
 };
@@ -35,7 +181,7 @@ private:
     using TdObjectPtr = td::td_api::object_ptr<td::td_api::Object>;
 public:
     using ResponseCb  = void (PurpleTdClient::*)(uint64_t requestId, TdObjectPtr object);
-    using ResponseCb2 = std::function<void(uint64_t, TdObjectPtr)>;
+    using ResponseCb2 = ResponseHandler;
     using UpdateCb    = void (PurpleTdClient::*)(td::td_api::Object &object);
 
     TdTransceiver(PurpleTdClient *owner, PurpleAccount *account, UpdateCb updateCb,
@@ -50,16 +196,23 @@ public:
                            bool cancelNormalResponse);
     void     setQueryTimer(uint64_t queryId, ResponseCb2 handler, unsigned timeoutSeconds,
                            bool cancelNormalResponse);
+    // Timing statistics and queue depth as a single-line JSON object
+    std::string getStatistics() const;
+    // Main loop timeout, or test backend timeout when testing. Interval is in milliseconds.
+    guint    addTimeout(guint interval, GSourceFunc function, gpointer data);
+    void     cancelTimeout(guint id);
 private:
     void  pollThreadLoop();
-    void *queueResponse(td::Client::Response &&response);
-    static gboolean timerCallback(gpointer userdata);
+    static int logStatistics(gpointer user_data);
+    bool  queueResponse(td::Client::Response &response);
+    void *scheduleDispatch();
 
     std::shared_ptr<TdTransceiverImpl>  m_impl;
     PurpleAccount                      *m_account;
     std::thread                         m_pollThread;
     std::atomic_bool                    m_stopThread;
     ITransceiverBackend                *m_testBackend;
+    guint                               m_statsTimer;
 };
 
 #endif